@@ -17,6 +17,8 @@
 
 #include "MadgwickAHRS.h"
 #include <math.h>
+#include <stdint.h>
+#include <string.h>
 
 //---------------------------------------------------------------------------------------------------
 // Definitions
@@ -215,9 +217,10 @@ void MadgwickAHRSupdateIMU(float gx, float gy, float gz, float ax, float ay, flo
 float invSqrt(float x) {
 	float halfx = 0.5f * x;
 	float y = x;
-	long i = *(long*)&y;
+	int32_t i;
+	memcpy(&i, &y, sizeof(i));	// a 32-bit integer and memcpy, so this also works where long is 64 bits (the host replay tool)
 	i = 0x5f3759df - (i>>1);
-	y = *(float*)&i;
+	memcpy(&y, &i, sizeof(y));
 	y = y * (1.5f - (halfx * y * y));
 	return y;
 }
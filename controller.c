@@ -0,0 +1,120 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include "controller.h"
+#include "MadgwickAHRS.h"
+#include <math.h>
+
+volatile float controller_parameters[PARAMETER_COUNT] = {
+	12000.0f, 5.90f,
+	500.0f,   0.27f,
+	16000.0f, 7.85f,
+	1000.0f,
+	0.7f
+};
+
+static float integral = 0;
+static float previous_error = 0;
+
+/**
+ * Runs the filter and the PID loop for one sensor sample.
+ *
+ * @param inputs     Sensor readings and radio inputs
+ * @param outputs    Where the pitch, PID terms and motor speeds are written
+ */
+void controller_update(const struct controller_inputs *inputs, struct controller_outputs *outputs) {
+
+	// sensor fusion with Madgwick's Filter
+	// MadgwickAHRSupdate(inputs->gyro_z, inputs->gyro_y, -inputs->gyro_x, inputs->accel_z, inputs->accel_y, -inputs->accel_x,
+	//                    inputs->magn_z, inputs->magn_y, -inputs->magn_x);
+	MadgwickAHRSupdateIMU(inputs->gyro_z, inputs->gyro_y, -inputs->gyro_x, inputs->accel_z, inputs->accel_y, -inputs->accel_x);
+
+	// calculate the pitch angle so that:    0 = vertical    -pi/2 = on its back    +pi/2 = on its face
+	float pitch = asinf(-2.0f * (q1*q3 - q0*q2));
+
+	// calculate the set point (desired angle) and error (difference between the current angle and desired angle)
+	// since there are no wheel encoders, only throttle affects the set point
+	// mapping throttle to an angle so that:  0 = no throttle    -pi/10 = full speed reverse    +pi/10 = full speed forward
+	float set_point = inputs->gimbal_y / 1400.0f * 0.314159265f;
+	float error = pitch - set_point;
+
+	// calculate the proportional component (current error * p scalar)
+	float p_scalar = controller_parameters[P_GAIN] + (inputs->knob_left - 2048.0f) * controller_parameters[P_GAIN_PER_KNOB];
+	if(p_scalar < 0) p_scalar = 0;
+	float proportional = error * p_scalar;
+
+	// calculate the integral component (summation of past errors * i scalar)
+	float i_scalar = controller_parameters[I_GAIN] + (inputs->knob_middle - 2048.0f) * controller_parameters[I_GAIN_PER_KNOB];
+	if(i_scalar < 0) i_scalar = 0;
+	integral += error * i_scalar;
+	float integral_limit = controller_parameters[INTEGRAL_LIMIT];
+	if(integral >  integral_limit) integral =  integral_limit; // limit wind-up
+	if(integral < -integral_limit) integral = -integral_limit;
+
+	// calculate the derivative component (change since previous error * d scalar)
+	float d_scalar = controller_parameters[D_GAIN] + (inputs->knob_right - 2048.0f) * controller_parameters[D_GAIN_PER_KNOB];
+	if(d_scalar < 0) d_scalar = 0;
+	float derivative = (error - previous_error) * d_scalar;
+	previous_error = error;
+
+	int32_t motor_a_speed = proportional + integral + derivative;
+	int32_t motor_b_speed = proportional + integral + derivative;
+
+	// apply steering
+	motor_a_speed += inputs->gimbal_x / 2;
+	motor_b_speed -= inputs->gimbal_x / 2;
+
+	// stop the motors if we're far from vertical since there is no chance of success
+	float tilt_limit = controller_parameters[TILT_LIMIT];
+	uint8_t stopped = (pitch < -tilt_limit || pitch > tilt_limit);
+	if(stopped) {
+		motor_a_speed = 0;
+		motor_b_speed = 0;
+	}
+
+	outputs->pitch = pitch;
+	outputs->set_point = set_point;
+	outputs->error = error;
+	outputs->p_scalar = p_scalar;
+	outputs->proportional = proportional;
+	outputs->i_scalar = i_scalar;
+	outputs->integral = integral;
+	outputs->d_scalar = d_scalar;
+	outputs->derivative = derivative;
+	outputs->motor_a_speed = motor_a_speed;
+	outputs->motor_b_speed = motor_b_speed;
+	outputs->stopped = stopped;
+
+}
+
+/**
+ * Reads the controller's state: the filter's quaternion, the integral and the previous error.
+ *
+ * @param state    State to read into
+ */
+void controller_get_state(struct controller_state *state) {
+
+	state->q0 = q0;
+	state->q1 = q1;
+	state->q2 = q2;
+	state->q3 = q3;
+	state->integral = integral;
+	state->previous_error = previous_error;
+
+}
+
+/**
+ * Replaces the controller's state, such as to resume a replay from a recorded point.
+ *
+ * @param state    State to restore
+ */
+void controller_set_state(const struct controller_state *state) {
+
+	q0 = state->q0;
+	q1 = state->q1;
+	q2 = state->q2;
+	q3 = state->q3;
+	integral = state->integral;
+	previous_error = state->previous_error;
+
+}
@@ -0,0 +1,63 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * The balancing controller: Madgwick's filter for the pitch angle, then a PID loop that turns the pitch error into
+ * motor speeds. It has no hardware dependencies, so the host can replay recorded telemetry through the same code.
+ */
+
+// controller parameters, which can be changed with COMMAND_SET_PARAMETER. The knobs trim the gains around their base values.
+enum PARAMETER {
+	P_GAIN, P_GAIN_PER_KNOB,
+	I_GAIN, I_GAIN_PER_KNOB,
+	D_GAIN, D_GAIN_PER_KNOB,
+	INTEGRAL_LIMIT,
+	TILT_LIMIT,
+	PARAMETER_COUNT
+};
+
+extern volatile float controller_parameters[PARAMETER_COUNT];
+
+struct controller_inputs {
+	float accel_x, accel_y, accel_z;         // G
+	float gyro_x, gyro_y, gyro_z;            // rad/s
+	float magn_x, magn_y, magn_z;            // Gs, unused while the filter runs without the magnetometer
+	float gimbal_x, gimbal_y;                // radio inputs, as received
+	float knob_left, knob_middle, knob_right;
+};
+
+struct controller_outputs {
+	float pitch;                             // 0 = vertical, -pi/2 = on its back, +pi/2 = on its face
+	float set_point, error;
+	float p_scalar, proportional;
+	float i_scalar, integral;
+	float d_scalar, derivative;
+	int32_t motor_a_speed, motor_b_speed;
+	uint8_t stopped;                         // 1 if the motors are stopped because the robot is too far from vertical
+};
+
+// everything carried from one update to the next
+struct controller_state {
+	float q0, q1, q2, q3;
+	float integral;
+	float previous_error;
+};
+
+/**
+ * Runs the filter and the PID loop for one sensor sample.
+ *
+ * @param inputs     Sensor readings and radio inputs
+ * @param outputs    Where the pitch, PID terms and motor speeds are written
+ */
+void controller_update(const struct controller_inputs *inputs, struct controller_outputs *outputs);
+
+/**
+ * Reads or replaces the controller's state, such as to resume a replay from a recorded point.
+ *
+ * @param state    State to read into, or to restore
+ */
+void controller_get_state(struct controller_state *state);
+void controller_set_state(const struct controller_state *state);
@@ -27,5 +27,7 @@
 #include "f0lib_lcd_ili9163.h"
 #include "f0lib_flash.h"
 #include "f0lib_uart.h"
+#include "f0lib_telemetry.h"
+#include "f0lib_dashboard.h"
 
 #endif
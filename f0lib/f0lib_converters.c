@@ -121,3 +121,121 @@ char* fixed_point_number_to_string(uint8_t leading_places, uint8_t trailing_plac
 
 	return numString;
 }
+
+/**
+ * Writes a uint32_t as a decimal string, without padding.
+ *
+ * @param num		The uint32_t to convert
+ * @param buffer	Destination, with room for at least 11 characters
+ * @returns		Number of characters written, not counting the null terminator
+ */
+uint8_t uint32_to_dec_buffer(uint32_t num, char *buffer) {
+	char digits[10];
+	uint8_t count = 0;
+
+	do {
+		digits[count++] = (num % 10) + 48;
+		num /= 10;
+	} while(num);
+
+	for(uint8_t i = 0; i < count; i++)
+		buffer[i] = digits[count - 1 - i];
+	buffer[count] = 0;
+
+	return count;
+}
+
+/**
+ * Writes a float as a decimal string with a fixed number of decimal places, like printf("%.*f", decimals, value).
+ * The result is rounded correctly (ties to even) using integer math only, so it matches printf for magnitudes below 2^63.
+ * Larger magnitudes are written as "ovf".
+ *
+ * @param value		The float to convert
+ * @param decimals	Digits after the decimal point, 0 to 9
+ * @param buffer	Destination, with room for at least 32 characters
+ * @returns		Number of characters written, not counting the null terminator
+ */
+uint8_t float_to_dec_buffer(float value, uint8_t decimals, char *buffer) {
+	static const uint32_t powers_of_ten[10] = {1, 10, 100, 1000, 10000, 100000, 1000000, 10000000, 100000000, 1000000000};
+	union {float f; uint32_t u;} bits = {value};
+	const char *text = 0;
+	uint8_t n = 0;
+
+	if(decimals > 9)
+		decimals = 9;
+
+	if(bits.u & 0x80000000)
+		buffer[n++] = '-';
+
+	// value = mantissa * 2^shift
+	int32_t exponent = (bits.u >> 23) & 0xFF;
+	uint32_t mantissa = bits.u & 0x7FFFFF;
+	if(exponent == 0xFF)
+		text = mantissa ? "nan" : "inf";
+	else if(exponent > 150 + 39)
+		text = "ovf";
+	if(text) {
+		while(*text)
+			buffer[n++] = *text++;
+		buffer[n] = 0;
+		return n;
+	}
+	if(exponent == 0)
+		exponent = 1; // subnormal
+	else
+		mantissa |= 0x800000;
+	int32_t shift = exponent - 150;
+
+	// split into the integer part and the fraction in units of 10^-decimals
+	uint64_t integer = 0;
+	uint32_t fraction = 0;
+	if(shift >= 0) {
+		integer = (uint64_t) mantissa << shift;
+	} else if(shift > -64) {
+		uint32_t s = -shift;
+		uint64_t fraction_bits = mantissa;
+		if(s < 24) {
+			integer = mantissa >> s;
+			fraction_bits = mantissa & ((1 << s) - 1);
+		}
+		uint64_t product = fraction_bits * powers_of_ten[decimals]; // < 2^54
+		fraction = product >> s;
+		uint64_t remainder = product - ((uint64_t) fraction << s);
+		uint64_t half = (uint64_t) 1 << (s - 1);
+		uint32_t last_digit = decimals ? fraction : (uint32_t) integer;
+		if(remainder > half || (remainder == half && (last_digit & 1))) {
+			fraction++;
+			if(fraction == powers_of_ten[decimals]) {
+				fraction = 0;
+				integer++;
+			}
+		}
+	} // else the magnitude is below 2^-40 and rounds to zero
+
+	// integer part
+	if(integer >> 32) {
+		char digits[20];
+		uint8_t count = 0;
+		while(integer) {
+			digits[count++] = (integer % 10) + 48;
+			integer /= 10;
+		}
+		while(count)
+			buffer[n++] = digits[--count];
+	} else {
+		n += uint32_to_dec_buffer(integer, &buffer[n]);
+	}
+
+	// fraction, with leading zeros
+	if(decimals) {
+		buffer[n++] = '.';
+		for(int8_t i = decimals - 1; i >= 0; i--) {
+			buffer[n + i] = (fraction % 10) + 48;
+			fraction /= 10;
+		}
+		n += decimals;
+	}
+
+	buffer[n] = 0;
+	return n;
+}
@@ -38,3 +38,24 @@ char* uint32_to_dec_string(uint32_t num);
 char* int16_to_dec_string(int16_t num);
 
 char* fixed_point_number_to_string(uint8_t leading_places, uint8_t trailing_places, uint32_t num);
+
+/**
+ * Writes a uint32_t as a decimal string, without padding.
+ *
+ * @param num		The uint32_t to convert
+ * @param buffer	Destination, with room for at least 11 characters
+ * @returns		Number of characters written, not counting the null terminator
+ */
+uint8_t uint32_to_dec_buffer(uint32_t num, char *buffer);
+
+/**
+ * Writes a float as a decimal string with a fixed number of decimal places, like printf("%.*f", decimals, value).
+ * The result is rounded correctly (ties to even) using integer math only, so it matches printf for magnitudes below 2^63.
+ * Larger magnitudes are written as "ovf".
+ *
+ * @param value		The float to convert
+ * @param decimals	Digits after the decimal point, 0 to 9
+ * @param buffer	Destination, with room for at least 32 characters
+ * @returns		Number of characters written, not counting the null terminator
+ */
+uint8_t float_to_dec_buffer(float value, uint8_t decimals, char *buffer);
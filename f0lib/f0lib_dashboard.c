@@ -0,0 +1,172 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include "f0lib_dashboard.h"
+#include "f0lib_uart.h"
+#include "f0lib_converters.h"
+#include <string.h>
+
+// unchanged characters shorter than a cursor move are resent rather than skipped
+#define DASHBOARD_GAP 8
+
+static char shadow[DASHBOARD_ROWS][DASHBOARD_COLUMNS];  // what the terminal currently shows
+static uint8_t row = 0;                                 // next row to render
+static uint8_t redraw = 1;
+static uint8_t changed = 0;                             // something was appended to the TX buffer
+static uint8_t full = 0;                                // the TX slot filled up during this update
+
+/**
+ * Starts an update. The first update after power up or dashboard_redraw() also clears the terminal and hides the cursor.
+ */
+void dashboard_begin(void) {
+
+	uart_reset_tx_buffer();
+	row = 0;
+	changed = 0;
+	full = 0;
+
+	if(redraw) {
+		uart_append_text("\x1B[2J\x1B[?25l", 10);
+		memset(shadow, ' ', sizeof(shadow));
+		redraw = 0;
+		changed = 1;
+	}
+
+}
+
+/**
+ * Compares a rendered row with the shadow, and appends cursor moves and the changed characters to the TX buffer.
+ * The shadow is only updated for the changes that fit.
+ */
+static void dashboard_update_row(uint8_t r, const char line[DASHBOARD_COLUMNS]) {
+
+	uint8_t column = 0;
+
+	while(column < DASHBOARD_COLUMNS && !full) {
+
+		if(line[column] == shadow[r][column]) {
+			column++;
+			continue;
+		}
+
+		// find the end of this run of changes, joining runs separated by short gaps
+		uint8_t first = column;
+		uint8_t last = column;
+		for(uint8_t k = column + 1; k < DASHBOARD_COLUMNS && k <= last + DASHBOARD_GAP; k++)
+			if(line[k] != shadow[r][k])
+				last = k;
+		uint8_t count = last - first + 1;
+
+		// move the cursor (rows and columns start at 1) then write the characters
+		char text[DASHBOARD_COLUMNS + 12];
+		uint8_t n = 0;
+		text[n++] = '\x1B';
+		text[n++] = '[';
+		n += uint32_to_dec_buffer(r + 1, &text[n]);
+		text[n++] = ';';
+		n += uint32_to_dec_buffer(first + 1, &text[n]);
+		text[n++] = 'H';
+		memcpy(&text[n], &line[first], count);
+		n += count;
+
+		if(!uart_append_text(text, n)) {
+			full = 1;
+			return;
+		}
+
+		memcpy(&shadow[r][first], &line[first], count);
+		changed = 1;
+		column = last + 1;
+
+	}
+
+}
+
+/**
+ * Renders the next row as an ASCII line graph, and appends whatever changed to the TX buffer.
+ * Rows beyond DASHBOARD_ROWS are ignored, and each row is cut off after DASHBOARD_COLUMNS characters.
+ *
+ * @param name    A text to show at the left of the graph
+ * @param value   The value to be graphed and also shown at the right of the graph
+ * @param unit    The text to be shown at the right of the graph
+ * @param min     Sets the scale of the graph
+ * @param max     Sets the scale of the graph
+ */
+void dashboard_graph(const char *name, float value, const char *unit, float min, float max) {
+
+	if(row >= DASHBOARD_ROWS)
+		return;
+
+	// render the row, padded with spaces
+	char line[DASHBOARD_COLUMNS + 48];
+	uint8_t n = 0;
+
+	while(*name && n < DASHBOARD_COLUMNS)
+		line[n++] = *name++;
+
+	float percentage = (value - min) / (max - min);
+	int dot_location = (percentage >= 0.0f && percentage <= 1.0f) ? (DASHBOARD_GRAPH_LENGTH - 1.0f) * percentage : -1;
+
+	line[n++] = ' ';
+	line[n++] = '[';
+	for(uint8_t j = 0; j < DASHBOARD_GRAPH_LENGTH; j++)
+		line[n++] = (j == dot_location) ? '*' : ' ';
+	line[n++] = ']';
+	line[n++] = ' ';
+
+	// sign, value, and unit
+	if(value >= 0.0f) {
+		line[n++] = '+';
+	} else {
+		line[n++] = '-';
+		value *= -1.0f;
+	}
+	char digits[32];
+	uint8_t length = float_to_dec_buffer(value, 3, digits);
+	if(length > 12)
+		length = 12;
+	memcpy(&line[n], digits, length);
+	n += length;
+	line[n++] = ' ';
+
+	while(*unit && n < DASHBOARD_COLUMNS)
+		line[n++] = *unit++;
+
+	while(n < DASHBOARD_COLUMNS)
+		line[n++] = ' ';
+
+	dashboard_update_row(row++, line);
+
+}
+
+/**
+ * Blanks any rows that were drawn by the previous update but not by this one, then sends the changes (if any.)
+ */
+void dashboard_end(void) {
+
+	char blank[DASHBOARD_COLUMNS];
+	memset(blank, ' ', sizeof(blank));
+	while(row < DASHBOARD_ROWS)
+		dashboard_update_row(row++, blank);
+
+	if(!changed) {
+		uart_reset_tx_buffer();
+		return;
+	}
+
+	// if the frame is dropped, the terminal no longer matches the shadow
+	uint32_t dropped = uart_get_statistics()->frames_dropped;
+	uart_tx_via_dma();
+	if(uart_get_statistics()->frames_dropped != dropped)
+		redraw = 1;
+
+}
+
+/**
+ * Makes the next update clear the terminal and draw everything again, such as when a terminal is (re)connected.
+ */
+void dashboard_redraw(void) {
+
+	redraw = 1;
+
+}
@@ -0,0 +1,58 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * A terminal dashboard of ASCII line graphs, sent with f0lib_uart. The rows look like uart_append_ascii_graph():
+ *
+ * X Acceleration     [          *                   ] -0.985 G
+ *
+ * A shadow copy of the screen is kept, and each update only sends ANSI cursor moves and the characters that changed.
+ * If an update doesn't fit in a TX slot, the rest of the changes are sent with the next update.
+ *
+ * Usage, for each update:
+ *
+ * dashboard_begin();
+ * dashboard_graph("X Acceleration    ", accel_x, "G", -2.0f, 2.0f);
+ * ...
+ * dashboard_end();
+ */
+
+#ifndef DASHBOARD_ROWS
+#define DASHBOARD_ROWS 12
+#endif
+#ifndef DASHBOARD_COLUMNS
+#define DASHBOARD_COLUMNS 72
+#endif
+
+// width of the graph between the [ and ]
+#define DASHBOARD_GRAPH_LENGTH 30
+
+/**
+ * Starts an update. The first update after power up or dashboard_redraw() also clears the terminal and hides the cursor.
+ */
+void dashboard_begin(void);
+
+/**
+ * Renders the next row as an ASCII line graph, and appends whatever changed to the TX buffer.
+ * Rows beyond DASHBOARD_ROWS are ignored, and each row is cut off after DASHBOARD_COLUMNS characters.
+ *
+ * @param name    A text to show at the left of the graph
+ * @param value   The value to be graphed and also shown at the right of the graph
+ * @param unit    The text to be shown at the right of the graph
+ * @param min     Sets the scale of the graph
+ * @param max     Sets the scale of the graph
+ */
+void dashboard_graph(const char *name, float value, const char *unit, float min, float max);
+
+/**
+ * Blanks any rows that were drawn by the previous update but not by this one, then sends the changes (if any.)
+ */
+void dashboard_end(void);
+
+/**
+ * Makes the next update clear the terminal and draw everything again, such as when a terminal is (re)connected.
+ */
+void dashboard_redraw(void);
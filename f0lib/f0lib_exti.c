@@ -4,10 +4,14 @@
 #include "stm32f0xx.h"
 #include "f0lib_exti.h"
 #include "f0lib_gpio.h"
+#include "f0lib_timers.h"
 
 // array of event handler function pointers
 static void (*exti_handler[16])(void) = {0};
 
+// time of the most recent interrupt for each pin number
+static volatile uint32_t exti_timestamp[16] = {0};
+
 /**
  * Configures an external interrupt.
  * EXTI0 can be pin 0 of any gpio port, EXTI1 can be pin 1 of any gpio port, etc.
@@ -93,18 +97,33 @@ void exti_trigger(enum GPIO_PIN pin) {
 }
 
 /**
- * ISR for External Interrupts 0 and 1. Clears the interrupts and calls the handlers.
+ * Gets the time of the most recent interrupt on a pin. The time is read from timer_microseconds() as soon as the ISR
+ * starts, before the handler is called, so it is not affected by how long earlier handlers took to run.
+ *
+ * @param pin		GPIO pin associated with the interrupt.
+ * @returns			Microseconds, or 0 if timer_microseconds_setup() has not been called
+ */
+uint32_t exti_get_timestamp(enum GPIO_PIN pin) {
+	return exti_timestamp[pin%16];
+}
+
+/**
+ * ISR for External Interrupts 0 and 1. Records the time, clears the interrupts and calls the handlers.
  */
 void EXTI0_1_IRQHandler(void) {
 
+	uint32_t now = timer_microseconds();
+
 	if(EXTI->PR & EXTI_PR_PR0) {
 
 		EXTI->PR = EXTI_PR_PR0;
+		exti_timestamp[0] = now;
 		if(exti_handler[0]) exti_handler[0]();
 
 	} else if(EXTI->PR & EXTI_PR_PR1) {
 
 		EXTI->PR = EXTI_PR_PR1;
+		exti_timestamp[1] = now;
 		if(exti_handler[1]) exti_handler[1]();
 
 	}
@@ -112,18 +131,22 @@ void EXTI0_1_IRQHandler(void) {
 }
 
 /**
- * ISR for External Interrupts 2 and 3. Clears the interrupts and calls the handlers.
+ * ISR for External Interrupts 2 and 3. Records the time, clears the interrupts and calls the handlers.
  */
 void EXTI2_3_IRQHandler(void) {
 
+	uint32_t now = timer_microseconds();
+
 	if(EXTI->PR & EXTI_PR_PR2) {
 
 		EXTI->PR = EXTI_PR_PR2;
+		exti_timestamp[2] = now;
 		if(exti_handler[2]) exti_handler[2]();
 
 	} else if(EXTI->PR & EXTI_PR_PR3) {
 
 		EXTI->PR = EXTI_PR_PR3;
+		exti_timestamp[3] = now;
 		if(exti_handler[3]) exti_handler[3]();
 
 	}
@@ -131,68 +154,82 @@ void EXTI2_3_IRQHandler(void) {
 }
 
 /**
- * ISR for External Interrupts 4 through 15. Clears the interrupts and calls the handlers.
+ * ISR for External Interrupts 4 through 15. Records the time, clears the interrupts and calls the handlers.
  */
 void EXTI4_15_IRQHandler(void) {
 
+	uint32_t now = timer_microseconds();
+
 	if(EXTI->PR & EXTI_PR_PR4) {
 
 		EXTI->PR = EXTI_PR_PR4;
+		exti_timestamp[4] = now;
 		if(exti_handler[4]) exti_handler[4]();
 
 	} else if(EXTI->PR & EXTI_PR_PR5) {
 
 		EXTI->PR = EXTI_PR_PR5;
+		exti_timestamp[5] = now;
 		if(exti_handler[5]) exti_handler[5]();
 
 	} else if(EXTI->PR & EXTI_PR_PR6) {
 
 		EXTI->PR = EXTI_PR_PR6;
+		exti_timestamp[6] = now;
 		if(exti_handler[6]) exti_handler[6]();
 
 	} else if(EXTI->PR & EXTI_PR_PR7) {
 
 		EXTI->PR = EXTI_PR_PR7;
+		exti_timestamp[7] = now;
 		if(exti_handler[7]) exti_handler[7]();
 
 	} else if(EXTI->PR & EXTI_PR_PR8) {
 
 		EXTI->PR = EXTI_PR_PR8;
+		exti_timestamp[8] = now;
 		if(exti_handler[8]) exti_handler[8]();
 
 	} else if(EXTI->PR & EXTI_PR_PR9) {
 
 		EXTI->PR = EXTI_PR_PR9;
+		exti_timestamp[9] = now;
 		if(exti_handler[9]) exti_handler[9]();
 
 	} else if(EXTI->PR & EXTI_PR_PR10) {
 
 		EXTI->PR = EXTI_PR_PR10;
+		exti_timestamp[10] = now;
 		if(exti_handler[10]) exti_handler[10]();
 
 	} else if(EXTI->PR & EXTI_PR_PR11) {
 
 		EXTI->PR = EXTI_PR_PR11;
+		exti_timestamp[11] = now;
 		if(exti_handler[11]) exti_handler[11]();
 
 	} else if(EXTI->PR & EXTI_PR_PR12) {
 
 		EXTI->PR = EXTI_PR_PR12;
+		exti_timestamp[12] = now;
 		if(exti_handler[12]) exti_handler[12]();
 
 	} else if(EXTI->PR & EXTI_PR_PR13) {
 
 		EXTI->PR = EXTI_PR_PR13;
+		exti_timestamp[13] = now;
 		if(exti_handler[13]) exti_handler[13]();
 
 	} else if(EXTI->PR & EXTI_PR_PR14) {
 
 		EXTI->PR = EXTI_PR_PR14;
+		exti_timestamp[14] = now;
 		if(exti_handler[14]) exti_handler[14]();
 
 	} else if(EXTI->PR & EXTI_PR_PR15) {
 
 		EXTI->PR = EXTI_PR_PR15;
+		exti_timestamp[15] = now;
 		if(exti_handler[15]) exti_handler[15]();
 
 	}
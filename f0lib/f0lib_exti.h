@@ -33,3 +33,12 @@ void exti_setup(enum GPIO_PIN pin, enum GPIO_PULL pull, enum EXTI_EDGE edge, voi
  * @param pin		GPIO pin associated with the interrupt.
  */
 void exti_trigger(enum GPIO_PIN pin);
+
+/**
+ * Gets the time of the most recent interrupt on a pin. The time is read from timer_microseconds() as soon as the ISR
+ * starts, before the handler is called, so it is not affected by how long earlier handlers took to run.
+ *
+ * @param pin		GPIO pin associated with the interrupt.
+ * @returns			Microseconds, or 0 if timer_microseconds_setup() has not been called
+ */
+uint32_t exti_get_timestamp(enum GPIO_PIN pin);
@@ -50,3 +50,7 @@ uint8_t flash_write_page(uint8_t pageNum, void* data, uint32_t byteCount) {
 
 	return returnValue;
 }
+
+const void* flash_page_address(uint8_t pageNum) {
+	return (const void*) (0x08000000 + (0x400 * pageNum));	// flash is memory mapped, so data can be read in place
+}
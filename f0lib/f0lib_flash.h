@@ -8,6 +8,8 @@ uint8_t flash_erase_page(uint8_t pageNum);
 
 uint8_t flash_write_page(uint8_t pageNum, void* data, uint32_t byteCount);
 
+const void* flash_page_address(uint8_t pageNum);
+
 // flash write testing /////////////////////////////////////////////////////////////////
 /*
 struct persistent_data {
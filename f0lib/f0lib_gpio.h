@@ -20,31 +20,35 @@ enum GPIO_PULL {NO_PULL, PULL_UP, PULL_DOWN};
 enum GPIO_AF {AF0, AF1, AF2, AF3, AF4, AF5, AF6, AF7};
 
 inline void gpio_high(enum GPIO_PIN pin) {
-	*(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x18) = (1 << (pin % 16));
+	*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x18) = (1 << (pin % 16));
 }
 
 inline void gpio_low(enum GPIO_PIN pin) {
-	*(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x28) = (1 << (pin % 16));
+	*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x28) = (1 << (pin % 16));
+}
+
+inline uint8_t gpio_read(enum GPIO_PIN pin) {
+	return (*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x10) >> (pin % 16)) & 1;
 }
 
 inline void gpio_set_mode(enum GPIO_PIN pin, enum GPIO_MODE mode) {
-	uint32_t value = *(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x00);
+	uint32_t value = *(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x00);
 	if(mode == INPUT) {
 		value &= ~(1 << 2 * (pin % 16));
 		value &= ~(1 << 2 * (pin % 16) + 1);
-		*(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x00) = value;
+		*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x00) = value;
 	} else if(mode == OUTPUT) {
 		value |= (1 << 2 * (pin % 16));
 		value &= ~(1 << 2 * (pin % 16) + 1);
-		*(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x00) = value;
+		*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x00) = value;
 	} else if(mode == AF) {
 		value &= ~(1 << 2 * (pin % 16));
 		value |= (1 << 2 * (pin % 16) + 1);
-		*(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x00) = value;
+		*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x00) = value;
 	} else if(mode == ANALOG) {
 		value |= (1 << 2 * (pin % 16));
 		value |= (1 << 2 * (pin % 16) + 1);
-		*(volatile uint32_t*) (0x48000000 + ((pin / 16) * 0x0400) + 0x00) = value;
+		*(volatile uint32_t*) (GPIOA_BASE + ((pin / 16) * 0x0400) + 0x00) = value;
 	}
 }
 #endif
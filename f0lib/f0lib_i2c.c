@@ -4,17 +4,59 @@
 #include "f0lib_i2c.h"
 #include "stdarg.h"
 
+// interrupts used while queued transactions are in progress
+#define I2C_QUEUE_INTERRUPTS (I2C_CR1_TXIE | I2C_CR1_RXIE | I2C_CR1_NACKIE | I2C_CR1_STOPIE | I2C_CR1_TCIE | I2C_CR1_ERRIE)
+
+// flags that end a transfer early
+#define I2C_ERROR_FLAGS (I2C_ISR_NACKF | I2C_ISR_ARLO | I2C_ISR_BERR | I2C_ISR_TIMEOUT)
+
+struct i2c_transaction {
+	uint8_t i2c_address;
+	uint8_t read;               // 0 = write, 1 = write the register number then read
+	uint8_t reg;
+	uint8_t byte_count;
+	uint8_t value;              // storage for single-byte writes
+	uint8_t *buffer;
+	void (*callback)(enum I2C_RESULT result);
+};
+
+struct i2c_peripheral {
+	struct i2c_transaction transactions[I2C_QUEUE_LENGTH];
+	volatile uint8_t head;      // next free slot
+	volatile uint8_t tail;      // transaction currently on the bus
+	volatile uint8_t active;
+	uint8_t index;              // bytes transferred in the current phase
+	uint8_t attempts;           // retries used by the current transaction
+	enum I2C_RESULT error;      // error reported during the current attempt
+	volatile uint32_t progress; // incremented by every interrupt and every transaction start
+	uint32_t watchdog_progress; // value of progress at the previous watchdog call
+	volatile uint8_t recovery_pending; // the current attempt timed out and waits for i2c_queue_recover()
+	enum GPIO_PIN sck_pin;
+	enum GPIO_PIN sda_pin;
+	struct i2c_statistics statistics;
+};
+
+static struct i2c_peripheral i2c1_state;
+static struct i2c_peripheral i2c2_state;
+
+static struct i2c_peripheral* i2c_get_state(I2C_TypeDef *i2c) {
+
+	return (i2c == I2C2) ? &i2c2_state : &i2c1_state;
+
+}
+
+static IRQn_Type i2c_get_irq(I2C_TypeDef *i2c) {
+
+	return (i2c == I2C2) ? I2C2_IRQn : I2C1_IRQn;
+
+}
+
 /**
- * Configures the I2C peripheral.
- *
- * @param i2c     I2C1 or I2C2
- * @param speed   STANDARD_MODE_100KHZ or FAST_MODE_400KHZ or FAST_MODE_PLUS_1MHZ
- * @param sck     The pin used for the I2C clock signal
- * @param sda     The pin used for the I2C data signal
+ * "Unsticks" any I2C slave devices that might be in a bad state by driving the clock a few times while SDA is high,
+ * then sending a start bit and a stop bit. The pins are left configured as open-drain outputs.
  */
-void i2c_setup(I2C_TypeDef *i2c, enum I2C_SPEED speed, enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin) {
+static void i2c_unstick_bus(enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin) {
 
-	// "unstick" any I2C slave devices that might be in a bad state by driving the clock a few times while SDA is high
 	gpio_setup(sck_pin, OUTPUT, OPEN_DRAIN, FIFTY_MHZ, PULL_UP, AF1);
 	gpio_setup(sda_pin, OUTPUT, OPEN_DRAIN, FIFTY_MHZ, PULL_UP, AF1);
 	gpio_high(sda_pin);
@@ -25,6 +67,194 @@ void i2c_setup(I2C_TypeDef *i2c, enum I2C_SPEED speed, enum GPIO_PIN sck_pin, en
 		for(volatile uint32_t j = 0; j < 1000; j++);
 	}
 
+	// SDA falls then rises while SCL is high
+	gpio_low(sda_pin);
+	for(volatile uint32_t j = 0; j < 1000; j++);
+	gpio_high(sda_pin);
+	for(volatile uint32_t j = 0; j < 1000; j++);
+
+}
+
+/**
+ * Disables the peripheral, clocks the bus free, then gives the pins back to the peripheral.
+ */
+static void i2c_recover_bus(I2C_TypeDef *i2c, struct i2c_peripheral *state) {
+
+	i2c->CR1 &= ~I2C_CR1_PE;
+
+	i2c_unstick_bus(state->sck_pin, state->sda_pin);
+	gpio_setup(state->sck_pin, AF, OPEN_DRAIN, FIFTY_MHZ, PULL_UP, AF1);
+	gpio_setup(state->sda_pin, AF, OPEN_DRAIN, FIFTY_MHZ, PULL_UP, AF1);
+
+	i2c->CR1 |= I2C_CR1_PE;
+	state->statistics.recoveries++;
+
+}
+
+/**
+ * Gets the peripheral back to a known state after a failed attempt.
+ * Clearing PE resets the state machine and all flags. A timeout means the bus itself may be stuck, so it is recovered too.
+ */
+static void i2c_reset_after_error(I2C_TypeDef *i2c, struct i2c_peripheral *state, enum I2C_RESULT result) {
+
+	if(result == I2C_TIMEOUT) {
+		i2c_recover_bus(i2c, state);
+	} else {
+		i2c->CR1 &= ~I2C_CR1_PE;
+		__NOP();
+		__NOP();
+		__NOP();
+		i2c->CR1 |= I2C_CR1_PE;
+	}
+
+}
+
+/**
+ * Updates the counters for the error flags in an ISR value.
+ *
+ * @returns    The error that ended the transfer
+ */
+static enum I2C_RESULT i2c_count_error(struct i2c_peripheral *state, uint32_t isr) {
+
+	if(isr & I2C_ISR_TIMEOUT) {
+		state->statistics.timeouts++;
+		return I2C_TIMEOUT;
+	} else if(isr & I2C_ISR_ARLO) {
+		state->statistics.arbitration_losses++;
+		return I2C_ARBITRATION_LOST;
+	} else if(isr & I2C_ISR_BERR) {
+		state->statistics.bus_errors++;
+		return I2C_BUS_ERROR;
+	} else {
+		state->statistics.nacks++;
+		return I2C_NACK;
+	}
+
+}
+
+/**
+ * Waits for a flag to be set, giving up on errors, an unexpected stop bit, or after I2C_TIMEOUT_LOOPS polls.
+ */
+static enum I2C_RESULT i2c_wait_for_flag(I2C_TypeDef *i2c, struct i2c_peripheral *state, uint32_t flag) {
+
+	for(uint32_t loops = 0; loops < I2C_TIMEOUT_LOOPS; loops++) {
+		uint32_t isr = i2c->ISR;
+		if(isr & flag)
+			return I2C_SUCCESS;
+		if(isr & I2C_ERROR_FLAGS)
+			return i2c_count_error(state, isr);
+		if(isr & I2C_ISR_STOPF) {
+			state->statistics.bus_errors++;
+			return I2C_BUS_ERROR;
+		}
+	}
+
+	state->statistics.timeouts++;
+	return I2C_TIMEOUT;
+
+}
+
+/**
+ * Calculates a TIMINGR value that meets the I2C specification for the given clock, bus speed and signal slopes.
+ * The smallest prescaler that can express every delay is used, giving the finest resolution.
+ * The analog noise filter is assumed to be enabled (the default) and the digital filter disabled.
+ *
+ * @param i2c_clock   Frequency of I2CCLK in Hz
+ * @param speed       STANDARD_MODE_100KHZ or FAST_MODE_400KHZ or FAST_MODE_PLUS_1MHZ
+ * @param rise_ns     SCL/SDA rise time in nanoseconds
+ * @param fall_ns     SCL/SDA fall time in nanoseconds
+ * @returns           The TIMINGR value, or 0 if the clock is too slow for this speed
+ */
+uint32_t i2c_compute_timing(uint32_t i2c_clock, enum I2C_SPEED speed, uint32_t rise_ns, uint32_t fall_ns) {
+
+	// minimum/maximum times from the I2C specification, in nanoseconds
+	uint32_t period_ns, low_min, high_min, setup_min, valid_max;
+	if(speed == STANDARD_MODE_100KHZ) {
+		period_ns = 10000; low_min = 4700; high_min = 4000; setup_min = 250; valid_max = 3450;
+	} else if(speed == FAST_MODE_400KHZ) {
+		period_ns = 2500;  low_min = 1300; high_min = 600;  setup_min = 100; valid_max = 900;
+	} else {
+		period_ns = 1000;  low_min = 500;  high_min = 260;  setup_min = 50;  valid_max = 450;
+	}
+
+	// analog filter delay range, from the datasheet
+	const uint32_t filter_min = 50;
+	const uint32_t filter_max = 260;
+
+	// work in picoseconds so a 48MHz clock period (20.833ns) is not truncated to 20ns
+	uint32_t clock_ps = 1000000000 / (i2c_clock / 1000);
+
+	// SCL edges are detected 2 or 3 clocks after passing through the analog filter
+	uint32_t sync1_ps = (fall_ns + filter_min) * 1000 + 2 * clock_ps;
+	uint32_t sync2_ps = (rise_ns + filter_min) * 1000 + 2 * clock_ps;
+
+	for(uint32_t presc = 0; presc < 16; presc++) {
+
+		uint32_t presc_ps = (presc + 1) * clock_ps;
+
+		// data setup time: (SCLDEL + 1) * tPRESC >= tr + tSU;DAT
+		uint32_t scldel = ((rise_ns + setup_min) * 1000 + presc_ps - 1) / presc_ps;
+		scldel = (scldel > 0) ? scldel - 1 : 0;
+
+		// data hold time: SDA must not change before SCL has fallen, and should be valid within tVD;DAT
+		// (with slow edges the tVD;DAT limit can be unreachable, then the shortest delay is the best that can be done)
+		int32_t sdadel_min = ((int32_t) (fall_ns - filter_min) * 1000 - 3 * (int32_t) clock_ps);
+		int32_t sdadel_max = ((int32_t) (valid_max - rise_ns - filter_max) * 1000 - 4 * (int32_t) clock_ps);
+		if(sdadel_max < 0)
+			sdadel_max = 0;
+		uint32_t sdadel = (sdadel_min > 0) ? ((uint32_t) sdadel_min + presc_ps - 1) / presc_ps : 0;
+
+		if(scldel > 15 || sdadel > 15 || sdadel > (uint32_t) sdadel_max / presc_ps)
+			continue;
+
+		// the low and high periods each include one synchronization delay
+		uint32_t low = (low_min * 1000 > sync1_ps) ? (low_min * 1000 - sync1_ps + presc_ps - 1) / presc_ps : 1;
+		uint32_t high = (high_min * 1000 > sync2_ps) ? (high_min * 1000 - sync2_ps + presc_ps - 1) / presc_ps : 1;
+
+		// stretch both periods so the total does not exceed the requested frequency
+		uint32_t counted_ps = period_ns * 1000 - sync1_ps - sync2_ps;
+		uint32_t total = (counted_ps + presc_ps - 1) / presc_ps;
+		if(total > low + high) {
+			uint32_t extra = total - low - high;
+			low += extra - extra / 2;
+			high += extra / 2;
+		}
+
+		if(low > 256 || high > 256 || sdadel + scldel + 2 > low)
+			continue;
+
+		return I2C_TIMINGR(presc, scldel, sdadel, high - 1, low - 1);
+
+	}
+
+	return 0;
+
+}
+
+/**
+ * Configures the I2C peripheral.
+ *
+ * @param i2c     I2C1 or I2C2
+ * @param speed   STANDARD_MODE_100KHZ or FAST_MODE_400KHZ or FAST_MODE_PLUS_1MHZ
+ * @param sck     The pin used for the I2C clock signal
+ * @param sda     The pin used for the I2C data signal
+ * @returns       1 if configured, 0 if SystemCoreClock is too slow for this speed (the peripheral is left untouched)
+ */
+uint8_t i2c_setup(I2C_TypeDef *i2c, enum I2C_SPEED speed, enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin) {
+
+	// both peripherals are clocked from SYSCLK: I2C1 directly, I2C2 through PCLK
+	uint32_t timing = i2c_compute_timing(SystemCoreClock, speed, I2C_RISE_TIME_NS, I2C_FALL_TIME_NS);
+	if(timing == 0)
+		return 0;
+
+	// remember the pins so the bus can be recovered later
+	struct i2c_peripheral *state = i2c_get_state(i2c);
+	state->sck_pin = sck_pin;
+	state->sda_pin = sda_pin;
+
+	// "unstick" any I2C slave devices that might be in a bad state
+	i2c_unstick_bus(sck_pin, sda_pin);
+
 	// configure the GPIOs
 	gpio_setup(sck_pin, AF, OPEN_DRAIN, FIFTY_MHZ, PULL_UP, AF1);
 	gpio_setup(sda_pin, AF, OPEN_DRAIN, FIFTY_MHZ, PULL_UP, AF1);
@@ -48,100 +278,452 @@ void i2c_setup(I2C_TypeDef *i2c, enum I2C_SPEED speed, enum GPIO_PIN sck_pin, en
 
 	}
 
-	uint8_t presc = 15;
-	uint8_t scldel = 1;
-	uint8_t sdadel = 1;
-	uint8_t sclh = 14;
-	uint8_t scll = 14;
-
-	// adjust the prescaler so one bit takes 30 cycles
-	if(speed == STANDARD_MODE_100KHZ)
-		presc = (SystemCoreClock / 3000000) - 1;  // 3MHz clock
-	else if(speed == FAST_MODE_400KHZ)
-		presc = (SystemCoreClock / 12000000) - 1; // 12MHz clock
-	else if(speed == FAST_MODE_PLUS_1MHZ)
-		presc = (SystemCoreClock / 30000000) - 1; // 30MHz clock
+	// Fast-mode Plus needs the stronger output drivers, which are only available on PB6 - PB9
+	if(speed == FAST_MODE_PLUS_1MHZ) {
+		RCC->APB2ENR |= RCC_APB2ENR_SYSCFGEN;
+		if(sck_pin == PB6 || sda_pin == PB6) SYSCFG->CFGR1 |= SYSCFG_CFGR1_I2C_FMP_PB6;
+		if(sck_pin == PB7 || sda_pin == PB7) SYSCFG->CFGR1 |= SYSCFG_CFGR1_I2C_FMP_PB7;
+		if(sck_pin == PB8 || sda_pin == PB8) SYSCFG->CFGR1 |= SYSCFG_CFGR1_I2C_FMP_PB8;
+		if(sck_pin == PB9 || sda_pin == PB9) SYSCFG->CFGR1 |= SYSCFG_CFGR1_I2C_FMP_PB9;
+	}
 
 	// set timing
-	i2c->TIMINGR = (scll << 0) | (sclh << 8) | (sdadel << 16) | (scldel << 20) | (presc << 28);
+	i2c->TIMINGR = timing;
+
+	// I2C1 can detect a slave holding SCL low: raise a TIMEOUT error after 10ms (TIMEOUTA counts in units of 2048 clocks)
+	if(i2c == I2C1)
+		i2c->TIMEOUTR = ((SystemCoreClock / 2048 / 100) - 1) | I2C_TIMEOUTR_TIMOUTEN;
 
 	// enable
 	i2c->CR1 |= 1;
 
+	// the interrupt sources are only enabled while queued transactions are in progress
+	if(i2c == I2C1)
+		NVIC_EnableIRQ(I2C1_IRQn);
+	else if(i2c == I2C2)
+		NVIC_EnableIRQ(I2C2_IRQn);
+
+	return 1;
+
 }
 
-/**
- * Writes to one register of an I2C device
- *
- * @param i2c           I2C1 or I2C2
- * @param i2c_address   I2C device address
- * @param reg           Register being written to
- * @param value         Value for the register
- */
-void i2c_write_register(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t reg, uint8_t value) {
+static enum I2C_RESULT i2c_write_register_attempt(I2C_TypeDef *i2c, struct i2c_peripheral *state, uint8_t i2c_address, uint8_t reg, uint8_t value) {
+
+	enum I2C_RESULT result;
 
 	// write two bytes with a start bit and a stop bit
 	i2c->CR2 = (i2c_address << 1) | I2C_CR2_START | I2C_CR2_AUTOEND | (2 << 16);
-	while((i2c->ISR & I2C_ISR_TXIS) == 0);
+	if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_TXIS)) != I2C_SUCCESS)
+		return result;
 	i2c->TXDR = reg;
-	while((i2c->ISR & I2C_ISR_TXIS) == 0);
+	if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_TXIS)) != I2C_SUCCESS)
+		return result;
 	i2c->TXDR = value;
-	while(i2c->ISR & I2C_ISR_BUSY);
+	if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_STOPF)) != I2C_SUCCESS)
+		return result;
+	i2c->ICR = I2C_ICR_STOPCF;
+
+	return I2C_SUCCESS;
 
 }
 
 /**
- * Read the specified number of bytes from an I2C device
+ * Writes to one register of an I2C device.
+ * Failed attempts are retried up to I2C_MAX_RETRIES times, and the bus is recovered after a timeout.
  *
  * @param i2c           I2C1 or I2C2
  * @param i2c_address   I2C device address
- * @param byte_count    Number of bytes to read
- * @param first_reg     First register to read from
- * @param rx_buffer     Pointer to an array of uint8_t's where values will be stored
+ * @param reg           Register being written to
+ * @param value         Value for the register
+ * @returns             I2C_SUCCESS, or the error from the last attempt
  */
-void i2c_read_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer) {
+enum I2C_RESULT i2c_write_register(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t reg, uint8_t value) {
+
+	struct i2c_peripheral *state = i2c_get_state(i2c);
+	enum I2C_RESULT result = I2C_SUCCESS;
+
+	for(uint8_t attempt = 0; attempt <= I2C_MAX_RETRIES; attempt++) {
+		if(attempt > 0)
+			state->statistics.retries++;
+		result = i2c_write_register_attempt(i2c, state, i2c_address, reg, value);
+		if(result == I2C_SUCCESS)
+			return result;
+		i2c_reset_after_error(i2c, state, result);
+	}
+
+	state->statistics.failures++;
+	return result;
+
+}
+
+static enum I2C_RESULT i2c_read_registers_attempt(I2C_TypeDef *i2c, struct i2c_peripheral *state, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer) {
 
-	uint8_t *ptr = rx_buffer;
+	enum I2C_RESULT result;
 
 	// write one byte (the register number) with a start bit but no stop bit
 	i2c->CR2 = (i2c_address << 1) | I2C_CR2_START | (1 << 16);
-	while((i2c->ISR & I2C_ISR_TXIS) == 0)
-		if((i2c->ISR & I2C_ISR_NACKF) || (i2c->ISR & I2C_ISR_STOPF) || (i2c->ISR & I2C_ISR_ARLO)) {
-			i2c->CR1 &= ~I2C_CR1_PE;
-			__NOP();
-			__NOP();
-			__NOP();
-			i2c->CR1 |= I2C_CR1_PE;
-			i2c_read_registers(i2c, i2c_address, byte_count, first_reg, rx_buffer);
-			return;
-		}
+	if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_TXIS)) != I2C_SUCCESS)
+		return result;
 	i2c->TXDR = first_reg;
-	while((i2c->ISR & I2C_ISR_TC) == 0)
-		if((i2c->ISR & I2C_ISR_NACKF) || (i2c->ISR & I2C_ISR_STOPF) || (i2c->ISR & I2C_ISR_ARLO)) {
-			i2c->CR1 &= ~I2C_CR1_PE;
-			__NOP();
-			__NOP();
-			__NOP();
-			i2c->CR1 |= I2C_CR1_PE;
-			i2c_read_registers(i2c, i2c_address, byte_count, first_reg, rx_buffer);
-			return;
-		}
+	if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_TC)) != I2C_SUCCESS)
+		return result;
 
 	// read the specified number of bytes with a start bit and a stop bit
 	i2c->CR2 = (i2c_address << 1) | I2C_CR2_RD_WRN | I2C_CR2_START | I2C_CR2_AUTOEND | (byte_count << 16);
 
 	// wait for the bytes to arrive
 	while(byte_count-- > 0) {
-		while((i2c->ISR & I2C_ISR_RXNE) == 0)
-			if((i2c->ISR & I2C_ISR_NACKF) || (i2c->ISR & I2C_ISR_STOPF) || (i2c->ISR & I2C_ISR_ARLO)) {
-				i2c->CR1 &= ~I2C_CR1_PE;
-				__NOP();
-				__NOP();
-				__NOP();
-				i2c->CR1 |= I2C_CR1_PE;
-				i2c_read_registers(i2c, i2c_address, byte_count, first_reg, ptr);
-				return;
-			}
+		if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_RXNE)) != I2C_SUCCESS)
+			return result;
 		*rx_buffer++ = i2c->RXDR;
 	}
+
+	if((result = i2c_wait_for_flag(i2c, state, I2C_ISR_STOPF)) != I2C_SUCCESS)
+		return result;
+	i2c->ICR = I2C_ICR_STOPCF;
+
+	return I2C_SUCCESS;
+
+}
+
+/**
+ * Read the specified number of bytes from an I2C device.
+ * Failed attempts are retried up to I2C_MAX_RETRIES times, and the bus is recovered after a timeout.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param byte_count    Number of bytes to read
+ * @param first_reg     First register to read from
+ * @param rx_buffer     Pointer to an array of uint8_t's where values will be stored
+ * @returns             I2C_SUCCESS, or the error from the last attempt
+ */
+enum I2C_RESULT i2c_read_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer) {
+
+	struct i2c_peripheral *state = i2c_get_state(i2c);
+	enum I2C_RESULT result = I2C_SUCCESS;
+
+	for(uint8_t attempt = 0; attempt <= I2C_MAX_RETRIES; attempt++) {
+		if(attempt > 0)
+			state->statistics.retries++;
+		result = i2c_read_registers_attempt(i2c, state, i2c_address, byte_count, first_reg, rx_buffer);
+		if(result == I2C_SUCCESS)
+			return result;
+		i2c_reset_after_error(i2c, state, result);
+	}
+
+	state->statistics.failures++;
+	return result;
+
+}
+
+/**
+ * Starts the transaction at the tail of the queue, or disables the I2C interrupts if the queue is empty.
+ */
+static void i2c_start_next_transaction(I2C_TypeDef *i2c, struct i2c_peripheral *state) {
+
+	if(state->tail == state->head) {
+		i2c->CR1 &= ~I2C_QUEUE_INTERRUPTS;
+		state->active = 0;
+		return;
+	}
+
+	struct i2c_transaction *t = &state->transactions[state->tail];
+	state->active = 1;
+	state->index = 0;
+	state->error = I2C_SUCCESS;
+	state->progress++;
+	i2c->CR1 |= I2C_QUEUE_INTERRUPTS;
+
+	if(t->read)
+		i2c->CR2 = (t->i2c_address << 1) | I2C_CR2_START | (1 << 16);                                    // register number, no stop bit
+	else
+		i2c->CR2 = (t->i2c_address << 1) | I2C_CR2_START | I2C_CR2_AUTOEND | ((t->byte_count + 1) << 16); // register number and values
+
+}
+
+/**
+ * Retries a failed transaction until I2C_MAX_RETRIES is reached.
+ * Otherwise the transaction is removed from the queue, its callback is called, then the next transaction is started.
+ * The callback runs before the next transaction starts, so it may safely reuse its buffer.
+ */
+static void i2c_retry_or_complete(I2C_TypeDef *i2c, struct i2c_peripheral *state, enum I2C_RESULT result) {
+
+	if(result != I2C_SUCCESS) {
+		if(state->attempts < I2C_MAX_RETRIES) {
+			state->attempts++;
+			state->statistics.retries++;
+			i2c_start_next_transaction(i2c, state);
+			return;
+		}
+		state->statistics.failures++;
+	}
+
+	void (*callback)(enum I2C_RESULT result) = state->transactions[state->tail].callback;
+	state->tail = (state->tail + 1) % I2C_QUEUE_LENGTH;
+	state->attempts = 0;
+
+	if(callback)
+		callback(result);
+
+	i2c_start_next_transaction(i2c, state);
+
+}
+
+/**
+ * Ends the current attempt. The peripheral is reset after an error, then the transaction is retried or completed.
+ * Clocking a stuck bus free busy-waits for milliseconds, so after a timeout the peripheral is only disabled here.
+ * The transaction stays at the tail of the queue until i2c_queue_recover() is called from the main loop.
+ */
+static void i2c_end_attempt(I2C_TypeDef *i2c, struct i2c_peripheral *state, enum I2C_RESULT result) {
+
+	if(result == I2C_TIMEOUT) {
+		i2c->CR1 &= ~(I2C_CR1_PE | I2C_QUEUE_INTERRUPTS);
+		state->recovery_pending = 1;
+		return;
+	}
+
+	if(result != I2C_SUCCESS)
+		i2c_reset_after_error(i2c, state, result);
+
+	i2c_retry_or_complete(i2c, state, result);
+
+}
+
+/**
+ * Adds a transaction to the queue, and starts it if the bus is idle.
+ */
+static uint8_t i2c_enqueue(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t read, uint8_t reg, uint8_t byte_count, uint8_t *buffer, uint8_t value, void (*callback)(enum I2C_RESULT result)) {
+
+	if(i2c != I2C1 && i2c != I2C2)
+		return 0;
+
+	struct i2c_peripheral *state = i2c_get_state(i2c);
+	IRQn_Type irq = i2c_get_irq(i2c);
+
+	NVIC_DisableIRQ(irq);
+
+	uint8_t next = (state->head + 1) % I2C_QUEUE_LENGTH;
+	if(next == state->tail) {
+		NVIC_EnableIRQ(irq);
+		return 0;
+	}
+
+	struct i2c_transaction *t = &state->transactions[state->head];
+	t->i2c_address = i2c_address;
+	t->read = read;
+	t->reg = reg;
+	t->byte_count = byte_count;
+	t->value = value;
+	t->buffer = buffer ? buffer : &t->value;
+	t->callback = callback;
+	state->head = next;
+
+	if(!state->active)
+		i2c_start_next_transaction(i2c, state);
+
+	NVIC_EnableIRQ(irq);
+	return 1;
+
+}
+
+/**
+ * Queues a write to one register of an I2C device.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param reg           Register being written to
+ * @param value         Value for the register (copied into the queue)
+ * @param callback      Function to call when done, or 0
+ * @returns             1 if queued, 0 if the queue is full
+ */
+uint8_t i2c_queue_write_register(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t reg, uint8_t value, void (*callback)(enum I2C_RESULT result)) {
+
+	return i2c_enqueue(i2c, i2c_address, 0, reg, 1, 0, value, callback);
+
+}
+
+/**
+ * Queues a burst write to consecutive registers of an I2C device.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param byte_count    Number of bytes to write, 1 - 254
+ * @param first_reg     First register to write to
+ * @param tx_buffer     Values to write. Must remain valid until the callback is called.
+ * @param callback      Function to call when done, or 0
+ * @returns             1 if queued, 0 if the queue is full
+ */
+uint8_t i2c_queue_write_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *tx_buffer, void (*callback)(enum I2C_RESULT result)) {
+
+	if(byte_count == 0 || byte_count > 254)
+		return 0;
+
+	return i2c_enqueue(i2c, i2c_address, 0, first_reg, byte_count, tx_buffer, 0, callback);
+
+}
+
+/**
+ * Queues a write of the register number followed by a read of the specified number of bytes.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param byte_count    Number of bytes to read
+ * @param first_reg     First register to read from
+ * @param rx_buffer     Where values will be stored. Must remain valid until the callback is called.
+ * @param callback      Function to call when done, or 0
+ * @returns             1 if queued, 0 if the queue is full
+ */
+uint8_t i2c_queue_read_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer, void (*callback)(enum I2C_RESULT result)) {
+
+	if(byte_count == 0)
+		return 0;
+
+	return i2c_enqueue(i2c, i2c_address, 1, first_reg, byte_count, rx_buffer, 0, callback);
+
+}
+
+/**
+ * Checks if all queued transactions have completed.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @returns             1 if the queue is empty and the bus is not in use by a queued transaction
+ */
+uint8_t i2c_queue_idle(I2C_TypeDef *i2c) {
+
+	return !i2c_get_state(i2c)->active;
+
+}
+
+/**
+ * Aborts a queued transaction that has made no progress since the previous call.
+ * Call this periodically (at an interval much longer than any transaction) to catch a stuck bus that
+ * raises no interrupts. The stalled attempt counts as an I2C_TIMEOUT: the bus is recovered by the next
+ * i2c_queue_recover() call, then the transaction is retried like any other failed attempt.
+ *
+ * @param i2c           I2C1 or I2C2
+ */
+void i2c_queue_watchdog(I2C_TypeDef *i2c) {
+
+	struct i2c_peripheral *state = i2c_get_state(i2c);
+	IRQn_Type irq = i2c_get_irq(i2c);
+
+	NVIC_DisableIRQ(irq);
+
+	if(state->active && !state->recovery_pending && state->progress == state->watchdog_progress) {
+		state->statistics.timeouts++;
+		i2c_end_attempt(i2c, state, I2C_TIMEOUT);
+	}
+	state->watchdog_progress = state->progress;
+
+	NVIC_EnableIRQ(irq);
+
+}
+
+/**
+ * Recovers the bus after a queued transaction timed out, then retries or completes that transaction.
+ * Recovery busy-waits for a few milliseconds, so call this from the main loop, never from an interrupt.
+ * Does nothing if no recovery is pending.
+ *
+ * @param i2c           I2C1 or I2C2
+ */
+void i2c_queue_recover(I2C_TypeDef *i2c) {
+
+	struct i2c_peripheral *state = i2c_get_state(i2c);
+	IRQn_Type irq = i2c_get_irq(i2c);
+
+	if(!state->recovery_pending)
+		return;
+
+	// the queue interrupts are disabled while recovery is pending, so the ISR does not touch the peripheral
+	i2c_recover_bus(i2c, state);
+
+	NVIC_DisableIRQ(irq);
+	state->recovery_pending = 0;
+	i2c_retry_or_complete(i2c, state, I2C_TIMEOUT);
+	NVIC_EnableIRQ(irq);
+
+}
+
+/**
+ * Gets the bus health counters.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @returns             Pointer to the live counters for that peripheral
+ */
+const struct i2c_statistics* i2c_get_statistics(I2C_TypeDef *i2c) {
+
+	return &i2c_get_state(i2c)->statistics;
+
+}
+
+/**
+ * Advances the transaction at the tail of the queue. Shared by the I2C1 and I2C2 ISRs.
+ */
+static void i2c_queue_handler(I2C_TypeDef *i2c, struct i2c_peripheral *state) {
+
+	struct i2c_transaction *t = &state->transactions[state->tail];
+	uint32_t isr = i2c->ISR;
+
+	if(!state->active) {
+		i2c->CR1 &= ~I2C_QUEUE_INTERRUPTS;
+		return;
+	}
+
+	state->progress++;
+
+	// arbitration loss, bus error or SCL held low: no stop bit will follow, so end the attempt now
+	if(isr & (I2C_ISR_ARLO | I2C_ISR_BERR | I2C_ISR_TIMEOUT)) {
+		i2c->ICR = I2C_ICR_ARLOCF | I2C_ICR_BERRCF | I2C_ICR_TIMOUTCF;
+		i2c_end_attempt(i2c, state, i2c_count_error(state, isr));
+		return;
+	}
+
+	// NACK: a stop bit is sent automatically, so end the attempt when STOPF is set
+	if(isr & I2C_ISR_NACKF) {
+		i2c->ICR = I2C_ICR_NACKCF;
+		state->error = i2c_count_error(state, isr);
+	}
+
+	// send the register number, then any values
+	if(isr & I2C_ISR_TXIS) {
+		i2c->TXDR = (state->index == 0) ? t->reg : t->buffer[state->index - 1];
+		state->index++;
+	}
+
+	// register number sent for a read: restart in read mode with a stop bit at the end
+	if(isr & I2C_ISR_TC) {
+		state->index = 0;
+		i2c->CR2 = (t->i2c_address << 1) | I2C_CR2_RD_WRN | I2C_CR2_START | I2C_CR2_AUTOEND | (t->byte_count << 16);
+	}
+
+	if(isr & I2C_ISR_RXNE) {
+		if(state->index < t->byte_count)
+			t->buffer[state->index++] = i2c->RXDR;
+		else
+			(void) i2c->RXDR;
+	}
+
+	if(isr & I2C_ISR_STOPF) {
+		i2c->ICR = I2C_ICR_STOPCF;
+		i2c_end_attempt(i2c, state, state->error);
+	}
+
+}
+
+/**
+ * ISR for I2C1.
+ */
+void I2C1_IRQHandler(void) {
+
+	i2c_queue_handler(I2C1, &i2c1_state);
+
+}
+
+/**
+ * ISR for I2C2.
+ */
+void I2C2_IRQHandler(void) {
+
+	i2c_queue_handler(I2C2, &i2c2_state);
+
 }
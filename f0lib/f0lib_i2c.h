@@ -5,6 +5,41 @@
 #include "f0lib_gpio.h"
 
 enum I2C_SPEED {STANDARD_MODE_100KHZ, FAST_MODE_400KHZ, FAST_MODE_PLUS_1MHZ};
+enum I2C_RESULT {I2C_SUCCESS, I2C_NACK, I2C_ARBITRATION_LOST, I2C_BUS_ERROR, I2C_TIMEOUT};
+
+// signal slopes used when calculating TIMINGR, depend on the pull-up resistors and bus capacitance
+#ifndef I2C_RISE_TIME_NS
+#define I2C_RISE_TIME_NS 100
+#endif
+#ifndef I2C_FALL_TIME_NS
+#define I2C_FALL_TIME_NS 10
+#endif
+
+// assembles a TIMINGR value from its fields
+#define I2C_TIMINGR(presc, scldel, sdadel, sclh, scll) (((uint32_t) (presc) << 28) | ((uint32_t) (scldel) << 20) | ((uint32_t) (sdadel) << 16) | ((uint32_t) (sclh) << 8) | (uint32_t) (scll))
+
+// number of slots in each peripheral's transaction queue (one slot is always kept empty)
+#define I2C_QUEUE_LENGTH 20
+
+// a failed transaction is attempted this many more times before giving up
+#define I2C_MAX_RETRIES 3
+
+// polling iterations before a blocking function gives up on a flag (roughly 4ms at 48MHz)
+#define I2C_TIMEOUT_LOOPS 20000
+
+/**
+ * Bus health counters, maintained separately for each peripheral.
+ * They only ever increase, so telemetry can report the difference between two readings.
+ */
+struct i2c_statistics {
+	uint32_t nacks;
+	uint32_t arbitration_losses;
+	uint32_t bus_errors;
+	uint32_t timeouts;
+	uint32_t retries;
+	uint32_t recoveries;   // bus recovery sequences (SCL clocked by hand)
+	uint32_t failures;     // transactions that still failed after all retries
+};
 
 /**
  * Possible GPIO usage:
@@ -15,33 +50,136 @@ enum I2C_SPEED {STANDARD_MODE_100KHZ, FAST_MODE_400KHZ, FAST_MODE_PLUS_1MHZ};
  * I2C2 SDA:	PB11 AF1	PF7 AF
  */
 
+/**
+ * Calculates a TIMINGR value that meets the I2C specification for the given clock, bus speed and signal slopes.
+ * The smallest prescaler that can express every delay is used, giving the finest resolution.
+ * The analog noise filter is assumed to be enabled (the default) and the digital filter disabled.
+ *
+ * @param i2c_clock   Frequency of I2CCLK in Hz
+ * @param speed       STANDARD_MODE_100KHZ or FAST_MODE_400KHZ or FAST_MODE_PLUS_1MHZ
+ * @param rise_ns     SCL/SDA rise time in nanoseconds
+ * @param fall_ns     SCL/SDA fall time in nanoseconds
+ * @returns           The TIMINGR value, or 0 if the clock is too slow for this speed
+ */
+uint32_t i2c_compute_timing(uint32_t i2c_clock, enum I2C_SPEED speed, uint32_t rise_ns, uint32_t fall_ns);
+
 /**
  * Configures the I2C peripheral.
+ * TIMINGR is calculated from SystemCoreClock, I2C_RISE_TIME_NS and I2C_FALL_TIME_NS.
+ * For FAST_MODE_PLUS_1MHZ the Fm+ drive capability is enabled on the pins, which is only possible on PB6 - PB9.
  *
  * @param i2c     I2C1 or I2C2
  * @param speed   STANDARD_MODE_100KHZ or FAST_MODE_400KHZ or FAST_MODE_PLUS_1MHZ
  * @param sck     The pin used for the I2C clock signal
  * @param sda     The pin used for the I2C data signal
+ * @returns       1 if configured, 0 if SystemCoreClock is too slow for this speed (the peripheral is left untouched)
  */
-void i2c_setup(I2C_TypeDef *i2c, enum I2C_SPEED speed, enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin);
+uint8_t i2c_setup(I2C_TypeDef *i2c, enum I2C_SPEED speed, enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin);
 
 /**
- * Writes to one register of an I2C device
+ * Writes to one register of an I2C device.
+ * Failed attempts are retried up to I2C_MAX_RETRIES times, and the bus is recovered after a timeout.
  *
  * @param i2c           I2C1 or I2C2
  * @param i2c_address   I2C device address
  * @param reg           Register being written to
  * @param value         Value for the register
+ * @returns             I2C_SUCCESS, or the error from the last attempt
  */
-void i2c_write_register(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t reg, uint8_t value);
+enum I2C_RESULT i2c_write_register(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t reg, uint8_t value);
 
 /**
- * Read the specified number of bytes from an I2C device
+ * Read the specified number of bytes from an I2C device.
+ * Failed attempts are retried up to I2C_MAX_RETRIES times, and the bus is recovered after a timeout.
  *
  * @param i2c           I2C1 or I2C2
  * @param i2c_address   I2C device address
  * @param byte_count    Number of bytes to read
  * @param first_reg     First register to read from
  * @param rx_buffer     Pointer to an array of uint8_t's where values will be stored
+ * @returns             I2C_SUCCESS, or the error from the last attempt
+ */
+enum I2C_RESULT i2c_read_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer);
+
+/**
+ * The queued functions below add a transaction to a per-peripheral FIFO and return immediately.
+ * Transactions are executed one after another by the I2C1/I2C2 interrupt handlers, and the optional
+ * callback is called from interrupt context when each transaction completes.
+ * Failed transactions are retried up to I2C_MAX_RETRIES times before the callback receives the error.
+ *
+ * Do not mix the blocking functions above with queued transactions on the same peripheral:
+ * the blocking functions must only be used while i2c_queue_idle() returns 1.
+ */
+
+/**
+ * Queues a write to one register of an I2C device.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param reg           Register being written to
+ * @param value         Value for the register (copied into the queue)
+ * @param callback      Function to call when done, or 0
+ * @returns             1 if queued, 0 if the queue is full
+ */
+uint8_t i2c_queue_write_register(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t reg, uint8_t value, void (*callback)(enum I2C_RESULT result));
+
+/**
+ * Queues a burst write to consecutive registers of an I2C device.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param byte_count    Number of bytes to write, 1 - 254
+ * @param first_reg     First register to write to
+ * @param tx_buffer     Values to write. Must remain valid until the callback is called.
+ * @param callback      Function to call when done, or 0
+ * @returns             1 if queued, 0 if the queue is full
+ */
+uint8_t i2c_queue_write_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *tx_buffer, void (*callback)(enum I2C_RESULT result));
+
+/**
+ * Queues a write of the register number followed by a read of the specified number of bytes.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @param i2c_address   I2C device address
+ * @param byte_count    Number of bytes to read
+ * @param first_reg     First register to read from
+ * @param rx_buffer     Where values will be stored. Must remain valid until the callback is called.
+ * @param callback      Function to call when done, or 0
+ * @returns             1 if queued, 0 if the queue is full
+ */
+uint8_t i2c_queue_read_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer, void (*callback)(enum I2C_RESULT result));
+
+/**
+ * Checks if all queued transactions have completed.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @returns             1 if the queue is empty and the bus is not in use by a queued transaction
+ */
+uint8_t i2c_queue_idle(I2C_TypeDef *i2c);
+
+/**
+ * Aborts a queued transaction that has made no progress since the previous call.
+ * Call this periodically (at an interval much longer than any transaction) to catch a stuck bus that
+ * raises no interrupts. The stalled attempt counts as an I2C_TIMEOUT: the bus is recovered by the next
+ * i2c_queue_recover() call, then the transaction is retried like any other failed attempt.
+ *
+ * @param i2c           I2C1 or I2C2
+ */
+void i2c_queue_watchdog(I2C_TypeDef *i2c);
+
+/**
+ * Recovers the bus after a queued transaction timed out, then retries or completes that transaction.
+ * Recovery busy-waits for a few milliseconds, so call this from the main loop, never from an interrupt.
+ * Does nothing if no recovery is pending.
+ *
+ * @param i2c           I2C1 or I2C2
+ */
+void i2c_queue_recover(I2C_TypeDef *i2c);
+
+/**
+ * Gets the bus health counters.
+ *
+ * @param i2c           I2C1 or I2C2
+ * @returns             Pointer to the live counters for that peripheral
  */
-void i2c_read_registers(I2C_TypeDef *i2c, uint8_t i2c_address, uint8_t byte_count, uint8_t first_reg, uint8_t *rx_buffer);
+const struct i2c_statistics* i2c_get_statistics(I2C_TypeDef *i2c);
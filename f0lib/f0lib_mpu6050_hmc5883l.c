@@ -1,28 +1,154 @@
 // Author: Farrell Farahbod <farrellfarahbod@gmail.com>
 // License: public domain
 
+#include <stddef.h>
 #include "f0lib_mpu6050_hmc5883l.h"
 #include "f0lib_i2c.h"
 #include "f0lib_exti.h"
+#include "f0lib_flash.h"
 
 // i2c device addresses
 #define MPU6050_ADDRESS  0b1101000
 #define HMC5883L_ADDRESS 0b0011110
 
-// offsets calculated at power up
-static int16_t gyro_x_offset = 0;
-static int16_t gyro_y_offset = 0;
-static int16_t gyro_z_offset = 0;
-static uint32_t samples = 0;
+// bus speed. The MPU6050 datasheet only specifies 400kHz, but Fast-mode Plus cuts the 20-byte read to about 250us.
+// If i2c_get_statistics() shows NACKs or bus errors at 1MHz on a particular board, define this as FAST_MODE_400KHZ.
+#ifndef MPU6050_HMC5883L_I2C_SPEED
+#define MPU6050_HMC5883L_I2C_SPEED FAST_MODE_PLUS_1MHZ
+#endif
+
+// calibration record, loaded from flash at startup
+static struct mpu6050_hmc5883l_calibration calibration;
+
+// gyro calibration: the first samples are discarded while the sensor settles, then the next samples are averaged
+#define CALIBRATION_SETTLE_SAMPLES  64
+#define CALIBRATION_AVERAGE_SAMPLES 64
+static volatile uint16_t calibration_samples = 0; // 0 when not calibrating
+static volatile uint8_t calibration_save_pending = 0; // a finished calibration waits for the main loop to write it to flash
+static int32_t gyro_sum[3];
+static int32_t temperature_sum;
+
+// bias(gyro_offset_temperature) for each axis, see mpu6050_hmc5883l_calibration
+static int16_t gyro_bias_reference[3];
+
+// raw register values, filled by the queued i2c read
+static uint8_t rx_buffer[20];
+static volatile uint8_t read_pending = 0;
+static uint32_t read_timestamp;   // when INTA signalled the readings in rx_buffer
+static enum GPIO_PIN interrupt_pin;
 
 I2C_TypeDef *i2c;
-void (*event_handler)(float gyro_x, float gyro_y, float gyro_z, float accel_x, float accel_y, float accel_z, float magn_x, float magn_y, float magn_z);
+void (*event_handler)(const struct mpu6050_hmc5883l_sample *sample);
 
-static void mpu6050_hmc5883l_read_sensors(void) {
+// the most recent calibrated sample, passed to the event handler by pointer
+static struct mpu6050_hmc5883l_sample sample;
+
+static uint16_t mpu6050_hmc5883l_calibration_checksum(const struct mpu6050_hmc5883l_calibration *record) {
+
+	const uint16_t *halfwords = (const uint16_t *) record;
+	uint16_t checksum = 0;
+	for(uint32_t i = 0; i < offsetof(struct mpu6050_hmc5883l_calibration, checksum) / 2; i++)
+		checksum += halfwords[i];
+	return checksum;
+
+}
+
+// fill the record with corrections that leave the raw values unchanged
+static void mpu6050_hmc5883l_default_calibration(struct mpu6050_hmc5883l_calibration *record) {
+
+	for(uint8_t axis = 0; axis < 3; axis++) {
+		record->gyro_offset[axis] = 0;
+		record->accel_offset[axis] = 0;
+		record->accel_scale[axis] = MPU6050_HMC5883L_CALIBRATION_ONE;
+		record->magn_hard_iron[axis] = 0;
+		for(uint8_t column = 0; column < 3; column++)
+			record->magn_soft_iron[axis][column] = (axis == column) ? MPU6050_HMC5883L_CALIBRATION_ONE : 0;
+	}
+	record->gyro_offset_temperature = 0;
+	record->gyro_bias_temperature_start = 0;
+	record->gyro_bias_temperature_shift = 10;
+	for(uint8_t axis = 0; axis < 3; axis++)
+		for(uint8_t point = 0; point < MPU6050_HMC5883L_BIAS_POINTS; point++)
+			record->gyro_bias_table[axis][point] = 0;
+
+}
+
+// linear interpolation of the bias table. Points are a power of two apart so this needs no division.
+static int16_t mpu6050_hmc5883l_gyro_bias(uint8_t axis, int16_t temperature) {
+
+	const int16_t *table = calibration.gyro_bias_table[axis];
+	uint16_t shift = calibration.gyro_bias_temperature_shift;
+
+	int32_t position = (int32_t) temperature - calibration.gyro_bias_temperature_start;
+	if(position <= 0)
+		return table[0];
+
+	int32_t point = position >> shift;
+	if(point >= MPU6050_HMC5883L_BIAS_POINTS - 1)
+		return table[MPU6050_HMC5883L_BIAS_POINTS - 1];
+
+	int32_t fraction = position - (point << shift);
+	return table[point] + (((int32_t) (table[point + 1] - table[point]) * fraction) >> shift);
+
+}
+
+// a scale above 1.0 can take a reading near full scale past the range of an int16_t
+static int16_t mpu6050_hmc5883l_saturate(int32_t value) {
+
+	if(value > INT16_MAX)
+		return INT16_MAX;
+	if(value < INT16_MIN)
+		return INT16_MIN;
+	return value;
+
+}
+
+static void mpu6050_hmc5883l_update_bias_reference(void) {
+
+	for(uint8_t axis = 0; axis < 3; axis++)
+		gyro_bias_reference[axis] = mpu6050_hmc5883l_gyro_bias(axis, calibration.gyro_offset_temperature);
 
-	// read the sensor values
-	uint8_t rx_buffer[20];
-	i2c_read_registers(i2c, MPU6050_ADDRESS, 20, 0x3B, rx_buffer);
+}
+
+// returns 1 if a valid record was found in flash
+static uint8_t mpu6050_hmc5883l_load_calibration(void) {
+
+	const struct mpu6050_hmc5883l_calibration *stored = (const struct mpu6050_hmc5883l_calibration *) flash_page_address(MPU6050_HMC5883L_CALIBRATION_PAGE);
+
+	if(stored->magic != MPU6050_HMC5883L_CALIBRATION_MAGIC ||
+	   stored->version != MPU6050_HMC5883L_CALIBRATION_VERSION ||
+	   stored->checksum != mpu6050_hmc5883l_calibration_checksum(stored)) {
+		mpu6050_hmc5883l_default_calibration(&calibration);
+		mpu6050_hmc5883l_update_bias_reference();
+		return 0;
+	}
+
+	calibration = *stored;
+	mpu6050_hmc5883l_update_bias_reference();
+	return 1;
+
+}
+
+// the code runs from the same flash bank, so erasing and writing the page stalls the cpu and every interrupt for 20 - 40ms
+static uint8_t mpu6050_hmc5883l_save_calibration(void) {
+
+	calibration.magic = MPU6050_HMC5883L_CALIBRATION_MAGIC;
+	calibration.version = MPU6050_HMC5883L_CALIBRATION_VERSION;
+	calibration.checksum = mpu6050_hmc5883l_calibration_checksum(&calibration);
+
+	if(!flash_erase_page(MPU6050_HMC5883L_CALIBRATION_PAGE))
+		return 0;
+	return flash_write_page(MPU6050_HMC5883L_CALIBRATION_PAGE, &calibration, sizeof(calibration));
+
+}
+
+static void mpu6050_hmc5883l_process_sensors(enum I2C_RESULT result) {
+
+	read_pending = 0;
+
+	// skip this sample if the bus transaction failed
+	if(result != I2C_SUCCESS)
+		return;
 
 	// extract the raw values
 	int16_t  accel_x_raw  = rx_buffer[0]  << 8 | rx_buffer[1];
@@ -36,59 +162,90 @@ static void mpu6050_hmc5883l_read_sensors(void) {
 	int16_t  magn_y_raw   = rx_buffer[16] << 8 | rx_buffer[17];
 	int16_t  magn_z_raw   = rx_buffer[18] << 8 | rx_buffer[19];
 
-	// calculate the offsets at power up
-	if(samples < 64) {
-		samples++;
-		return;
-	} else if(samples < 128) {
-		gyro_x_offset += gyro_x_raw;
-		gyro_y_offset += gyro_y_raw;
-		gyro_z_offset += gyro_z_raw;
-		samples++;
+	// average the gyro readings while calibrating
+	if(calibration_samples) {
+		if(calibration_samples > CALIBRATION_SETTLE_SAMPLES) {
+			gyro_sum[0] += gyro_x_raw;
+			gyro_sum[1] += gyro_y_raw;
+			gyro_sum[2] += gyro_z_raw;
+			temperature_sum += mpu_temp_raw;
+		}
+		if(calibration_samples == CALIBRATION_SETTLE_SAMPLES + CALIBRATION_AVERAGE_SAMPLES) {
+			for(uint8_t axis = 0; axis < 3; axis++)
+				calibration.gyro_offset[axis] = gyro_sum[axis] / CALIBRATION_AVERAGE_SAMPLES;
+			calibration.gyro_offset_temperature = temperature_sum / CALIBRATION_AVERAGE_SAMPLES;
+			mpu6050_hmc5883l_update_bias_reference();
+			calibration_save_pending = 1;
+			calibration_samples = 0;
+		} else {
+			calibration_samples++;
+		}
 		return;
-	} else if(samples == 128) {
-		gyro_x_offset /= 64;
-		gyro_y_offset /= 64;
-		gyro_z_offset /= 64;
-		samples++;
-	} else {
-		gyro_x_raw -= gyro_x_offset;
-		gyro_y_raw -= gyro_y_offset;
-		gyro_z_raw -= gyro_z_offset;
 	}
 
-	// convert accelerometer readings into G's
-	float accel_x = accel_x_raw / 8192.0f;
-	float accel_y = accel_y_raw / 8192.0f;
-	float accel_z = accel_z_raw / 8192.0f;
+	// apply the calibration
+	gyro_x_raw = mpu6050_hmc5883l_saturate((int32_t) gyro_x_raw - calibration.gyro_offset[0] - mpu6050_hmc5883l_gyro_bias(0, mpu_temp_raw) + gyro_bias_reference[0]);
+	gyro_y_raw = mpu6050_hmc5883l_saturate((int32_t) gyro_y_raw - calibration.gyro_offset[1] - mpu6050_hmc5883l_gyro_bias(1, mpu_temp_raw) + gyro_bias_reference[1]);
+	gyro_z_raw = mpu6050_hmc5883l_saturate((int32_t) gyro_z_raw - calibration.gyro_offset[2] - mpu6050_hmc5883l_gyro_bias(2, mpu_temp_raw) + gyro_bias_reference[2]);
 
-	// convert temperature reading into degrees Celsius
-	float mpu_temp = mpu_temp_raw / 340.0f + 36.53f;
+	accel_x_raw = mpu6050_hmc5883l_saturate(((int32_t) (accel_x_raw - calibration.accel_offset[0]) * calibration.accel_scale[0]) >> 14);
+	accel_y_raw = mpu6050_hmc5883l_saturate(((int32_t) (accel_y_raw - calibration.accel_offset[1]) * calibration.accel_scale[1]) >> 14);
+	accel_z_raw = mpu6050_hmc5883l_saturate(((int32_t) (accel_z_raw - calibration.accel_offset[2]) * calibration.accel_scale[2]) >> 14);
 
-	// convert gyro readings into Radians per second
-	float gyro_x = gyro_x_raw / 939.650784f;
-	float gyro_y = gyro_y_raw / 939.650784f;
-	float gyro_z = gyro_z_raw / 939.650784f;
+	int32_t magn_x_centered = magn_x_raw - calibration.magn_hard_iron[0];
+	int32_t magn_y_centered = magn_y_raw - calibration.magn_hard_iron[1];
+	int32_t magn_z_centered = magn_z_raw - calibration.magn_hard_iron[2];
+	magn_x_raw = mpu6050_hmc5883l_saturate((magn_x_centered * calibration.magn_soft_iron[0][0] + magn_y_centered * calibration.magn_soft_iron[0][1] + magn_z_centered * calibration.magn_soft_iron[0][2]) >> 14);
+	magn_y_raw = mpu6050_hmc5883l_saturate((magn_x_centered * calibration.magn_soft_iron[1][0] + magn_y_centered * calibration.magn_soft_iron[1][1] + magn_z_centered * calibration.magn_soft_iron[1][2]) >> 14);
+	magn_z_raw = mpu6050_hmc5883l_saturate((magn_x_centered * calibration.magn_soft_iron[2][0] + magn_y_centered * calibration.magn_soft_iron[2][1] + magn_z_centered * calibration.magn_soft_iron[2][2]) >> 14);
 
-	// convert magnetometer readings into Gauss's
-	float magn_x = magn_x_raw / 660.0f;
-	float magn_y = magn_y_raw / 660.0f;
-	float magn_z = magn_z_raw / 660.0f;
+	// rotate the readings into the board's frame of reference
+	sample.accel_x     = MPU6050_HMC5883L_AXIS_X(accel_x_raw, accel_y_raw, accel_z_raw);
+	sample.accel_y     = MPU6050_HMC5883L_AXIS_Y(accel_x_raw, accel_y_raw, accel_z_raw);
+	sample.accel_z     = MPU6050_HMC5883L_AXIS_Z(accel_x_raw, accel_y_raw, accel_z_raw);
+	sample.gyro_x      = MPU6050_HMC5883L_AXIS_X(gyro_x_raw,  gyro_y_raw,  gyro_z_raw);
+	sample.gyro_y      = MPU6050_HMC5883L_AXIS_Y(gyro_x_raw,  gyro_y_raw,  gyro_z_raw);
+	sample.gyro_z      = MPU6050_HMC5883L_AXIS_Z(gyro_x_raw,  gyro_y_raw,  gyro_z_raw);
+	sample.magn_x      = MPU6050_HMC5883L_AXIS_X(magn_x_raw,  magn_y_raw,  magn_z_raw);
+	sample.magn_y      = MPU6050_HMC5883L_AXIS_Y(magn_x_raw,  magn_y_raw,  magn_z_raw);
+	sample.magn_z      = MPU6050_HMC5883L_AXIS_Z(magn_x_raw,  magn_y_raw,  magn_z_raw);
+	sample.temperature = mpu_temp_raw;
+	sample.timestamp = read_timestamp;
 
 	// give the event handler the sensor readings
-	event_handler(gyro_x, gyro_y, gyro_z, accel_x, accel_y, accel_z, magn_x, magn_y, magn_z);
+	event_handler(&sample);
+
+}
+
+// This will be called after a rising edge on the MPU6050's INTA pin, indicating that new readings are available.
+// The read is queued so the bus transfer happens in the background, and the readings are processed when it completes.
+static void mpu6050_hmc5883l_read_sensors(void) {
+
+	// a read that has made no progress since the previous sample is aborted, and the bus is recovered from the main loop
+	i2c_queue_watchdog(i2c);
+
+	// the previous read has not finished yet, so drop this sample instead of overwriting rx_buffer
+	if(read_pending)
+		return;
+
+	read_pending = 1;
+	read_timestamp = exti_get_timestamp(interrupt_pin);
+	if(!i2c_queue_read_registers(i2c, MPU6050_ADDRESS, 20, 0x3B, rx_buffer, &mpu6050_hmc5883l_process_sensors))
+		read_pending = 0;
 
 }
 
 /**
  * Configure an MPU6050 and HMC5883L sensor.
+ * The calibration record is loaded from flash. If flash does not contain a valid record, a gyro calibration is started.
  *
  * @param sck_pin   I2C clock pin
  * @param sda_pin   I2C data pin
  * @param int_pin   MPU6050 interrupt pin
- * @param handler   Pointer to an event handler that will be called after new sensor readings have been processed
+ * @param handler   Pointer to an event handler that will be called with each new calibrated sample
+ * @returns         1 if configured, 0 if the pins are not an I2C pin pair or SystemCoreClock is too slow for MPU6050_HMC5883L_I2C_SPEED
  */
-void mpu6050_hmc5883l_setup(enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin, enum GPIO_PIN int_pin, void (*handler)(float gyro_x, float gyro_y, float gyro_z, float accel_x, float accel_y, float accel_z, float magn_x, float magn_y, float magn_z)) {
+uint8_t mpu6050_hmc5883l_setup(enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin, enum GPIO_PIN int_pin, void (*handler)(const struct mpu6050_hmc5883l_sample *sample)) {
 
 	// determine which i2c peripheral to use
 	if(sck_pin == PB6 && sda_pin == PB7)
@@ -100,37 +257,167 @@ void mpu6050_hmc5883l_setup(enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin, enum G
 	else if(sck_pin == PF6 && sda_pin == PF7)
 		i2c = I2C2;
 	else
-		return;
+		return 0;
 
 	// assign the event handler pointer
 	event_handler = handler;
+	interrupt_pin = int_pin;
+
+	// load the calibration, or measure the gyro offsets if this is the first boot
+	if(!mpu6050_hmc5883l_load_calibration())
+		mpu6050_hmc5883l_calibrate_gyro();
 
 	// configure i2c
-	i2c_setup(i2c, FAST_MODE_400KHZ, sck_pin, sda_pin);
+	if(!i2c_setup(i2c, MPU6050_HMC5883L_I2C_SPEED, sck_pin, sda_pin))
+		return 0;
+
+	// the register writes below are queued and performed in the background by the i2c interrupt handler
 
 	// configure the MPU6050 (gyro/accelerometer)
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x6B, 0x00);                    // exit sleep
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x19, 109);                     // sample rate = 8kHz / 110 = 72.7Hz
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x1B, 0x18);                    // gyro full scale = +/- 2000dps
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x1C, 0x08);                    // accelerometer full scale = +/- 4g
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x38, 0x01);                    // enable INTA interrupt
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x6B, 0x00, 0);                       // exit sleep
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x19, 109, 0);                        // sample rate = 8kHz / 110 = 72.7Hz
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x1B, 0x18, 0);                       // gyro full scale = +/- 2000dps
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x1C, 0x08, 0);                       // accelerometer full scale = +/- 4g
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x38, 0x01, 0);                       // enable INTA interrupt
 
 	// configure the HMC5883L (magnetometer)
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x6A, 0x00);                    // disable i2c master mode
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x37, 0x02);                    // enable i2c master bypass mode
-	i2c_write_register(i2c, HMC5883L_ADDRESS, 0x00, 0x18);                    // sample rate = 75Hz
-	i2c_write_register(i2c, HMC5883L_ADDRESS, 0x01, 0x60);                    // full scale = +/- 2.5 Gauss
-	i2c_write_register(i2c, HMC5883L_ADDRESS, 0x02, 0x00);                    // continuous measurement mode
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x37, 0x00);                    // disable i2c master bypass mode
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x6A, 0x20);                    // enable i2c master mode
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x6A, 0x00, 0);                       // disable i2c master mode
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x37, 0x02, 0);                       // enable i2c master bypass mode
+	i2c_queue_write_register(i2c, HMC5883L_ADDRESS, 0x00, 0x18, 0);                       // sample rate = 75Hz
+	i2c_queue_write_register(i2c, HMC5883L_ADDRESS, 0x01, 0x60, 0);                       // full scale = +/- 2.5 Gauss
+	i2c_queue_write_register(i2c, HMC5883L_ADDRESS, 0x02, 0x00, 0);                       // continuous measurement mode
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x37, 0x00, 0);                       // disable i2c master bypass mode
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x6A, 0x20, 0);                       // enable i2c master mode
 
 	// configure the MPU6050 to automatically read the magnetometer
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x25, HMC5883L_ADDRESS | 0x80); // slave 0 i2c address, read mode
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x26, 0x03);                    // slave 0 register = 0x03 (x axis)
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x27, 6 | 0x80);                // slave 0 transfer size = 6, enabled
-	i2c_write_register(i2c, MPU6050_ADDRESS,  0x67, 1);                       // enable slave 0 delay
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x25, HMC5883L_ADDRESS | 0x80, 0);    // slave 0 i2c address, read mode
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x26, 0x03, 0);                       // slave 0 register = 0x03 (x axis)
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x27, 6 | 0x80, 0);                   // slave 0 transfer size = 6, enabled
+	i2c_queue_write_register(i2c, MPU6050_ADDRESS,  0x67, 1, 0);                          // enable slave 0 delay
 
 	// configure an external interrupt for the MPU6050's active-high INTA signal
-	exti_setup(PB7, NO_PULL, RISING_EDGE, &mpu6050_hmc5883l_read_sensors);
+	exti_setup(int_pin, NO_PULL, RISING_EDGE, &mpu6050_hmc5883l_read_sensors);
+
+	return 1;
+
+}
+
+/**
+ * Recover the I2C bus after a sensor read timed out, then retry the read.
+ * Recovery busy-waits for a few milliseconds, so call this from the main loop rather than from an interrupt.
+ */
+void mpu6050_hmc5883l_recover_bus(void) {
+
+	i2c_queue_recover(i2c);
+
+}
+
+/**
+ * Start measuring the gyro offsets. The sensor must be kept still until the calibration finishes (about 1.8 seconds.)
+ * The event handler is not called while calibrating. The new offsets are written to flash by
+ * mpu6050_hmc5883l_save_pending_calibration() once finished.
+ */
+void mpu6050_hmc5883l_calibrate_gyro(void) {
+
+	// may be called from the main loop, so don't let the i2c callback see a partial reset
+	__disable_irq();
+	gyro_sum[0] = 0;
+	gyro_sum[1] = 0;
+	gyro_sum[2] = 0;
+	temperature_sum = 0;
+	calibration_samples = 1;
+	__enable_irq();
+
+}
+
+/**
+ * Write a finished gyro calibration or an uploaded bias table to flash.
+ * Erasing the page stalls the cpu and every interrupt for 20 - 40ms, so the sensor isn't read and the event handler
+ * isn't called meanwhile. Call this from the main loop, and only while nothing depends on the event handler,
+ * e.g. while the motors are stopped. Until then the new calibration is used from RAM.
+ *
+ * @returns   1 if a calibration was written to flash, 0 if none was waiting or the write failed
+ */
+uint8_t mpu6050_hmc5883l_save_pending_calibration(void) {
+
+	if(!calibration_save_pending)
+		return 0;
+
+	// a failed write is not retried, so the main loop isn't stalled over and over
+	calibration_save_pending = 0;
+	return mpu6050_hmc5883l_save_calibration();
+
+}
+
+/**
+ * Check if a gyro calibration is in progress.
+ *
+ * @returns   1 if calibrating, 0 otherwise
+ */
+uint8_t mpu6050_hmc5883l_calibrating(void) {
+
+	return calibration_samples != 0;
+
+}
+
+/**
+ * Replace the calibration record and write it to flash.
+ * Use this to store accelerometer and magnetometer corrections that were calculated externally.
+ * Like mpu6050_hmc5883l_save_pending_calibration(), this stalls every interrupt while flash is written.
+ *
+ * @param record   The new calibration. The magic, version and checksum fields are filled in automatically.
+ * @returns        1 if the record was written to flash, 0 otherwise
+ */
+uint8_t mpu6050_hmc5883l_set_calibration(const struct mpu6050_hmc5883l_calibration *record) {
+
+	// the i2c callback reads the record, so don't let it see a partial copy
+	__disable_irq();
+	calibration = *record;
+	mpu6050_hmc5883l_update_bias_reference();
+	calibration_save_pending = 0;
+	__enable_irq();
+
+	return mpu6050_hmc5883l_save_calibration();
+
+}
+
+/**
+ * Replace the gyro bias vs temperature table and its temperature range.
+ * Use this to install a table fitted by host/gyro_temp_fit. The change is applied to the next sample,
+ * and the record is written to flash by mpu6050_hmc5883l_save_pending_calibration().
+ *
+ * @param temperature_start    Raw temperature of the first point
+ * @param temperature_shift    Points are (1 << temperature_shift) raw temperature units apart, 0 - 14
+ * @param table                MPU6050_HMC5883L_BIAS_POINTS biases in raw gyro units for x, y and z, in the sensor's axes
+ * @returns                    1 on success, 0 if the shift is out of range
+ */
+uint8_t mpu6050_hmc5883l_set_gyro_bias_table(int16_t temperature_start, uint16_t temperature_shift, const int16_t table[3][MPU6050_HMC5883L_BIAS_POINTS]) {
+
+	if(temperature_shift > 14)
+		return 0;
+
+	// the i2c callback reads the table, so don't let it see a partial update
+	__disable_irq();
+	calibration.gyro_bias_temperature_start = temperature_start;
+	calibration.gyro_bias_temperature_shift = temperature_shift;
+	for(uint8_t axis = 0; axis < 3; axis++)
+		for(uint8_t point = 0; point < MPU6050_HMC5883L_BIAS_POINTS; point++)
+			calibration.gyro_bias_table[axis][point] = table[axis][point];
+	mpu6050_hmc5883l_update_bias_reference();
+	calibration_save_pending = 1;
+	__enable_irq();
+
+	return 1;
+
+}
+
+/**
+ * Get the calibration record that is currently being applied.
+ *
+ * @returns   Pointer to the calibration record
+ */
+const struct mpu6050_hmc5883l_calibration* mpu6050_hmc5883l_get_calibration(void) {
+
+	return &calibration;
 
 }
@@ -1,14 +1,149 @@
 // Author: Farrell Farahbod <farrellfarahbod@gmail.com>
 // License: public domain
 
+#pragma once
 #include "f0lib_gpio.h"
 
+// the calibration record is stored in the last page of flash, which the linker script keeps free
+#ifndef MPU6050_HMC5883L_CALIBRATION_PAGE
+#define MPU6050_HMC5883L_CALIBRATION_PAGE 63
+#endif
+
+#define MPU6050_HMC5883L_CALIBRATION_MAGIC   0xCA11B8A7
+#define MPU6050_HMC5883L_CALIBRATION_VERSION 2
+
+// Multiply the raw sample fields by these to get physical units.
+// These match the full scale ranges configured in mpu6050_hmc5883l_setup(): +/-4g, +/-2000dps and +/-2.5Gauss.
+#define MPU6050_HMC5883L_ACCEL_G_PER_LSB       (1.0f / 8192.0f)
+#define MPU6050_HMC5883L_GYRO_RAD_PER_LSB      (1.0f / 939.650784f)
+#define MPU6050_HMC5883L_MAGN_GAUSS_PER_LSB    (1.0f / 660.0f)
+#define MPU6050_HMC5883L_TEMP_C_PER_LSB        (1.0f / 340.0f)
+#define MPU6050_HMC5883L_TEMP_C_OFFSET         36.53f
+
+// Axis remapping from the sensor's frame of reference to the board's frame of reference.
+// Each macro selects a sensor axis (x, y or z) and may negate it. Define these before building to match how the sensor is mounted.
+// The same mapping is applied to the accelerometer, gyro and magnetometer. The calibration record is applied before remapping.
+#ifndef MPU6050_HMC5883L_AXIS_X
+#define MPU6050_HMC5883L_AXIS_X(x, y, z) (x)
+#endif
+#ifndef MPU6050_HMC5883L_AXIS_Y
+#define MPU6050_HMC5883L_AXIS_Y(x, y, z) (y)
+#endif
+#ifndef MPU6050_HMC5883L_AXIS_Z
+#define MPU6050_HMC5883L_AXIS_Z(x, y, z) (z)
+#endif
+
+// One set of calibrated readings, in raw sensor units
+struct mpu6050_hmc5883l_sample {
+	int16_t  accel_x;
+	int16_t  accel_y;
+	int16_t  accel_z;
+	int16_t  temperature;
+	int16_t  gyro_x;
+	int16_t  gyro_y;
+	int16_t  gyro_z;
+	int16_t  magn_x;
+	int16_t  magn_y;
+	int16_t  magn_z;
+	uint32_t timestamp;                 // timer_microseconds() when the MPU6050 signalled new readings
+} __attribute__((packed));
+
+// scale factors are Q14 fixed point: 16384 = 1.0
+#define MPU6050_HMC5883L_CALIBRATION_ONE 16384
+
+// the gyro bias vs temperature table has this many points per axis
+#define MPU6050_HMC5883L_BIAS_POINTS 8
+
+// Corrections applied to the raw sensor values before they are converted to floats.
+// accel = (raw - accel_offset) * accel_scale
+// gyro  =  raw - gyro_offset - (bias(temperature) - bias(gyro_offset_temperature))
+// magn  = magn_soft_iron * (raw - magn_hard_iron)
+//
+// bias() interpolates gyro_bias_table, whose points are at raw temperatures start, start + (1 << shift), start + (2 << shift), etc.
+// Only the shape of the table matters: gyro_offset pins it to the temperature the offsets were measured at, so recalibrating
+// the gyro shifts the whole curve without invalidating it. A table of zeros disables temperature compensation.
+struct mpu6050_hmc5883l_calibration {
+	uint32_t magic;
+	uint16_t version;
+	int16_t  gyro_offset[3];
+	int16_t  accel_offset[3];
+	int16_t  accel_scale[3];
+	int16_t  magn_hard_iron[3];
+	int16_t  magn_soft_iron[3][3];
+	int16_t  gyro_offset_temperature;   // raw temperature when gyro_offset was measured
+	int16_t  gyro_bias_temperature_start;
+	uint16_t gyro_bias_temperature_shift;
+	int16_t  gyro_bias_table[3][MPU6050_HMC5883L_BIAS_POINTS];
+	uint16_t checksum;                  // sum of all preceding halfwords
+};
+
 /**
  * Configure an MPU6050 and HMC5883L sensor.
+ * The calibration record is loaded from flash. If flash does not contain a valid record, a gyro calibration is started.
  *
  * @param sck_pin   I2C clock pin
  * @param sda_pin   I2C data pin
  * @param int_pin   MPU6050 interrupt pin
- * @param handler   Pointer to an event handler that will be called after new sensor readings have been processed
+ * @param handler   Pointer to an event handler that will be called with each new calibrated sample
+ * @returns         1 if configured, 0 if the pins are not an I2C pin pair or SystemCoreClock is too slow for MPU6050_HMC5883L_I2C_SPEED
+ */
+uint8_t mpu6050_hmc5883l_setup(enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin, enum GPIO_PIN int_pin, void (*handler)(const struct mpu6050_hmc5883l_sample *sample));
+
+/**
+ * Recover the I2C bus after a sensor read timed out, then retry the read.
+ * Recovery busy-waits for a few milliseconds, so call this from the main loop rather than from an interrupt.
+ */
+void mpu6050_hmc5883l_recover_bus(void);
+
+/**
+ * Start measuring the gyro offsets. The sensor must be kept still until the calibration finishes (about 1.8 seconds.)
+ * The event handler is not called while calibrating. The new offsets are written to flash by
+ * mpu6050_hmc5883l_save_pending_calibration() once finished.
+ */
+void mpu6050_hmc5883l_calibrate_gyro(void);
+
+/**
+ * Write a finished gyro calibration or an uploaded bias table to flash.
+ * Erasing the page stalls the cpu and every interrupt for 20 - 40ms, so the sensor isn't read and the event handler
+ * isn't called meanwhile. Call this from the main loop, and only while nothing depends on the event handler,
+ * e.g. while the motors are stopped. Until then the new calibration is used from RAM.
+ *
+ * @returns   1 if a calibration was written to flash, 0 if none was waiting or the write failed
+ */
+uint8_t mpu6050_hmc5883l_save_pending_calibration(void);
+
+/**
+ * Check if a gyro calibration is in progress.
+ *
+ * @returns   1 if calibrating, 0 otherwise
+ */
+uint8_t mpu6050_hmc5883l_calibrating(void);
+
+/**
+ * Replace the calibration record and write it to flash.
+ * Use this to store accelerometer and magnetometer corrections that were calculated externally.
+ * Like mpu6050_hmc5883l_save_pending_calibration(), this stalls every interrupt while flash is written.
+ *
+ * @param record   The new calibration. The magic, version and checksum fields are filled in automatically.
+ * @returns        1 if the record was written to flash, 0 otherwise
+ */
+uint8_t mpu6050_hmc5883l_set_calibration(const struct mpu6050_hmc5883l_calibration *record);
+
+/**
+ * Replace the gyro bias vs temperature table and its temperature range.
+ * Use this to install a table fitted by host/gyro_temp_fit. The change is applied to the next sample,
+ * and the record is written to flash by mpu6050_hmc5883l_save_pending_calibration().
+ *
+ * @param temperature_start    Raw temperature of the first point
+ * @param temperature_shift    Points are (1 << temperature_shift) raw temperature units apart, 0 - 14
+ * @param table                MPU6050_HMC5883L_BIAS_POINTS biases in raw gyro units for x, y and z, in the sensor's axes
+ * @returns                    1 on success, 0 if the shift is out of range
+ */
+uint8_t mpu6050_hmc5883l_set_gyro_bias_table(int16_t temperature_start, uint16_t temperature_shift, const int16_t table[3][MPU6050_HMC5883L_BIAS_POINTS]);
+
+/**
+ * Get the calibration record that is currently being applied.
+ *
+ * @returns   Pointer to the calibration record
  */
-void mpu6050_hmc5883l_setup(enum GPIO_PIN sck_pin, enum GPIO_PIN sda_pin, enum GPIO_PIN int_pin, void (*handler)(float gyro_x, float gyro_y, float gyro_z, float accel_x, float accel_y, float accel_z, float magn_x, float magn_y, float magn_z));
+const struct mpu6050_hmc5883l_calibration* mpu6050_hmc5883l_get_calibration(void);
@@ -103,9 +103,59 @@
 
 static SPI_TypeDef *SPIx;
 static enum GPIO_PIN cs_pin;
+static enum GPIO_PIN miso_pin;
+static enum GPIO_PIN gdo0_pin;
 static uint8_t packet_length;
 static uint8_t rx_buffer[256];
-static void (*handler)(uint8_t byte_count, uint8_t bytes[]);
+static void (*handler)(const struct cc2500_packet *packet);
+static struct cc2500_link_statistics statistics = {0};
+static uint32_t previous_packet_timestamp = 0;
+static uint8_t link_lost = 0;       // the last valid packet is older than CC2500_PACKET_TIMEOUT
+static float packet_interval = 0;   // average microseconds between valid packets
+
+// Register values determined with the TI SmartRF program, for 160 channels of 405 kHz from 2411 MHz.
+// PKTLEN is replaced with the packet size given to cc2500_setup().
+const uint8_t cc2500_default_profile[CC2500_PROFILE_SIZE] = {
+	0x29,	// IOCFG2		reset value
+	0x2E,	// IOCFG1		reset value
+	0x06,	// IOCFG0		GDO0 as interrupt: asserts on sync, deasserts on end of packet
+	0x07,	// FIFOTHR		reset value
+	0xBE,	// SYNC1		Sync word: 0xBEEF
+	0xEF,	// SYNC0		Sync word: 0xBEEF
+	0xFF,	// PKTLEN		set by cc2500_setup()
+	0x0D,	// PKTCTRL1		Packet control: CRC autoflush, append status bytes, strict address check
+	0x44,	// PKTCTRL0		Packet control: data whitening, CRC enabled, fixed packet length mode
+	0x69,	// ADDR			Address: 0x69
+	0x7F,	// CHANNR		Channel: 127
+	0x0C,	// FSCTRL1
+	0x00,	// FSCTRL0		reset value
+	0x5C,	// FREQ2
+	0xF6,	// FREQ1
+	0x27,	// FREQ0
+	0x0E,	// MDMCFG4
+	0x3B,	// MDMCFG3
+	0x73,	// MDMCFG2		Modem configuration: MSK, 30/32 sync bits detected
+	0xC2,	// MDMCFG1		Modem configuration: FEC, 8 byte minimum preamble
+	0xF8,	// MDMCFG0		reset value
+	0x00,	// DEVIATN
+	0x07,	// MCSM2		reset value
+	0x0E,	// MCSM1		Radio state machine: stay in TX mode after sending a packet, stay in RX mode after receiving
+	0x18,	// MCSM0
+	0x1D,	// FOCCFG
+	0x1C,	// BSCFG
+	0xC7,	// AGCCTRL2
+	0x40,	// AGCCTRL1		reset value
+	0xB0,	// AGCCTRL0
+	0x87,	// WOREVT1		reset value
+	0x6B,	// WOREVT0		reset value
+	0xF8,	// WORCTRL		reset value
+	0xB6,	// FREND1
+	0x10,	// FREND0		reset value
+	0xEA,	// FSCAL3
+	0x0A,	// FSCAL2		reset value
+	0x00,	// FSCAL1
+	0x19	// FSCAL0
+};
 
 /**
  * Access a configuration register on the CC2500.
@@ -128,6 +178,63 @@ static uint8_t cc2500_write_register(uint8_t reg, uint8_t val) {
 
 }
 
+/**
+ * Reads consecutive registers, or several bytes of the RX FIFO, in one burst with CS held low.
+ *
+ * @param reg      First register, or FIFO
+ * @param bytes    Where to write the values
+ * @param count    Number of bytes to read
+ * @returns        Status byte
+ */
+static uint8_t cc2500_read_burst(uint8_t reg, uint8_t *bytes, uint8_t count) {
+
+	uint8_t status = 0;
+
+	gpio_low(cs_pin);
+	status = spi_write_byte(SPIx, reg | READ_BURST);
+	spi_read_bytes(SPIx, bytes, count);
+	gpio_high(cs_pin);
+
+	return status;
+
+}
+
+/**
+ * Writes consecutive registers in one burst with CS held low.
+ *
+ * @param reg      First register
+ * @param bytes    Values to write
+ * @param count    Number of registers
+ * @returns        Status byte
+ */
+static uint8_t cc2500_write_burst(uint8_t reg, const uint8_t *bytes, uint8_t count) {
+
+	uint8_t status = 0;
+
+	gpio_low(cs_pin);
+	status = spi_write_byte(SPIx, reg | WRITE_BURST);
+	spi_write_buffer(SPIx, bytes, count);
+	gpio_high(cs_pin);
+
+	return status;
+
+}
+
+/**
+ * Waits for the CC2500 to be ready while CS is low. SO (MISO) is then CHIP_RDYn, which goes low once the crystal is running.
+ *
+ * @returns    1 if ready, 0 if CHIP_RDYn stayed high for CC2500_RESET_TIMEOUT polls
+ */
+static uint8_t cc2500_wait_ready(void) {
+
+	for(uint32_t i = 0; i < CC2500_RESET_TIMEOUT; i++)
+		if(gpio_read(miso_pin) == 0)
+			return 1;
+
+	return 0;
+
+}
+
 /**
  * Send a command strobe (one-byte register access that initiates an action.)
  *
@@ -194,6 +301,45 @@ uint8_t cc2500_get_rssi(void) {
 
 }
 
+/**
+ * Gets the link counters and rolling averages. Packets lost without a sync word never reach the CC2500's FIFO,
+ * so they only show up as a lower packet rate. Measuring loss needs the transmitter to number its packets.
+ *
+ * @returns    Pointer to the statistics, which are updated as packets are received
+ */
+const struct cc2500_link_statistics* cc2500_get_link_statistics(void) {
+
+	return &statistics;
+
+}
+
+/**
+ * Gets the time since the last valid packet, to notice when the transmitter's commands have gone stale.
+ * Once the last packet is older than CC2500_PACKET_TIMEOUT, 0xFFFFFFFF is returned until the next packet arrives,
+ * so the difference wrapping around after about 71 minutes can't make an old packet look fresh again.
+ * This relies on the age being read at least every 35 minutes, which a control loop does anyway.
+ *
+ * @param now    timer_microseconds(), or a timestamp taken a little earlier (such as a sensor sample's)
+ * @returns      Microseconds since GDO0 signalled the end of the last valid packet, 0 if that packet arrived after now,
+ *               or 0xFFFFFFFF if no packet has been received yet or the last one is stale
+ */
+uint32_t cc2500_get_packet_age(uint32_t now) {
+
+	if(statistics.packets == 0 || link_lost)
+		return 0xFFFFFFFF;
+
+	// now can be read slightly before the packet arrived, anything else negative has wrapped around
+	int32_t age = now - previous_packet_timestamp;
+	if(age <= 0 && age > -CC2500_PACKET_TIMEOUT)
+		return 0;
+	if(age <= 0 || age > CC2500_PACKET_TIMEOUT) {
+		link_lost = 1;
+		return 0xFFFFFFFF;
+	}
+	return age;
+
+}
+
 /**
  * Flushes the receiver FIFO.
  */
@@ -256,35 +402,113 @@ void cc2500_transmit_packet(uint8_t bytes[]) {
 
 }
 
+/**
+ * Writes a set of configuration registers, IOCFG2 (0x00) to FSCAL0 (0x26), in one burst.
+ * PKTLEN is always set to the packet size given to cc2500_setup(), whatever the profile contains.
+ * The radio is left idle, so call cc2500_enter_rx_mode() or cc2500_enter_tx_mode() afterwards.
+ *
+ * @param profile    Register values, such as cc2500_default_profile
+ */
+void cc2500_load_profile(const uint8_t profile[CC2500_PROFILE_SIZE]) {
+
+	cc2500_send_strobe(SIDLE);
+	cc2500_write_burst(IOCFG2, profile, CC2500_PROFILE_SIZE);
+	cc2500_write_register(PKTLEN, packet_length + 1); // +1 for the address at byte 0
+
+}
+
+/**
+ * Updates the link statistics after an end of packet.
+ *
+ * @param packet    The packet, or 0 if it failed its CRC or overflowed the FIFO
+ */
+static void cc2500_update_statistics(const struct cc2500_packet *packet) {
+
+	const float weight = CC2500_STATISTICS_WEIGHT;
+
+	if(!packet)
+		return;
+
+	// the first packet starts the averages instead of being blended with zeros
+	if(statistics.packets == 0) {
+		statistics.rssi = packet->rssi;
+		statistics.lqi = packet->lqi;
+	} else {
+		statistics.rssi += weight * (packet->rssi - statistics.rssi);
+		statistics.lqi += weight * (packet->lqi - statistics.lqi);
+		float interval = packet->timestamp - previous_packet_timestamp;
+		packet_interval = (statistics.packets == 1) ? interval : packet_interval + weight * (interval - packet_interval);
+		statistics.packet_rate = (packet_interval > 0) ? 1000000.0f / packet_interval : 0;
+	}
+
+	statistics.packets++;
+	previous_packet_timestamp = packet->timestamp;
+	link_lost = 0;
+
+}
+
 // This will be called after a falling edge on the GDO0 pin, indicating that a packet has been received
 // *HOWEVER* that does not mean the packet was valid (CRC test passed)
-// If the CRC check fails the RX FIFO will be automatically flushed by the CC2500.
+// If the CRC check fails the RX FIFO will be automatically flushed by the CC2500, so it will be too short (usually empty.)
 static void receiver_handler(void) {
 
+	struct cc2500_packet packet;
+	packet.timestamp = exti_get_timestamp(gdo0_pin);
+
 	uint8_t byte_count = cc2500_write_register(RXBYTES | READ_BYTE, 0x00);
 
 	// check for RX FIFO overflow
 	if(byte_count >> 7) {
+		statistics.overflows++;
+		cc2500_update_statistics(0);
 		cc2500_flush_rx_fifo();
 		cc2500_enter_rx_mode();
 		return;
 	}
 
-	// receive the bytes
-	for(uint8_t i = 0; i < byte_count; i++)
-		rx_buffer[i] = cc2500_write_register(FIFO | READ_BYTE, 0x00);
+	// the address, payload and two status bytes, unless the packet was discarded
+	if(byte_count < packet_length + 3) {
+		statistics.crc_errors++;
+		cc2500_update_statistics(0);
+		if(byte_count > 0) {
+			cc2500_send_strobe(SIDLE); // the FIFO can only be flushed when idle
+			cc2500_flush_rx_fifo();
+		}
+		cc2500_enter_rx_mode();
+		return;
+	}
+
+	// receive the address, payload and appended status bytes in one burst
+	cc2500_read_burst(FIFO, rx_buffer, byte_count);
 
 	// re-enter RX mode
 	cc2500_enter_rx_mode();
 
+	// status bytes: RSSI (signed, half dB steps), then CRC_OK and the LQI
+	int8_t raw_rssi = rx_buffer[packet_length + 1];
+	uint8_t lqi_crc = rx_buffer[packet_length + 2];
+	packet.rssi = raw_rssi / 2 - CC2500_RSSI_OFFSET;
+	packet.lqi = lqi_crc & 0x7F;
+	packet.crc_ok = lqi_crc >> 7;
+
+	// only possible with a profile that turns CRC autoflush off
+	if(!packet.crc_ok) {
+		statistics.crc_errors++;
+		cc2500_update_statistics(0);
+		return;
+	}
+	cc2500_update_statistics(&packet);
+
 	// call the user's packet handler function, skipping past byte 0 (address byte)
-	handler(packet_length, &rx_buffer[1]);
+	packet.byte_count = packet_length;
+	packet.bytes = &rx_buffer[1];
+	handler(&packet);
 
 }
 
 /**
- * Setup SPI, reset the CC2500, then write to registers that must be different from their reset values.
- * Register values were determined with the TI SmartRF program.
+ * Setup SPI, reset the CC2500, then write cc2500_default_profile to the configuration registers in one burst.
+ * Reset completion is detected on the MISO pin (CHIP_RDYn), rather than by waiting a fixed time.
  *
  * The CC2500 supports a frequency range of 2400 - 2483.5 MHz, and it can be split up into 256 (or fewer) channels.
  * This function configures the CC2500 for 160 (0-159) channels.
@@ -299,11 +523,14 @@ static void receiver_handler(void) {
  * @param gdo0              GDO0 interrupt pin
  * @param packet_size       Number of bytes in a packet
  * @param packet_handler    Your function that will be called after successfully receiving a packet
+ * @returns                 1 on success, 0 if the CC2500 did not become ready after reset
  */
-void cc2500_setup(SPI_TypeDef *spi, enum GPIO_PIN clk, enum GPIO_PIN miso, enum GPIO_PIN mosi, enum GPIO_PIN cs, enum GPIO_PIN gdo0, uint8_t packet_size, void (*packet_handler)(uint8_t byte_count, uint8_t bytes[])) {
+uint8_t cc2500_setup(SPI_TypeDef *spi, enum GPIO_PIN clk, enum GPIO_PIN miso, enum GPIO_PIN mosi, enum GPIO_PIN cs, enum GPIO_PIN gdo0, uint8_t packet_size, void (*packet_handler)(const struct cc2500_packet *packet)) {
 
 	SPIx = spi;
 	cs_pin = cs;
+	miso_pin = miso;
+	gdo0_pin = gdo0;
 	packet_length = packet_size;
 	handler = packet_handler;
 
@@ -312,42 +539,22 @@ void cc2500_setup(SPI_TypeDef *spi, enum GPIO_PIN clk, enum GPIO_PIN miso, enum
 	gpio_setup(cs, OUTPUT, PUSH_PULL, FIFTY_MHZ, NO_PULL, AF0);
 	gpio_high(cs_pin);
 
-	// ensure cc2500 registers contain their reset values
-	cc2500_send_strobe(SRES);
-
-	// waste time for reset to complete
-	for(volatile uint32_t i = 0; i < 99999; i++);
-
-	// write to the registers that need different values
-	cc2500_write_register(IOCFG0,	0x06);	// GDO0 as interrupt: asserts on sync, deasserts on end of packet
-	cc2500_write_register(SYNC1,	0xBE);	// Sync word: 0xBEEF
-	cc2500_write_register(SYNC0,	0xEF);	// Sync word: 0xBEEF
-	cc2500_write_register(PKTLEN,	packet_size+1); // Packet length +1 for the address at byte 0
-	cc2500_write_register(PKTCTRL1,	0x0D);	// Packet control: CRC autoflush, append status bytes, strict address check
-	cc2500_write_register(PKTCTRL0,	0x44);	// Packet control: data whitening, CRC enabled, fixed packet length mode
-	cc2500_write_register(ADDR,		0x69);	// Address: 0x69
-	cc2500_write_register(CHANNR,	0x7F);	// Channel: 127
-	cc2500_write_register(FSCTRL1,	0x0C);	//
-	cc2500_write_register(FREQ2,	0x5C);	//
-	cc2500_write_register(FREQ1,	0xF6);	//
-	cc2500_write_register(FREQ0,	0x27);	//
-	cc2500_write_register(MDMCFG4,	0x0E);	//
-	cc2500_write_register(MDMCFG3,	0x3B);	//
-	cc2500_write_register(MDMCFG2,	0x73);	// Modem configuration: MSK, 30/32 sync bits detected
-	cc2500_write_register(MDMCFG1,	0xC2);	// Modem configuration: FEC, 8 byte minimum preamble
-	cc2500_write_register(DEVIATN,	0x00);	//
-	cc2500_write_register(MCSM1,	0x0E);	// Radio state machine: stay in TX mode after sending a packet, stay in RX mode after receiving
-	cc2500_write_register(MCSM0,	0x18);	//
-	cc2500_write_register(FOCCFG,	0x1D);	//
-	cc2500_write_register(BSCFG,	0x1C);	//
-	cc2500_write_register(AGCCTRL2,	0xC7);	//
-	cc2500_write_register(AGCCTRL0,	0xB0);	//
-	cc2500_write_register(FREND1,	0xB6);	//
-	cc2500_write_register(FSCAL3,	0xEA);	//
-	cc2500_write_register(FSCAL1,	0x00);	//
-	cc2500_write_register(FSCAL0,	0x19);	//
-	cc2500_write_register(PATABLE,	0xFF);	// Output power: +1dBm (the maximum possible)
+	// ensure cc2500 registers contain their reset values, with CS held low until the chip is ready again
+	gpio_low(cs_pin);
+	uint8_t ready = cc2500_wait_ready();
+	if(ready) {
+		spi_write_byte(SPIx, SRES);
+		ready = cc2500_wait_ready();
+	}
+	gpio_high(cs_pin);
+	if(!ready)
+		return 0;
+
+	// write the registers, then the output power: +1dBm (the maximum possible)
+	cc2500_load_profile(cc2500_default_profile);
+	cc2500_write_register(PATABLE, 0xFF);
 
 	exti_setup(gdo0, NO_PULL, FALLING_EDGE, &receiver_handler); // GDO0 falls at end of packet
+	return 1;
 
 }
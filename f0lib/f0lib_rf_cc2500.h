@@ -7,6 +7,52 @@
 #include "f0lib_spi.h"
 #include "f0lib_gpio.h"
 
+// configuration registers in a profile: IOCFG2 (0x00) to FSCAL0 (0x26)
+#define CC2500_PROFILE_SIZE 0x27
+
+// polls of CHIP_RDYn before cc2500_setup() gives up on the CC2500 (a few ms, the crystal usually starts in 150us)
+#ifndef CC2500_RESET_TIMEOUT
+#define CC2500_RESET_TIMEOUT 100000
+#endif
+
+// the register set written by cc2500_setup(). Copy it and change some values to make another profile.
+extern const uint8_t cc2500_default_profile[CC2500_PROFILE_SIZE];
+
+// subtracted from half the raw RSSI to get dBm, for the 500 kBaud data rate of cc2500_default_profile
+#ifndef CC2500_RSSI_OFFSET
+#define CC2500_RSSI_OFFSET 72
+#endif
+
+// packets older than this (microseconds) are stale, see cc2500_get_packet_age()
+#ifndef CC2500_PACKET_TIMEOUT
+#define CC2500_PACKET_TIMEOUT 250000
+#endif
+
+// weight of the newest packet in the rolling link statistics, so they follow roughly the last 16 packets
+#ifndef CC2500_STATISTICS_WEIGHT
+#define CC2500_STATISTICS_WEIGHT 0.0625f
+#endif
+
+// A received packet, passed to the packet handler
+struct cc2500_packet {
+	uint8_t byte_count;     // payload size
+	uint8_t *bytes;         // payload, after the address byte
+	uint32_t timestamp;     // timer_microseconds() when GDO0 signalled the end of the packet
+	int16_t rssi;           // dBm, from the status bytes the CC2500 appends to the packet
+	uint8_t lqi;            // link quality indicator, 0 - 127, lower is better
+	uint8_t crc_ok;         // 1 if the CRC was valid (always, since CRC autoflush discards the others)
+};
+
+// Link counters, and rolling (exponentially weighted) averages that are updated with every end of packet
+struct cc2500_link_statistics {
+	uint32_t packets;       // packets received with a valid CRC
+	uint32_t crc_errors;    // ends of packets that left nothing in the RX FIFO, because CRC autoflush discarded them
+	uint32_t overflows;     // RX FIFO overflows
+	float packet_rate;      // valid packets per second, from the average interval between them
+	float rssi;             // average dBm of recent valid packets
+	float lqi;              // average link quality indicator of recent valid packets
+};
+
 /**
  * Gets the status byte.
  *
@@ -37,6 +83,26 @@ uint8_t cc2500_get_channel(void);
  */
 uint8_t cc2500_get_rssi(void);
 
+/**
+ * Gets the link counters and rolling averages. Packets lost without a sync word never reach the CC2500's FIFO,
+ * so they only show up as a lower packet rate. Measuring loss needs the transmitter to number its packets.
+ *
+ * @returns    Pointer to the statistics, which are updated as packets are received
+ */
+const struct cc2500_link_statistics* cc2500_get_link_statistics(void);
+
+/**
+ * Gets the time since the last valid packet, to notice when the transmitter's commands have gone stale.
+ * Once the last packet is older than CC2500_PACKET_TIMEOUT, 0xFFFFFFFF is returned until the next packet arrives,
+ * so the difference wrapping around after about 71 minutes can't make an old packet look fresh again.
+ * This relies on the age being read at least every 35 minutes, which a control loop does anyway.
+ *
+ * @param now    timer_microseconds(), or a timestamp taken a little earlier (such as a sensor sample's)
+ * @returns      Microseconds since GDO0 signalled the end of the last valid packet, 0 if that packet arrived after now,
+ *               or 0xFFFFFFFF if no packet has been received yet or the last one is stale
+ */
+uint32_t cc2500_get_packet_age(uint32_t now);
+
 /**
  * Flushes the receiver FIFO.
  */
@@ -65,8 +131,17 @@ void cc2500_enter_tx_mode(void);
 void cc2500_transmit_packet(uint8_t bytes[]);
 
 /**
- * Setup SPI, reset the CC2500, then write to registers that must be different from their reset values.
- * Register values were determined with the TI SmartRF program.
+ * Writes a set of configuration registers, IOCFG2 (0x00) to FSCAL0 (0x26), in one burst.
+ * PKTLEN is always set to the packet size given to cc2500_setup(), whatever the profile contains.
+ * The radio is left idle, so call cc2500_enter_rx_mode() or cc2500_enter_tx_mode() afterwards.
+ *
+ * @param profile    Register values, such as cc2500_default_profile
+ */
+void cc2500_load_profile(const uint8_t profile[CC2500_PROFILE_SIZE]);
+
+/**
+ * Setup SPI, reset the CC2500, then write cc2500_default_profile to the configuration registers in one burst.
+ * Reset completion is detected on the MISO pin (CHIP_RDYn), rather than by waiting a fixed time.
  *
  * The CC2500 supports a frequency range of 2400 - 2483.5 MHz, and it can be split up into 256 (or fewer) channels.
  * This function configures the CC2500 for 160 (0-159) channels.
@@ -81,5 +156,6 @@ void cc2500_transmit_packet(uint8_t bytes[]);
  * @param gdo0              GDO0 interrupt pin
  * @param packet_size       Number of bytes in a packet
  * @param packet_handler    Your function that will be called after successfully receiving a packet
+ * @returns                 1 on success, 0 if the CC2500 did not become ready after reset
  */
-void cc2500_setup(SPI_TypeDef *spi, enum GPIO_PIN clk, enum GPIO_PIN miso, enum GPIO_PIN mosi, enum GPIO_PIN cs, enum GPIO_PIN gdo0, uint8_t packet_size, void (*packet_handler)(uint8_t byte_count, uint8_t bytes[]));
+uint8_t cc2500_setup(SPI_TypeDef *spi, enum GPIO_PIN clk, enum GPIO_PIN miso, enum GPIO_PIN mosi, enum GPIO_PIN cs, enum GPIO_PIN gdo0, uint8_t packet_size, void (*packet_handler)(const struct cc2500_packet *packet));
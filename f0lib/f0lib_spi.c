@@ -89,3 +89,54 @@ uint8_t spi_write_bytes(SPI_TypeDef *spi, uint8_t byteCount, uint8_t firstByte,
 
 	return returnValue;
 }
+
+
+/**
+ * Writes multiple bytes from a buffer, discarding the received bytes.
+ * The next byte is queued while the previous one is being clocked, so there are no gaps between bytes.
+ * This function does NOT toggle the CS line -- do that manually.
+ *
+ * @param spi			Either SPI1 or SPI2
+ * @param bytes			Bytes to send
+ * @param byteCount		Number of bytes to write
+ */
+void spi_write_buffer(SPI_TypeDef *spi, const uint8_t *bytes, uint16_t byteCount) {
+	volatile uint8_t *spi_dr = (volatile uint8_t*) &spi->DR;
+	uint16_t sent = 0;
+	uint16_t received = 0;
+
+	while(received < byteCount) {
+		// keep at most two bytes in flight so the 4-byte RX FIFO can't overflow
+		if(sent < byteCount && sent - received < 2 && (spi->SR & SPI_SR_TXE))
+			*spi_dr = bytes[sent++];						// queue the next byte
+		if(spi->SR & SPI_SR_RXNE) {
+			(void) *spi_dr;									// discard a received byte
+			received++;
+		}
+	}
+}
+
+/**
+ * Reads multiple bytes into a buffer, sending 0x00 for each one.
+ * The next byte is queued while the previous one is being clocked, so there are no gaps between bytes.
+ * This function does NOT toggle the CS line -- do that manually.
+ *
+ * @param spi			Either SPI1 or SPI2
+ * @param bytes			Where to write the received bytes
+ * @param byteCount		Number of bytes to read
+ */
+void spi_read_bytes(SPI_TypeDef *spi, uint8_t *bytes, uint16_t byteCount) {
+	volatile uint8_t *spi_dr = (volatile uint8_t*) &spi->DR;
+	uint16_t sent = 0;
+	uint16_t received = 0;
+
+	while(received < byteCount) {
+		// keep at most two bytes in flight so the 4-byte RX FIFO can't overflow
+		if(sent < byteCount && sent - received < 2 && (spi->SR & SPI_SR_TXE)) {
+			*spi_dr = 0x00;									// queue the next byte
+			sent++;
+		}
+		if(spi->SR & SPI_SR_RXNE)
+			bytes[received++] = *spi_dr;					// collect a received byte
+	}
+}
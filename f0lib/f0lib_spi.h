@@ -59,4 +59,26 @@ uint8_t spi_write_byte(SPI_TypeDef *spi, uint8_t byte);
  * @returns				Last byte of data received
  */
 uint8_t spi_write_bytes(SPI_TypeDef *spi, uint8_t byteCount, uint8_t firstByte, ...);
+
+/**
+ * Writes multiple bytes from a buffer, discarding the received bytes.
+ * The next byte is queued while the previous one is being clocked, so there are no gaps between bytes.
+ * This function does NOT toggle the CS line -- do that manually.
+ *
+ * @param spi			Either SPI1 or SPI2
+ * @param bytes			Bytes to send
+ * @param byteCount		Number of bytes to write
+ */
+void spi_write_buffer(SPI_TypeDef *spi, const uint8_t *bytes, uint16_t byteCount);
+
+/**
+ * Reads multiple bytes into a buffer, sending 0x00 for each one.
+ * The next byte is queued while the previous one is being clocked, so there are no gaps between bytes.
+ * This function does NOT toggle the CS line -- do that manually.
+ *
+ * @param spi			Either SPI1 or SPI2
+ * @param bytes			Where to write the received bytes
+ * @param byteCount		Number of bytes to read
+ */
+void spi_read_bytes(SPI_TypeDef *spi, uint8_t *bytes, uint16_t byteCount);
 #endif
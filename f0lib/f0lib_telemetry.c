@@ -0,0 +1,350 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include "f0lib_telemetry.h"
+#include "f0lib_uart.h"
+#include "stm32f0xx.h"
+#include <string.h>
+
+static const struct telemetry_channel *channels = 0;
+static uint8_t channel_count = 0;
+static float inverse_scales[TELEMETRY_MAX_CHANNELS];  // avoids a software division per value
+static volatile uint8_t decimations[TELEMETRY_MAX_CHANNELS];
+static uint8_t countdowns[TELEMETRY_MAX_CHANNELS];     // calls of telemetry_send() until the channel is due
+
+static uint8_t next_descriptor = 0;
+static uint8_t descriptors_pending = 0;           // descriptors still to be sent back to back
+static uint8_t frames_until_descriptor = 0;
+static volatile uint8_t schema_requested = 0;
+
+static uint16_t sequence = 0;                     // data frames built, including any the UART dropped
+
+static volatile uint8_t ack_commands[TELEMETRY_ACK_QUEUE];
+static volatile uint8_t ack_results[TELEMETRY_ACK_QUEUE];
+static volatile uint8_t acks_queued = 0;
+
+static const struct telemetry_histogram *histogram_queue[TELEMETRY_HISTOGRAM_QUEUE];
+static volatile uint8_t histograms_queued = 0;
+
+/**
+ * Sets the channel table and starts sending its descriptors. uart_setup() must be called first.
+ *
+ * @param table      Table of channels, which must remain valid (usually const)
+ * @param count      Number of channels, 1 to TELEMETRY_MAX_CHANNELS
+ */
+void telemetry_setup(const struct telemetry_channel *table, uint8_t count) {
+
+	// telemetry_send() needs at least one channel to describe
+	if(count == 0 || count > TELEMETRY_MAX_CHANNELS)
+		return;
+
+	channels = table;
+	channel_count = count;
+
+	for(uint8_t j = 0; j < count; j++) {
+		inverse_scales[j] = (table[j].type == TELEMETRY_FLOAT || table[j].scale == 0.0f) ? 1.0f : 1.0f / table[j].scale;
+		decimations[j] = 1;
+		countdowns[j] = 0;
+	}
+
+	next_descriptor = 0;
+	descriptors_pending = count;
+	frames_until_descriptor = 0;
+
+}
+
+/**
+ * Converts a value to a rounded integer, saturated to [min, max]. NaN becomes min.
+ */
+static int32_t telemetry_quantize(float value, float inverse_scale, int32_t min, int32_t max) {
+
+	float q = value * inverse_scale;
+
+	if(q >= (float) max)
+		return max;
+	if(!(q > (float) min))
+		return min;
+	return (int32_t) (q >= 0.0f ? q + 0.5f : q - 0.5f);
+
+}
+
+/**
+ * Queues the descriptor frame of one channel.
+ */
+static void telemetry_send_descriptor(uint8_t index) {
+
+	const struct telemetry_channel *channel = &channels[index];
+	uint8_t *payload = (uint8_t*) uart_frame_begin();
+	uint16_t n = 0;
+
+	payload[n++] = TELEMETRY_DESCRIPTOR_FRAME;
+	payload[n++] = index;
+	payload[n++] = channel_count;
+	payload[n++] = channel->type;
+	payload[n++] = decimations[index];
+	memcpy(&payload[n], &channel->scale, sizeof(float));
+	n += sizeof(float);
+
+	uint16_t length = strlen(channel->name) + 1;
+	memcpy(&payload[n], channel->name, length);
+	n += length;
+
+	length = strlen(channel->unit) + 1;
+	memcpy(&payload[n], channel->unit, length);
+	n += length;
+
+	uart_frame_end(n);
+
+}
+
+/**
+ * Queues the frame of the oldest acknowledgement in the queue.
+ */
+static void telemetry_send_next_ack(void) {
+
+	uint8_t *payload = (uint8_t*) uart_frame_begin();
+	payload[0] = TELEMETRY_ACK_FRAME;
+	payload[1] = ack_commands[0];
+	payload[2] = ack_results[0];
+	uart_frame_end(3);
+
+	__disable_irq();
+	acks_queued--;
+	for(uint8_t j = 0; j < acks_queued; j++) {
+		ack_commands[j] = ack_commands[j + 1];
+		ack_results[j] = ack_results[j + 1];
+	}
+	__enable_irq();
+
+}
+
+/**
+ * Queues the frame of the oldest histogram in the queue.
+ */
+static void telemetry_send_next_histogram(void) {
+
+	const struct telemetry_histogram *histogram = histogram_queue[0];
+	uint8_t *payload = (uint8_t*) uart_frame_begin();
+	uint16_t n = 0;
+
+	payload[n++] = TELEMETRY_HISTOGRAM_FRAME;
+	payload[n++] = histogram->id;
+	payload[n++] = TELEMETRY_HISTOGRAM_BINS;
+	memcpy(&payload[n], &histogram->bin_width, sizeof(uint16_t));
+	n += sizeof(uint16_t);
+	memcpy(&payload[n], &histogram->first_bin, sizeof(int32_t));
+	n += sizeof(int32_t);
+	memcpy(&payload[n], histogram->counts, sizeof(histogram->counts));
+	n += sizeof(histogram->counts);
+
+	uart_frame_end(n);
+
+	__disable_irq();
+	histograms_queued--;
+	for(uint8_t j = 0; j < histograms_queued; j++)
+		histogram_queue[j] = histogram_queue[j + 1];
+	__enable_irq();
+
+}
+
+/**
+ * Queues the acknowledgement and the descriptor that are due, then reads the value of every channel that is due and
+ * queues a data frame, followed by a histogram if one is waiting. No data frame is sent if no channel is due.
+ * If the TX ring is full the data frame is dropped, but the other frames wait for a later call.
+ *
+ * @param timestamp   Time of the sample the values were calculated from, in microseconds
+ */
+void telemetry_send(uint32_t timestamp) {
+
+	if(!channels)
+		return;
+
+	// acknowledgements go first so a saturated link can't starve them
+	while(acks_queued > 0 && uart_tx_slots_free() > 0)
+		telemetry_send_next_ack();
+
+	if(schema_requested) {
+		schema_requested = 0;
+		descriptors_pending = channel_count;
+	}
+
+	// send the descriptors back to back after setup, then spread them out
+	if(descriptors_pending == 0 && frames_until_descriptor > 0) {
+		frames_until_descriptor--;
+	} else if(uart_tx_slots_free() > 0) {
+		telemetry_send_descriptor(next_descriptor);
+		next_descriptor = (next_descriptor + 1 == channel_count) ? 0 : next_descriptor + 1;
+
+		if(descriptors_pending > 0)
+			descriptors_pending--;
+		if(descriptors_pending == 0)
+			frames_until_descriptor = TELEMETRY_DESCRIPTOR_INTERVAL - 1;
+	}
+
+	uint8_t *payload = (uint8_t*) uart_frame_begin();
+	uint16_t n = 0;
+	uint32_t mask = 0;
+
+	payload[n++] = TELEMETRY_DATA_FRAME;
+	n += 2; // the sequence number is filled in below
+	memcpy(&payload[n], &timestamp, sizeof(uint32_t));
+	n += 4;
+	uint16_t dropped = uart_get_statistics()->frames_dropped;
+	payload[n++] = (dropped >> 0) & 0xFF;
+	payload[n++] = (dropped >> 8) & 0xFF;
+	n += 4; // the mask is filled in below
+
+	for(uint8_t j = 0; j < channel_count; j++) {
+
+		// skip channels that are disabled or not due yet
+		uint8_t decimation = decimations[j];
+		if(decimation == 0)
+			continue;
+		if(countdowns[j] > 0) {
+			countdowns[j]--;
+			continue;
+		}
+		countdowns[j] = decimation - 1;
+		mask |= (uint32_t) 1 << j;
+
+		float value = *channels[j].value;
+
+		if(channels[j].type == TELEMETRY_INT8) {
+
+			payload[n++] = telemetry_quantize(value, inverse_scales[j], INT8_MIN, INT8_MAX);
+
+		} else if(channels[j].type == TELEMETRY_INT16) {
+
+			int32_t q = telemetry_quantize(value, inverse_scales[j], INT16_MIN, INT16_MAX);
+			payload[n++] = (q >> 0) & 0xFF;
+			payload[n++] = (q >> 8) & 0xFF;
+
+		} else {
+
+			memcpy(&payload[n], &value, sizeof(float));
+			n += sizeof(float);
+
+		}
+
+	}
+
+	payload[9]  = (mask >>  0) & 0xFF;
+	payload[10] = (mask >>  8) & 0xFF;
+	payload[11] = (mask >> 16) & 0xFF;
+	payload[12] = (mask >> 24) & 0xFF;
+
+	if(mask) {
+		payload[1] = (sequence >> 0) & 0xFF;
+		payload[2] = (sequence >> 8) & 0xFF;
+		sequence++;
+		uart_frame_end(n);
+	} else {
+		uart_reset_tx_buffer();
+	}
+
+	if(histograms_queued > 0 && uart_tx_slots_free() > 0)
+		telemetry_send_next_histogram();
+
+}
+
+/**
+ * Enables, disables or decimates a channel. All channels start with a decimation of 1.
+ *
+ * @param channel      Index in the channel table
+ * @param decimation   0 = disabled, 1 = every time, n = every nth time
+ * @returns            1 on success, 0 if there is no such channel
+ */
+uint8_t telemetry_set_decimation(uint8_t channel, uint8_t decimation) {
+
+	if(channel >= channel_count)
+		return 0;
+
+	decimations[channel] = decimation;
+	countdowns[channel] = 0; // due on the next call
+	return 1;
+
+}
+
+/**
+ * Gets a channel's decimation.
+ *
+ * @param channel   Index in the channel table
+ * @returns         The decimation, or 0 if there is no such channel
+ */
+uint8_t telemetry_get_decimation(uint8_t channel) {
+
+	if(channel >= channel_count)
+		return 0;
+
+	return decimations[channel];
+
+}
+
+/**
+ * Sends every descriptor again, back to back, starting with the next call of telemetry_send().
+ */
+void telemetry_send_schema(void) {
+
+	schema_requested = 1;
+
+}
+
+/**
+ * Queues an acknowledgement frame, which is sent by the next call of telemetry_send(), or a later one if the TX ring is full.
+ * Up to TELEMETRY_ACK_QUEUE acknowledgements can wait. If the queue is full the newest one is replaced.
+ *
+ * @param command   Identifies what is being acknowledged, such as a received command
+ * @param result    1 for success, 0 for failure, or any other value the receiver understands
+ */
+void telemetry_acknowledge(uint8_t command, uint8_t result) {
+
+	__disable_irq();
+	if(acks_queued < TELEMETRY_ACK_QUEUE)
+		acks_queued++;
+	ack_commands[acks_queued - 1] = command;
+	ack_results[acks_queued - 1] = result;
+	__enable_irq();
+
+}
+
+/**
+ * Counts a value in a histogram. Values outside the range are counted in the first or last bin,
+ * and a bin stops counting at 65535.
+ *
+ * @param histogram   The histogram
+ * @param value       Value to count
+ */
+void telemetry_histogram_add(struct telemetry_histogram *histogram, int32_t value) {
+
+	uint32_t bin = 0;
+	if(value > histogram->first_bin && histogram->bin_width > 0)
+		bin = ((uint32_t) value - (uint32_t) histogram->first_bin) / histogram->bin_width;
+	if(bin >= TELEMETRY_HISTOGRAM_BINS)
+		bin = TELEMETRY_HISTOGRAM_BINS - 1;
+
+	if(histogram->counts[bin] < UINT16_MAX)
+		histogram->counts[bin]++;
+
+}
+
+/**
+ * Queues a histogram frame, which is sent after a later data frame, one histogram per data frame.
+ * The counts are copied when the frame is built, so the histogram must remain valid until then.
+ *
+ * @param histogram   The histogram
+ * @returns           1 if queued, 0 if TELEMETRY_HISTOGRAM_QUEUE histograms are already waiting
+ */
+uint8_t telemetry_send_histogram(const struct telemetry_histogram *histogram) {
+
+	uint8_t queued = 0;
+
+	__disable_irq();
+	if(histograms_queued < TELEMETRY_HISTOGRAM_QUEUE) {
+		histogram_queue[histograms_queued++] = histogram;
+		queued = 1;
+	}
+	__enable_irq();
+
+	return queued;
+
+}
@@ -0,0 +1,143 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#pragma once
+#include <stdint.h>
+
+/**
+ * Self-describing binary telemetry, sent with the f0lib_uart frame API (COBS encoded payload and CRC-16, then 0x00.)
+ *
+ * The first payload byte is the frame type:
+ *
+ * Data frame:        TELEMETRY_DATA_FRAME, sequence number (uint16), timestamp (uint32, microseconds),
+ *                    frames dropped (uint16), channel mask (uint32), then the value of each channel in the mask,
+ *                    in table order (little-endian, packed.) Bit n of the mask is channel n.
+ * Descriptor frame:  TELEMETRY_DESCRIPTOR_FRAME, channel index, channel count, type, decimation, scale (float),
+ *                    name (null terminated), unit (null terminated)
+ * Acknowledgement:   TELEMETRY_ACK_FRAME, command, result (see telemetry_acknowledge())
+ * Histogram:         TELEMETRY_HISTOGRAM_FRAME, id, bin count, bin width (uint16), lower edge of bin 0 (int32),
+ *                    then the count of each bin (uint16, saturated.) The first and last bins also hold the values
+ *                    below and above the range.
+ *
+ * A quantized value is round(value / scale), saturated to the range of its type. Multiply by scale to recover the value.
+ * Descriptors are sent one per data frame after telemetry_setup() until the whole table has gone out,
+ * then one every TELEMETRY_DESCRIPTOR_INTERVAL data frames, so a receiver that connects late still learns the layout.
+ *
+ * Each channel has a decimation: 0 = disabled, 1 = sent every time, n = sent every nth time telemetry_send() is called.
+ *
+ * The sequence number increases by one with every data frame, so a gap means frames were lost. The frames dropped field
+ * is the low 16 bits of the UART's count of frames discarded because its TX ring was full, so a receiver can
+ * tell those losses apart from errors on the link. A stalled or slow loop shows up in the timestamps instead.
+ * Only data frames are discarded: acknowledgements, descriptors and histograms wait for a free slot.
+ */
+
+#define TELEMETRY_DATA_FRAME       0x01
+#define TELEMETRY_DESCRIPTOR_FRAME 0x02
+#define TELEMETRY_ACK_FRAME        0x03
+#define TELEMETRY_HISTOGRAM_FRAME  0x04
+
+// the channel mask of a data frame has one bit per channel
+#define TELEMETRY_MAX_CHANNELS 32
+
+// data frames between two descriptor frames, once the whole table has been described
+#ifndef TELEMETRY_DESCRIPTOR_INTERVAL
+#define TELEMETRY_DESCRIPTOR_INTERVAL 8
+#endif
+
+// bins in a histogram frame
+#ifndef TELEMETRY_HISTOGRAM_BINS
+#define TELEMETRY_HISTOGRAM_BINS 16
+#endif
+
+// acknowledgements that can wait to be sent, for commands that arrive between two calls of telemetry_send()
+#ifndef TELEMETRY_ACK_QUEUE
+#define TELEMETRY_ACK_QUEUE 4
+#endif
+
+// histograms that can wait to be sent, one after each data frame
+#ifndef TELEMETRY_HISTOGRAM_QUEUE
+#define TELEMETRY_HISTOGRAM_QUEUE 4
+#endif
+
+enum TELEMETRY_TYPE {TELEMETRY_INT8, TELEMETRY_INT16, TELEMETRY_FLOAT};
+
+struct telemetry_channel {
+	const char *name;
+	const char *unit;
+	float scale;                // units per LSB of a quantized value, ignored for TELEMETRY_FLOAT
+	enum TELEMETRY_TYPE type;
+	const volatile float *value;
+};
+
+struct telemetry_histogram {
+	uint8_t id;                 // tells the receiver which histogram this is
+	uint16_t bin_width;
+	int32_t first_bin;          // lower edge of bin 0
+	uint16_t counts[TELEMETRY_HISTOGRAM_BINS];
+};
+
+/**
+ * Sets the channel table and starts sending its descriptors. uart_setup() must be called first.
+ *
+ * @param table      Table of channels, which must remain valid (usually const)
+ * @param count      Number of channels, 1 to TELEMETRY_MAX_CHANNELS
+ */
+void telemetry_setup(const struct telemetry_channel *table, uint8_t count);
+
+/**
+ * Queues the acknowledgement and the descriptor that are due, then reads the value of every channel that is due and
+ * queues a data frame, followed by a histogram if one is waiting. No data frame is sent if no channel is due.
+ * If the TX ring is full the data frame is dropped, but the other frames wait for a later call.
+ *
+ * @param timestamp   Time of the sample the values were calculated from, in microseconds
+ */
+void telemetry_send(uint32_t timestamp);
+
+/**
+ * Enables, disables or decimates a channel. All channels start with a decimation of 1.
+ *
+ * @param channel      Index in the channel table
+ * @param decimation   0 = disabled, 1 = every time, n = every nth time
+ * @returns            1 on success, 0 if there is no such channel
+ */
+uint8_t telemetry_set_decimation(uint8_t channel, uint8_t decimation);
+
+/**
+ * Gets a channel's decimation.
+ *
+ * @param channel   Index in the channel table
+ * @returns         The decimation, or 0 if there is no such channel
+ */
+uint8_t telemetry_get_decimation(uint8_t channel);
+
+/**
+ * Sends every descriptor again, back to back, starting with the next call of telemetry_send().
+ */
+void telemetry_send_schema(void);
+
+/**
+ * Queues an acknowledgement frame, which is sent by the next call of telemetry_send(), or a later one if the TX ring is full.
+ * Up to TELEMETRY_ACK_QUEUE acknowledgements can wait. If the queue is full the newest one is replaced.
+ *
+ * @param command   Identifies what is being acknowledged, such as a received command
+ * @param result    1 for success, 0 for failure, or any other value the receiver understands
+ */
+void telemetry_acknowledge(uint8_t command, uint8_t result);
+
+/**
+ * Counts a value in a histogram. Values outside the range are counted in the first or last bin,
+ * and a bin stops counting at 65535.
+ *
+ * @param histogram   The histogram
+ * @param value       Value to count
+ */
+void telemetry_histogram_add(struct telemetry_histogram *histogram, int32_t value);
+
+/**
+ * Queues a histogram frame, which is sent after a later data frame, one histogram per data frame.
+ * The counts are copied when the frame is built, so the histogram must remain valid until then.
+ *
+ * @param histogram   The histogram
+ * @returns           1 if queued, 0 if TELEMETRY_HISTOGRAM_QUEUE histograms are already waiting
+ */
+uint8_t telemetry_send_histogram(const struct telemetry_histogram *histogram);
@@ -8,6 +8,7 @@
 
 
 static TIM_TypeDef *hbridge_timer;
+static TIM_TypeDef *microseconds_high_timer = 0;
 
 /**
  * Configure one of the 4-channel timers for controlling dual h-bridges.
@@ -512,3 +513,62 @@ void timer_one_pulse_setup(TIM_TypeDef *timer, uint32_t delay) {
 	// enable counter
 	timer->CR1 |= TIM_CR1_CEN;
 }
+
+/**
+ * Configure a free-running 32-bit microsecond counter built from two chained 16-bit timers.
+ * TIM3 counts microseconds, and each TIM3 overflow clocks the high timer through the internal trigger connection.
+ * TIM3 and the high timer can not be used for anything else.
+ *
+ * @param high_timer	TIM1 or TIM15
+ */
+void timer_microseconds_setup(TIM_TypeDef *high_timer) {
+	// internal trigger input that is connected to TIM3's TRGO
+	uint32_t trigger;
+	if(high_timer == TIM1) {
+		trigger = TIM_SMCR_TS_1; // ITR2
+		RCC->APB2ENR |= RCC_APB2ENR_TIM1EN;
+		RCC->APB2RSTR |= RCC_APB2RSTR_TIM1RST;
+		RCC->APB2RSTR &= ~RCC_APB2RSTR_TIM1RST;
+	} else if(high_timer == TIM15) {
+		trigger = TIM_SMCR_TS_0; // ITR1
+		RCC->APB2ENR |= RCC_APB2ENR_TIM15EN;
+		RCC->APB2RSTR |= RCC_APB2RSTR_TIM15RST;
+		RCC->APB2RSTR &= ~RCC_APB2RSTR_TIM15RST;
+	} else {
+		return;
+	}
+
+	// low timer: one tick per microsecond, TRGO on overflow.
+	// Configured first, because its UG is also output on TRGO and would count in the high timer.
+	timer_timebase_setup(TIM3, SystemCoreClock / 1000000, 65536, 0);
+
+	// high timer: count every trigger (external clock mode 1), full 16-bit range
+	high_timer->PSC = 0;
+	high_timer->ARR = 0xFFFF;
+	high_timer->SMCR = trigger | TIM_SMCR_SMS_2 | TIM_SMCR_SMS_1 | TIM_SMCR_SMS_0;
+	high_timer->EGR |= TIM_EGR_UG;
+	high_timer->SR &= ~TIM_SR_UIF;
+	high_timer->CR1 |= TIM_CR1_CEN;
+	microseconds_high_timer = high_timer;
+}
+
+/**
+ * Reads the microsecond counter. It wraps around after about 71.6 minutes.
+ *
+ * @returns			Microseconds since timer_microseconds_setup() was called, or 0 if it has not been called
+ */
+uint32_t timer_microseconds(void) {
+	if(!microseconds_high_timer)
+		return 0;
+
+	// if the high half changed while reading the low half, TIM3 overflowed in between, so read the low half again
+	uint32_t high = microseconds_high_timer->CNT;
+	uint32_t low = TIM3->CNT;
+	uint32_t high_again = microseconds_high_timer->CNT;
+	if(high != high_again) {
+		high = high_again;
+		low = TIM3->CNT;
+	}
+
+	return (high << 16) | low;
+}
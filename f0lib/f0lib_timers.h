@@ -135,3 +135,19 @@ void timer_timebase_setup(TIM_TypeDef *timer, uint32_t prescaler, uint32_t arr,
  * @param delay		Delay in milliseconds before the pulse.
  */
 void timer_one_pulse_setup(TIM_TypeDef *timer, uint32_t delay);
+
+/**
+ * Configure a free-running 32-bit microsecond counter built from two chained 16-bit timers.
+ * TIM3 counts microseconds, and each TIM3 overflow clocks the high timer through the internal trigger connection.
+ * TIM3 and the high timer can not be used for anything else.
+ *
+ * @param high_timer	TIM1 or TIM15
+ */
+void timer_microseconds_setup(TIM_TypeDef *high_timer);
+
+/**
+ * Reads the microsecond counter. It wraps around after about 71.6 minutes.
+ *
+ * @returns			Microseconds since timer_microseconds_setup() was called, or 0 if it has not been called
+ */
+uint32_t timer_microseconds(void);
@@ -1,270 +1,692 @@
-// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
-// License: public domain
-
-#include "f0lib_uart.h"
-#include <stdio.h>
-#include <string.h>
-#include <stdarg.h>
-
-static USART_TypeDef *usart;
-static char uart_tx_buffer[1024] = {0};
-static uint32_t i = 0;
-
-/**
- * Setup one of the USARTs for TX-only communication via DMA.
- *
- * @param tx      TX pin
- * @param baud    The baud rate, such as 9600
- */
-void uart_setup(enum GPIO_PIN tx_pin, uint32_t baud) {
-
-	// determine which USART to use
-	if(tx_pin == PA9 || tx_pin == PB6)
-		usart = USART1;
-	else if(tx_pin == PA2 || tx_pin == PA14)
-		usart = USART2;
-	else
-		return;
-
-	// configure the GPIO
-	if(tx_pin == PB6)
-		gpio_setup(tx_pin, AF, PUSH_PULL, FIFTY_MHZ, NO_PULL, AF0);
-	else
-		gpio_setup(tx_pin, AF, PUSH_PULL, FIFTY_MHZ, NO_PULL, AF1);
-
-	// enable the clock, then reset
-	if(usart == USART1) {
-
-		RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
-		RCC->APB2RSTR |= RCC_APB2RSTR_USART1RST;
-		RCC->APB2RSTR &= ~RCC_APB2RSTR_USART1RST;
-
-	} else if(usart == USART2) {
-
-		RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
-		RCC->APB2RSTR |= RCC_APB1RSTR_USART2RST;
-		RCC->APB2RSTR &= ~RCC_APB1RSTR_USART2RST;
-
-	}
-
-	// enable DMA for TX
-	usart->CR3 = USART_CR3_DMAT;
-
-	// set the baud rate prescaler
-	usart->BRR = SystemCoreClock / baud;
-
-	// enable the UART and TX
-	usart->CR1 = USART_CR1_UE | USART_CR1_TE;
-
-	// enable the DMA clock
-	RCC->AHBENR |= RCC_AHBENR_DMA1EN;
-
-}
-
-void uart_send_csv_floats(uint8_t count, float first_value, ...) {
-
-	va_list arglist;
-	va_start(arglist, first_value);
-
-	i = 0;
-	i += sprintf(&uart_tx_buffer[i], "%2.7f", first_value);
-	count--;
-
-	while(count-- > 0)
-		i += sprintf(&uart_tx_buffer[i], ",%2.7f", va_arg(arglist, double));
-
-	i += sprintf(&uart_tx_buffer[i], "\r\n");
-
-	uart_tx_via_dma();
-
-	va_end(arglist);
-
-}
-
-void uart_send_bin_floats(uint8_t count, float first_value, ...) {
-
-	va_list arglist;
-	va_start(arglist, first_value);
-
-	uint16_t checksum = 0;
-	char* ptr = 0;
-
-	i = 0;
-	uart_tx_buffer[i++] = 0xAA;
-	ptr = (char*) &first_value;
-	uart_tx_buffer[i++] = ptr[0];
-	uart_tx_buffer[i++] = ptr[1];
-	uart_tx_buffer[i++] = ptr[2];
-	uart_tx_buffer[i++] = ptr[3];
-	checksum += (ptr[1] << 8) | (ptr[0] << 0);
-	checksum += (ptr[3] << 8) | (ptr[2] << 0);
-	count--;
-
-	while(count-- > 0) {
-		float value = va_arg(arglist, double); // because floats are promoted to doubles when passed
-		ptr = (char*) &value;
-		uart_tx_buffer[i++] = ptr[0];
-		uart_tx_buffer[i++] = ptr[1];
-		uart_tx_buffer[i++] = ptr[2];
-		uart_tx_buffer[i++] = ptr[3];
-		checksum += (ptr[1] << 8) | (ptr[0] << 0);
-		checksum += (ptr[3] << 8) | (ptr[2] << 0);
-	}
-
-	uart_tx_buffer[i++] = (checksum >> 0) & 0xFF;
-	uart_tx_buffer[i++] = (checksum >> 8) & 0xFF;
-
-	uart_tx_via_dma();
-
-	va_end(arglist);
-
-}
-
-/**
- * Effectively empties the TX buffer by placing a null character at position zero and resetting the pointer.
- */
-void uart_reset_tx_buffer(void) {
-
-	uart_tx_buffer[0] = 0;
-	i = 0;
-
-}
-
-/**
- * Transmit the contents of uart_tx_buffer[] (until the null character) via DMA.
- */
-void uart_tx_via_dma(void) {
-
-	// wait for previous DMA transfer to finish
-	while((usart->ISR & USART_ISR_TC) == 0);
-
-	// determine which DMA channel to use
-	DMA_Channel_TypeDef *dma_channel;
-	if(usart == USART1)
-		dma_channel = DMA1_Channel2;
-	else if(usart == USART2)
-		dma_channel = DMA1_Channel4;
-	else
-		return;
-
-	dma_channel->CCR &= !DMA_CCR_EN;                            // disable the channel
-	dma_channel->CNDTR = i;                                     // bytes to transfer
-	dma_channel->CPAR = (uint32_t) &usart->TDR;                 // peripheral address
-	dma_channel->CMAR = (uint32_t) uart_tx_buffer;              // memory address
-	dma_channel->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_EN; // increment memory address, read from memory, enable the channel
-
-}
-
-/**
- * Appends a horizontal ASCII line graph to uart_tx_buffer[]. The graph looks like this:
- *
- * X Acceleration     [          *                   ]    -0.985 G
- *
- * @param name    A text to show at the left of the graph
- * @param value   The value to be graphed and also shown at the right of the graph
- * @param unit    The text to be shown at the right of the graph
- * @param min     Sets the scale of the graph
- * @param max     Sets the scale of the graph
- */
-void uart_append_ascii_graph(char name[], float value, char unit[], float min, float max) {
-
-	#define GRAPH_LENGTH 30
-
-	// remove the existing null character
-	if(i > 0)
-		i--;
-
-	uint32_t j = 0;
-
-	// append the name
-	j = 0;
-	while(name[j])
-		uart_tx_buffer[i++] = name[j++];
-
-	// append the ASCII line graph
-	float percentage = (value - min) / (max - min);
-	int dot_location = (GRAPH_LENGTH - 1.0) * percentage;
-
-	uart_tx_buffer[i++] = ' ';
-	uart_tx_buffer[i++] = '[';
-	for(j = 0; j < GRAPH_LENGTH; j++) {
-		if (j == dot_location)
-			uart_tx_buffer[i++] = '*';
-		else
-			uart_tx_buffer[i++] = ' ';
-	}
-	uart_tx_buffer[i++] = ']';
-	uart_tx_buffer[i++] = ' ';
-
-	// append the value
-	if(value >= 0.0f) {
-		uart_tx_buffer[i++] = '+';
-	} else {
-		uart_tx_buffer[i++] = '-';
-		value *= -1.0f;
-	}
-	char temp[7] = {0};
-	sprintf(temp, "%02.3f", value);
-	j = 0;
-	while(temp[j])
-		uart_tx_buffer[i++] = temp[j++];
-
-	// append the unit
-	uart_tx_buffer[i++] = ' ';
-	j = 0;
-	while(unit[j])
-		uart_tx_buffer[i++] = unit[j++];
-
-	// append a \n\r and null character
-	uart_tx_buffer[i++] = '\n';
-	uart_tx_buffer[i++] = '\r';
-	uart_tx_buffer[i++] = 0;
-
-}
-
-/**
- * Appends a \n\r\0 to uart_tx_buffer[].
- */
-void uart_append_newline(void) {
-
-	// remove the existing null character
-	if(i > 0)
-		i--;
-
-	uart_tx_buffer[i++] = '\n';
-	uart_tx_buffer[i++] = '\r';
-	uart_tx_buffer[i++] = 0;
-
-}
-
-/**
- * Appends \x1B[*A\x1B[?25l to uart_tx_buffer[]. * is replaced with the actual number of lines.
- * This moves the cursor back up to the top, and hides the cursor.
- */
-void uart_append_cursor_home(void) {
-
-	uint32_t j = 0;
-	uint32_t n = 0;
-
-	// remove the existing null character
-	if(i > 0)
-		i--;
-
-	// count the \n's
-	while(uart_tx_buffer[j]) {
-		if(uart_tx_buffer[j] == '\n')
-			n++;
-		j++;
-	}
-
-	char temp[16] = {0};
-	sprintf(temp, "\x1B[%dA\x1B[?25l", n);
-
-	// append the text
-	j = 0;
-	while(temp[j])
-		uart_tx_buffer[i++] = temp[j++];
-
-	uart_tx_buffer[i++] = 0;
-
-}
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include "f0lib_uart.h"
+#include "f0lib_converters.h"
+#include <string.h>
+#include <stdarg.h>
+
+static USART_TypeDef *usart;
+static DMA_Channel_TypeDef *dma_channel;
+static uint32_t dma_tc_flag;   // DMA_ISR_TCIFx of that channel
+static uint32_t dma_tc_clear;  // DMA_IFCR_CTCIFx of that channel
+
+// ring of frames: slots tx_head ... tx_head + tx_queued - 1 are waiting or being sent, tx_fill is being built
+// slots are word aligned so binary frames can be filled in place as structs
+static char uart_tx_slots[UART_TX_SLOTS][UART_TX_SLOT_SIZE] __attribute__((aligned(4))) = {{0}};
+static uint16_t uart_tx_lengths[UART_TX_SLOTS] = {0};
+static uint8_t uart_tx_starts[UART_TX_SLOTS] = {0};   // offset of the first byte to send
+static volatile uint8_t tx_head = 0;
+static volatile uint8_t tx_queued = 0;
+static uint8_t tx_fill = 0;
+
+static char *uart_tx_buffer = uart_tx_slots[0];
+static uint32_t i = 0;
+static uint8_t start = 0;
+static uint16_t tx_lines = 0;   // \n's appended since the buffer was reset, for uart_append_cursor_home()
+
+static struct uart_statistics statistics = {0};
+
+// receive: DMA writes into a circular buffer, and uart_receive_frame() collects bytes up to each 0x00
+static DMA_Channel_TypeDef *rx_dma_channel;
+static uint8_t uart_rx_buffer[UART_RX_BUFFER_SIZE];
+static uint16_t rx_read = 0;
+static uint8_t rx_frame[UART_RX_FRAME_SIZE];
+static uint16_t rx_frame_length = 0;
+static uint8_t rx_frame_overflow = 0;
+
+static void uart_start_dma(void);
+
+// CRC-16/CCITT-FALSE (polynomial 0x1021), one entry per value of the top byte
+static const uint16_t crc16_table[256] = {
+	0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50A5, 0x60C6, 0x70E7,
+	0x8108, 0x9129, 0xA14A, 0xB16B, 0xC18C, 0xD1AD, 0xE1CE, 0xF1EF,
+	0x1231, 0x0210, 0x3273, 0x2252, 0x52B5, 0x4294, 0x72F7, 0x62D6,
+	0x9339, 0x8318, 0xB37B, 0xA35A, 0xD3BD, 0xC39C, 0xF3FF, 0xE3DE,
+	0x2462, 0x3443, 0x0420, 0x1401, 0x64E6, 0x74C7, 0x44A4, 0x5485,
+	0xA56A, 0xB54B, 0x8528, 0x9509, 0xE5EE, 0xF5CF, 0xC5AC, 0xD58D,
+	0x3653, 0x2672, 0x1611, 0x0630, 0x76D7, 0x66F6, 0x5695, 0x46B4,
+	0xB75B, 0xA77A, 0x9719, 0x8738, 0xF7DF, 0xE7FE, 0xD79D, 0xC7BC,
+	0x48C4, 0x58E5, 0x6886, 0x78A7, 0x0840, 0x1861, 0x2802, 0x3823,
+	0xC9CC, 0xD9ED, 0xE98E, 0xF9AF, 0x8948, 0x9969, 0xA90A, 0xB92B,
+	0x5AF5, 0x4AD4, 0x7AB7, 0x6A96, 0x1A71, 0x0A50, 0x3A33, 0x2A12,
+	0xDBFD, 0xCBDC, 0xFBBF, 0xEB9E, 0x9B79, 0x8B58, 0xBB3B, 0xAB1A,
+	0x6CA6, 0x7C87, 0x4CE4, 0x5CC5, 0x2C22, 0x3C03, 0x0C60, 0x1C41,
+	0xEDAE, 0xFD8F, 0xCDEC, 0xDDCD, 0xAD2A, 0xBD0B, 0x8D68, 0x9D49,
+	0x7E97, 0x6EB6, 0x5ED5, 0x4EF4, 0x3E13, 0x2E32, 0x1E51, 0x0E70,
+	0xFF9F, 0xEFBE, 0xDFDD, 0xCFFC, 0xBF1B, 0xAF3A, 0x9F59, 0x8F78,
+	0x9188, 0x81A9, 0xB1CA, 0xA1EB, 0xD10C, 0xC12D, 0xF14E, 0xE16F,
+	0x1080, 0x00A1, 0x30C2, 0x20E3, 0x5004, 0x4025, 0x7046, 0x6067,
+	0x83B9, 0x9398, 0xA3FB, 0xB3DA, 0xC33D, 0xD31C, 0xE37F, 0xF35E,
+	0x02B1, 0x1290, 0x22F3, 0x32D2, 0x4235, 0x5214, 0x6277, 0x7256,
+	0xB5EA, 0xA5CB, 0x95A8, 0x8589, 0xF56E, 0xE54F, 0xD52C, 0xC50D,
+	0x34E2, 0x24C3, 0x14A0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+	0xA7DB, 0xB7FA, 0x8799, 0x97B8, 0xE75F, 0xF77E, 0xC71D, 0xD73C,
+	0x26D3, 0x36F2, 0x0691, 0x16B0, 0x6657, 0x7676, 0x4615, 0x5634,
+	0xD94C, 0xC96D, 0xF90E, 0xE92F, 0x99C8, 0x89E9, 0xB98A, 0xA9AB,
+	0x5844, 0x4865, 0x7806, 0x6827, 0x18C0, 0x08E1, 0x3882, 0x28A3,
+	0xCB7D, 0xDB5C, 0xEB3F, 0xFB1E, 0x8BF9, 0x9BD8, 0xABBB, 0xBB9A,
+	0x4A75, 0x5A54, 0x6A37, 0x7A16, 0x0AF1, 0x1AD0, 0x2AB3, 0x3A92,
+	0xFD2E, 0xED0F, 0xDD6C, 0xCD4D, 0xBDAA, 0xAD8B, 0x9DE8, 0x8DC9,
+	0x7C26, 0x6C07, 0x5C64, 0x4C45, 0x3CA2, 0x2C83, 0x1CE0, 0x0CC1,
+	0xEF1F, 0xFF3E, 0xCF5D, 0xDF7C, 0xAF9B, 0xBFBA, 0x8FD9, 0x9FF8,
+	0x6E17, 0x7E36, 0x4E55, 0x5E74, 0x2E93, 0x3EB2, 0x0ED1, 0x1EF0
+};
+
+/**
+ * Setup one of the USARTs for TX-only communication via DMA.
+ *
+ * @param tx      TX pin
+ * @param baud    The baud rate, such as 9600
+ */
+void uart_setup(enum GPIO_PIN tx_pin, uint32_t baud) {
+
+	// determine which USART to use
+	if(tx_pin == PA9 || tx_pin == PB6)
+		usart = USART1;
+	else if(tx_pin == PA2 || tx_pin == PA14)
+		usart = USART2;
+	else
+		return;
+
+	// configure the GPIO
+	if(tx_pin == PB6)
+		gpio_setup(tx_pin, AF, PUSH_PULL, FIFTY_MHZ, NO_PULL, AF0);
+	else
+		gpio_setup(tx_pin, AF, PUSH_PULL, FIFTY_MHZ, NO_PULL, AF1);
+
+	// enable the clock, then reset
+	if(usart == USART1) {
+
+		RCC->APB2ENR |= RCC_APB2ENR_USART1EN;
+		RCC->APB2RSTR |= RCC_APB2RSTR_USART1RST;
+		RCC->APB2RSTR &= ~RCC_APB2RSTR_USART1RST;
+
+	} else if(usart == USART2) {
+
+		RCC->APB1ENR |= RCC_APB1ENR_USART2EN;
+		RCC->APB2RSTR |= RCC_APB1RSTR_USART2RST;
+		RCC->APB2RSTR &= ~RCC_APB1RSTR_USART2RST;
+
+	}
+
+	// enable DMA for TX
+	usart->CR3 = USART_CR3_DMAT;
+
+	// determine which DMA channel to use
+	if(usart == USART1) {
+		dma_channel = DMA1_Channel2;
+		dma_tc_flag = DMA_ISR_TCIF2;
+		dma_tc_clear = DMA_IFCR_CTCIF2;
+	} else {
+		dma_channel = DMA1_Channel4;
+		dma_tc_flag = DMA_ISR_TCIF4;
+		dma_tc_clear = DMA_IFCR_CTCIF4;
+	}
+
+	// set the baud rate prescaler
+	usart->BRR = SystemCoreClock / baud;
+
+	// enable the UART and TX
+	usart->CR1 = USART_CR1_UE | USART_CR1_TE;
+
+	// enable the DMA clock
+	RCC->AHBENR |= RCC_AHBENR_DMA1EN;
+
+	// the transfer complete interrupt starts the next queued frame
+	if(usart == USART1)
+		NVIC_EnableIRQ(DMA1_Channel2_3_IRQn);
+	else
+		NVIC_EnableIRQ(DMA1_Channel4_5_IRQn);
+
+}
+
+/**
+ * Checks that a number of characters, including the null character, fit in the TX slot being built.
+ * If not, the text is counted as a dropped frame.
+ *
+ * @param count   Number of characters
+ * @returns       1 if they fit, 0 if not
+ */
+static uint8_t uart_tx_fits(uint32_t count) {
+
+	if(i + count <= UART_TX_SLOT_SIZE)
+		return 1;
+
+	__disable_irq();
+	statistics.frames_dropped++;
+	__enable_irq();
+	return 0;
+
+}
+
+void uart_send_csv_floats(uint8_t count, float first_value, ...) {
+
+	va_list arglist;
+	va_start(arglist, first_value);
+
+	// each further value needs room for a comma, float_to_dec_buffer()'s 32 characters, and the \r\n that ends the line.
+	// A line that doesn't fit is dropped.
+	i = 0;
+	i += float_to_dec_buffer(first_value, UART_CSV_DECIMALS, &uart_tx_buffer[i]);
+	count--;
+
+	while(count-- > 0) {
+		if(!uart_tx_fits(1 + 32 + 2)) {
+			uart_reset_tx_buffer();
+			va_end(arglist);
+			return;
+		}
+		uart_tx_buffer[i++] = ',';
+		i += float_to_dec_buffer(va_arg(arglist, double), UART_CSV_DECIMALS, &uart_tx_buffer[i]);
+	}
+
+	uart_tx_buffer[i++] = '\r';
+	uart_tx_buffer[i++] = '\n';
+	uart_tx_buffer[i] = 0;
+
+	uart_tx_via_dma();
+
+	va_end(arglist);
+
+}
+
+void uart_send_bin_floats(uint8_t count, float first_value, ...) {
+
+	va_list arglist;
+	va_start(arglist, first_value);
+
+	float *values = (float*) uart_frame_begin();
+	values[0] = first_value;
+	for(uint8_t j = 1; j < count; j++)
+		values[j] = va_arg(arglist, double); // because floats are promoted to doubles when passed
+
+	uart_frame_end(count * sizeof(float));
+
+	va_end(arglist);
+
+}
+
+/**
+ * Starts a binary frame in the TX buffer. The caller writes the payload directly to the returned memory,
+ * usually by pointing a struct at it, then calls uart_frame_end() to send it.
+ * The payload is followed by its CRC-16/CCITT-FALSE (big-endian), COBS encoded and terminated by a 0x00 byte.
+ * 0x00 never occurs inside a frame, so a receiver can always resynchronize at the next 0x00.
+ *
+ * @returns   Word aligned payload memory, with room for UART_FRAME_MAX_PAYLOAD bytes
+ */
+void* uart_frame_begin(void) {
+
+	return &uart_tx_buffer[4];
+
+}
+
+/**
+ * Appends the CRC to a frame started with uart_frame_begin(), encodes it, and queues it for transmission.
+ *
+ * @param byte_count   Size of the payload, at most UART_FRAME_MAX_PAYLOAD bytes
+ */
+void uart_frame_end(uint16_t byte_count) {
+
+	if(byte_count > UART_FRAME_MAX_PAYLOAD) {
+		uart_reset_tx_buffer();
+		return;
+	}
+
+	uint8_t *payload = (uint8_t*) &uart_tx_buffer[4];
+
+	uint16_t crc = uart_crc16(0xFFFF, payload, byte_count);
+	payload[byte_count++] = crc >> 8;
+	payload[byte_count++] = crc & 0xFF;
+
+	// COBS in place: the byte before the payload and every 0x00 become the distance to the next 0x00 (or the end)
+	// this needs no extra bytes because the payload and CRC are at most 254 bytes
+	uint8_t *code = payload - 1;
+	for(uint16_t j = 0; j < byte_count; j++) {
+		if(payload[j] == 0) {
+			*code = &payload[j] - code;
+			code = &payload[j];
+		}
+	}
+	*code = &payload[byte_count] - code;
+	payload[byte_count++] = 0;
+
+	i = 4 + byte_count;
+	start = 3;
+
+	uart_tx_via_dma();
+
+}
+
+/**
+ * Calculates a CRC-16/CCITT-FALSE. Start with a crc of 0xFFFF, and pass the result back in to continue over more bytes.
+ * A payload followed by its big-endian CRC gives a CRC of 0.
+ *
+ * @param crc     0xFFFF, or the result of the previous call
+ * @param bytes   Data
+ * @param count   Number of bytes
+ * @returns       The updated CRC
+ */
+uint16_t uart_crc16(uint16_t crc, const uint8_t *bytes, uint32_t count) {
+
+	while(count--)
+		crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *bytes++];
+
+	return crc;
+
+}
+
+/**
+ * Effectively empties the TX buffer by placing a null character at position zero and resetting the pointer.
+ */
+void uart_reset_tx_buffer(void) {
+
+	uart_tx_buffer[0] = 0;
+	i = 0;
+	start = 0;
+	tx_lines = 0;
+
+}
+
+/**
+ * Queues the contents of uart_tx_buffer[] for transmission via DMA and returns immediately.
+ * The frame is sent once the frames queued before it are done, and the next frame is built in another slot.
+ * If every other slot is still waiting to be sent, the new frame is dropped and counted instead.
+ */
+void uart_tx_via_dma(void) {
+
+	if(!dma_channel || i <= start) {
+		uart_reset_tx_buffer();
+		return;
+	}
+
+	__disable_irq();
+
+	if(tx_queued == UART_TX_SLOTS - 1) {
+
+		// ring full: drop the newest frame, and build the next one in the same slot
+		statistics.frames_dropped++;
+
+	} else {
+
+		uart_tx_lengths[tx_fill] = i - start;
+		uart_tx_starts[tx_fill] = start;
+		tx_fill = (tx_fill + 1 == UART_TX_SLOTS) ? 0 : tx_fill + 1;
+		tx_queued++;
+
+		// start now if the DMA channel was idle
+		if(tx_queued == 1)
+			uart_start_dma();
+
+	}
+
+	__enable_irq();
+
+	uart_tx_buffer = uart_tx_slots[tx_fill];
+	uart_reset_tx_buffer();
+
+}
+
+/**
+ * Counts the frames that can still be queued before the TX ring is full and new frames are dropped.
+ *
+ * @returns   0 to UART_TX_SLOTS - 1
+ */
+uint8_t uart_tx_slots_free(void) {
+
+	return UART_TX_SLOTS - 1 - tx_queued;
+
+}
+
+/**
+ * Starts the DMA transfer of the slot at tx_head. Called with interrupts disabled or from the DMA ISR.
+ */
+static void uart_start_dma(void) {
+
+	dma_channel->CCR = 0;                                                                        // disable the channel so it can be reconfigured
+	dma_channel->CNDTR = uart_tx_lengths[tx_head];                                               // bytes to transfer
+	dma_channel->CPAR = (uint32_t) (uintptr_t) &usart->TDR;                                      // peripheral address
+	dma_channel->CMAR = (uint32_t) (uintptr_t) &uart_tx_slots[tx_head][uart_tx_starts[tx_head]]; // memory address
+	dma_channel->CCR = DMA_CCR_MINC | DMA_CCR_DIR | DMA_CCR_TCIE | DMA_CCR_EN;                   // increment memory address, read from memory, interrupt when done, enable
+
+}
+
+/**
+ * Gets the TX and RX counters.
+ *
+ * @returns   Pointer to the counters, which are updated as frames are queued, sent and received
+ */
+const struct uart_statistics* uart_get_statistics(void) {
+
+	return &statistics;
+
+}
+
+/**
+ * Frees the slot that was just sent and starts the next one.
+ * The last byte may still be shifting out of the USART, but TDR is empty so the next transfer can begin.
+ */
+static void uart_dma_handler(void) {
+
+	if(!dma_channel || (DMA1->ISR & dma_tc_flag) == 0)
+		return;
+
+	DMA1->IFCR = dma_tc_clear;
+
+	statistics.frames_sent++;
+	statistics.bytes_sent += uart_tx_lengths[tx_head];
+	tx_head = (tx_head + 1 == UART_TX_SLOTS) ? 0 : tx_head + 1;
+	tx_queued--;
+
+	if(tx_queued > 0)
+		uart_start_dma();
+	else
+		dma_channel->CCR = 0;
+
+}
+
+void DMA1_Channel2_3_IRQHandler(void) {
+
+	uart_dma_handler();
+
+}
+
+void DMA1_Channel4_5_IRQHandler(void) {
+
+	uart_dma_handler();
+
+}
+
+/**
+ * Appends a horizontal ASCII line graph to uart_tx_buffer[]. The graph looks like this:
+ *
+ * X Acceleration     [          *                   ]    -0.985 G
+ *
+ * @param name    A text to show at the left of the graph
+ * @param value   The value to be graphed and also shown at the right of the graph
+ * @param unit    The text to be shown at the right of the graph
+ * @param min     Sets the scale of the graph
+ * @param max     Sets the scale of the graph
+ */
+void uart_append_ascii_graph(char name[], float value, char unit[], float min, float max) {
+
+	#define GRAPH_LENGTH 30
+
+	// remove the existing null character
+	if(i > 0)
+		i--;
+
+	// the row is left out if it doesn't fit, the value needs room for float_to_dec_buffer()'s 32 characters
+	if(!uart_tx_fits(strlen(name) + 2 + GRAPH_LENGTH + 3 + 32 + 1 + strlen(unit) + 3)) {
+		uart_tx_buffer[i++] = 0;
+		return;
+	}
+
+	uint32_t j = 0;
+
+	// append the name
+	j = 0;
+	while(name[j])
+		uart_tx_buffer[i++] = name[j++];
+
+	// append the ASCII line graph
+	float percentage = (value - min) / (max - min);
+	int32_t dot_location = (GRAPH_LENGTH - 1.0) * percentage; // outside 0 - GRAPH_LENGTH - 1 if the value is out of range
+
+	uart_tx_buffer[i++] = ' ';
+	uart_tx_buffer[i++] = '[';
+	for(j = 0; j < GRAPH_LENGTH; j++) {
+		if ((int32_t) j == dot_location)
+			uart_tx_buffer[i++] = '*';
+		else
+			uart_tx_buffer[i++] = ' ';
+	}
+	uart_tx_buffer[i++] = ']';
+	uart_tx_buffer[i++] = ' ';
+
+	// append the value
+	if(value >= 0.0f) {
+		uart_tx_buffer[i++] = '+';
+	} else {
+		uart_tx_buffer[i++] = '-';
+		value *= -1.0f;
+	}
+	i += float_to_dec_buffer(value, 3, &uart_tx_buffer[i]);
+
+	// append the unit
+	uart_tx_buffer[i++] = ' ';
+	j = 0;
+	while(unit[j])
+		uart_tx_buffer[i++] = unit[j++];
+
+	// append a \n\r and null character
+	uart_tx_buffer[i++] = '\n';
+	uart_tx_buffer[i++] = '\r';
+	uart_tx_buffer[i++] = 0;
+	tx_lines++;
+
+}
+
+/**
+ * Appends text to uart_tx_buffer[], followed by a null character, if it fits in the TX slot.
+ *
+ * @param text    Characters to append, which don't need to be null terminated
+ * @param count   Number of characters
+ * @returns       1 if appended, 0 if there was not enough room (nothing is appended)
+ */
+uint8_t uart_append_text(const char *text, uint16_t count) {
+
+	// remove the existing null character
+	if(i > 0)
+		i--;
+
+	if(i + count + 1 > UART_TX_SLOT_SIZE) {
+		uart_tx_buffer[i++] = 0;
+		return 0;
+	}
+
+	memcpy(&uart_tx_buffer[i], text, count);
+	i += count;
+	uart_tx_buffer[i++] = 0;
+	return 1;
+
+}
+
+/**
+ * Appends a \n\r\0 to uart_tx_buffer[].
+ */
+void uart_append_newline(void) {
+
+	// remove the existing null character
+	if(i > 0)
+		i--;
+
+	if(!uart_tx_fits(3)) {
+		uart_tx_buffer[i++] = 0;
+		return;
+	}
+
+	uart_tx_buffer[i++] = '\n';
+	uart_tx_buffer[i++] = '\r';
+	uart_tx_buffer[i++] = 0;
+	tx_lines++;
+
+}
+
+/**
+ * Appends \x1B[*A\x1B[?25l to uart_tx_buffer[]. * is replaced with the actual number of lines.
+ * This moves the cursor back up to the top, and hides the cursor.
+ */
+void uart_append_cursor_home(void) {
+
+	uint32_t j = 0;
+
+	// remove the existing null character
+	if(i > 0)
+		i--;
+
+	// \x1B[, up to 5 digits, A\x1B[?25l and the null character
+	if(!uart_tx_fits(2 + 5 + 7 + 1)) {
+		uart_tx_buffer[i++] = 0;
+		return;
+	}
+
+	// append the text
+	const char *hide_cursor = "A\x1B[?25l";
+	uart_tx_buffer[i++] = '\x1B';
+	uart_tx_buffer[i++] = '[';
+	i += uint32_to_dec_buffer(tx_lines, &uart_tx_buffer[i]);
+	j = 0;
+	while(hide_cursor[j])
+		uart_tx_buffer[i++] = hide_cursor[j++];
+
+	uart_tx_buffer[i++] = 0;
+
+}
+
+/**
+ * Enables reception on the USART set up by uart_setup(). Bytes are written to a circular buffer by DMA,
+ * and the idle line interrupt wakes the CPU (from __WFI()) when the sender pauses, usually at the end of a frame.
+ *
+ * @param rx_pin   RX pin
+ */
+void uart_receive_setup(enum GPIO_PIN rx_pin) {
+
+	// the pin must belong to the USART that uart_setup() configured
+	if(usart == USART1 && rx_pin == PA10)
+		gpio_setup(rx_pin, AF, PUSH_PULL, FIFTY_MHZ, PULL_UP, AF1);
+	else if(usart == USART1 && rx_pin == PB7)
+		gpio_setup(rx_pin, AF, PUSH_PULL, FIFTY_MHZ, PULL_UP, AF0);
+	else if(usart == USART2 && (rx_pin == PA3 || rx_pin == PA15))
+		gpio_setup(rx_pin, AF, PUSH_PULL, FIFTY_MHZ, PULL_UP, AF1);
+	else
+		return;
+
+	rx_dma_channel = (usart == USART1) ? DMA1_Channel3 : DMA1_Channel5;
+	rx_read = 0;
+	rx_frame_length = 0;
+	rx_frame_overflow = 0;
+
+	rx_dma_channel->CCR = 0;                                        // disable the channel so it can be configured
+	rx_dma_channel->CNDTR = UART_RX_BUFFER_SIZE;                    // bytes to transfer before wrapping around
+	rx_dma_channel->CPAR = (uint32_t) (uintptr_t) &usart->RDR;      // peripheral address
+	rx_dma_channel->CMAR = (uint32_t) (uintptr_t) uart_rx_buffer;   // memory address
+	rx_dma_channel->CCR = DMA_CCR_MINC | DMA_CCR_CIRC | DMA_CCR_EN; // increment memory address, circular, read from peripheral, enable
+
+	// DMA for RX, and don't stop receiving if a byte is ever missed
+	usart->CR1 &= ~USART_CR1_UE;
+	usart->CR3 |= USART_CR3_DMAR | USART_CR3_OVRDIS;
+	usart->CR1 |= USART_CR1_UE | USART_CR1_RE | USART_CR1_IDLEIE;
+
+	if(usart == USART1)
+		NVIC_EnableIRQ(USART1_IRQn);
+	else
+		NVIC_EnableIRQ(USART2_IRQn);
+
+}
+
+/**
+ * Decodes a COBS encoded frame (without its 0x00 delimiter.)
+ *
+ * @returns   Number of bytes decoded, or 0 if the frame is invalid or too long
+ */
+static uint16_t uart_cobs_decode(const uint8_t *in, uint16_t length, uint8_t *out, uint16_t max_length) {
+
+	uint16_t r = 0;
+	uint16_t w = 0;
+
+	while(r < length) {
+		uint8_t code = in[r++];
+		for(uint8_t k = 1; k < code; k++) {
+			if(r >= length || w >= max_length)
+				return 0;
+			out[w++] = in[r++];
+		}
+		if(code < 0xFF && r < length) {
+			if(w >= max_length)
+				return 0;
+			out[w++] = 0;
+		}
+	}
+
+	return w;
+
+}
+
+/**
+ * Gets the next complete frame that was received. Frames use the same format as uart_frame_begin():
+ * the payload and its CRC-16, COBS encoded and terminated by 0x00. Frames with a bad CRC are dropped and counted.
+ * Call this from the main loop, not from an ISR, until it returns 0.
+ *
+ * @param payload      Where to write the payload
+ * @param max_length   Size of the payload buffer
+ * @returns            Size of the payload, or 0 if no complete frame is waiting
+ */
+uint16_t uart_receive_frame(uint8_t *payload, uint16_t max_length) {
+
+	if(!rx_dma_channel)
+		return 0;
+
+	uint16_t write = UART_RX_BUFFER_SIZE - rx_dma_channel->CNDTR;
+	if(write >= UART_RX_BUFFER_SIZE)
+		write = 0;
+
+	while(rx_read != write) {
+
+		uint8_t byte = uart_rx_buffer[rx_read];
+		rx_read = (rx_read + 1 == UART_RX_BUFFER_SIZE) ? 0 : rx_read + 1;
+
+		// collect bytes until the delimiter
+		if(byte != 0) {
+			if(rx_frame_length < UART_RX_FRAME_SIZE)
+				rx_frame[rx_frame_length++] = byte;
+			else
+				rx_frame_overflow = 1;
+			continue;
+		}
+
+		uint16_t length = rx_frame_length;
+		uint8_t overflow = rx_frame_overflow;
+		rx_frame_length = 0;
+		rx_frame_overflow = 0;
+
+		// ignore empty frames, so a sender can use extra delimiters to resynchronize
+		if(length == 0 && !overflow)
+			continue;
+
+		uint16_t n = overflow ? 0 : uart_cobs_decode(rx_frame, length, rx_frame, UART_RX_FRAME_SIZE);
+		if(n < 2 || n - 2 > max_length || uart_crc16(0xFFFF, rx_frame, n) != 0) {
+			statistics.receive_errors++;
+			continue;
+		}
+
+		memcpy(payload, rx_frame, n - 2);
+		statistics.frames_received++;
+		return n - 2;
+
+	}
+
+	return 0;
+
+}
+
+/**
+ * The idle line interrupt only needs to wake the CPU, so just clear the flag.
+ */
+static void uart_usart_handler(void) {
+
+	usart->ICR = USART_ICR_IDLECF;
+
+}
+
+void USART1_IRQHandler(void) {
+
+	uart_usart_handler();
+
+}
+
+void USART2_IRQHandler(void) {
+
+	uart_usart_handler();
+
+}
@@ -1,56 +1,166 @@
-// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
-// License: public domain
-
-#include "f0lib_gpio.h"
-
-/**
- * Possible GPIO usage:
- *
- * USART1 TX:	PA9	AF1		PB6 AF0
- * USART2 TX:	PA2 AF1		PA14 AF1
- */
-
-/**
- * Setup one of the USARTs for TX-only communication via DMA.
- *
- * @param tx      TX pin
- * @param baud    The baud rate, such as 9600
- */
-void uart_setup(enum GPIO_PIN tx_pin, uint32_t baud);
-
-void uart_send_csv_floats(uint8_t count, float first_value, ...);
-void uart_send_bin_floats(uint8_t count, float first_value, ...);
-
-/**
- * Effectively empties the TX buffer by placing a null character at position zero and resetting the pointer.
- */
-void uart_reset_tx_buffer(void);
-
-/**
- * Transmit the contents of uart_tx_buffer[] (until the null character) via DMA.
- */
-void uart_tx_via_dma(void);
-
-/**
- * Appends a horizontal ASCII line graph to uart_tx_buffer[]. The graph looks like this:
- *
- * X Acceleration     [          *                   ]    -0.985 G
- *
- * @param name    A text to show at the left of the graph
- * @param value   The value to be graphed and also shown at the right of the graph
- * @param unit    The text to be shown at the right of the graph
- * @param min     Sets the scale of the graph
- * @param max     Sets the scale of the graph
- */
-void uart_append_ascii_graph(char name[], float value, char unit[], float min, float max);
-
-/**
- * Appends a \n\r\0 to uart_tx_buffer[].
- */
-void uart_append_newline(void);
-
-/**
- * Appends \x1B[*A\x1B[?25l to uart_tx_buffer[]. * is replaced with the actual number of lines.
- * This moves the cursor back up to the top, and hides the cursor.
- */
-void uart_append_cursor_home(void);
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include "f0lib_gpio.h"
+
+// frames are built in one slot while earlier slots are sent, so a slot must hold the largest frame.
+// telemetry_send() queues up to three frames (data, acknowledgement or histogram, descriptor) while one is being sent
+#ifndef UART_TX_SLOTS
+#define UART_TX_SLOTS 4
+#endif
+#ifndef UART_TX_SLOT_SIZE
+#define UART_TX_SLOT_SIZE 512
+#endif
+
+// circular DMA receive buffer, which must hold everything that can arrive between two calls of uart_receive_frame()
+#ifndef UART_RX_BUFFER_SIZE
+#define UART_RX_BUFFER_SIZE 128
+#endif
+
+// largest received frame, COBS encoded and including the CRC
+#define UART_RX_FRAME_SIZE 64
+
+// digits after the decimal point in uart_send_csv_floats()
+#ifndef UART_CSV_DECIMALS
+#define UART_CSV_DECIMALS 7
+#endif
+
+// largest payload of a binary frame, so the payload and CRC can be COBS encoded in place with a single code byte
+#define UART_FRAME_MAX_PAYLOAD 252
+
+/**
+ * TX and RX counters. They only ever increase, so telemetry can report the difference between two readings.
+ */
+struct uart_statistics {
+	uint32_t frames_sent;
+	uint32_t frames_dropped;  // frames discarded because every slot was still waiting to be sent, or text that didn't fit in a slot
+	uint32_t bytes_sent;
+	uint32_t frames_received;
+	uint32_t receive_errors;  // received frames with a bad CRC or COBS encoding, or too long
+};
+
+/**
+ * Possible GPIO usage:
+ *
+ * USART1 TX:	PA9	AF1		PB6 AF0
+ * USART2 TX:	PA2 AF1		PA14 AF1
+ * USART1 RX:	PA10 AF1	PB7 AF0
+ * USART2 RX:	PA3 AF1		PA15 AF1
+ */
+
+/**
+ * Setup one of the USARTs for TX-only communication via DMA.
+ *
+ * @param tx      TX pin
+ * @param baud    The baud rate, such as 9600
+ */
+void uart_setup(enum GPIO_PIN tx_pin, uint32_t baud);
+
+void uart_send_csv_floats(uint8_t count, float first_value, ...);
+void uart_send_bin_floats(uint8_t count, float first_value, ...);
+
+/**
+ * Starts a binary frame in the TX buffer. The caller writes the payload directly to the returned memory,
+ * usually by pointing a struct at it, then calls uart_frame_end() to send it.
+ * The payload is followed by its CRC-16/CCITT-FALSE (big-endian), COBS encoded and terminated by a 0x00 byte.
+ * 0x00 never occurs inside a frame, so a receiver can always resynchronize at the next 0x00.
+ *
+ * @returns   Word aligned payload memory, with room for UART_FRAME_MAX_PAYLOAD bytes
+ */
+void* uart_frame_begin(void);
+
+/**
+ * Appends the CRC to a frame started with uart_frame_begin(), encodes it, and queues it for transmission.
+ *
+ * @param byte_count   Size of the payload, at most UART_FRAME_MAX_PAYLOAD bytes
+ */
+void uart_frame_end(uint16_t byte_count);
+
+/**
+ * Calculates a CRC-16/CCITT-FALSE. Start with a crc of 0xFFFF, and pass the result back in to continue over more bytes.
+ * A payload followed by its big-endian CRC gives a CRC of 0.
+ *
+ * @param crc     0xFFFF, or the result of the previous call
+ * @param bytes   Data
+ * @param count   Number of bytes
+ * @returns       The updated CRC
+ */
+uint16_t uart_crc16(uint16_t crc, const uint8_t *bytes, uint32_t count);
+
+/**
+ * Effectively empties the TX buffer by placing a null character at position zero and resetting the pointer.
+ */
+void uart_reset_tx_buffer(void);
+
+/**
+ * Queues the contents of uart_tx_buffer[] for transmission via DMA and returns immediately.
+ * The frame is sent once the frames queued before it are done, and the next frame is built in another slot.
+ * If every other slot is still waiting to be sent, the new frame is dropped and counted instead.
+ */
+void uart_tx_via_dma(void);
+
+/**
+ * Counts the frames that can still be queued before the TX ring is full and new frames are dropped.
+ *
+ * @returns   0 to UART_TX_SLOTS - 1
+ */
+uint8_t uart_tx_slots_free(void);
+
+/**
+ * Gets the TX and RX counters.
+ *
+ * @returns   Pointer to the counters, which are updated as frames are queued, sent and received
+ */
+const struct uart_statistics* uart_get_statistics(void);
+
+/**
+ * Appends a horizontal ASCII line graph to uart_tx_buffer[]. The graph looks like this:
+ *
+ * X Acceleration     [          *                   ]    -0.985 G
+ *
+ * @param name    A text to show at the left of the graph
+ * @param value   The value to be graphed and also shown at the right of the graph
+ * @param unit    The text to be shown at the right of the graph
+ * @param min     Sets the scale of the graph
+ * @param max     Sets the scale of the graph
+ */
+void uart_append_ascii_graph(char name[], float value, char unit[], float min, float max);
+
+/**
+ * Appends text to uart_tx_buffer[], followed by a null character, if it fits in the TX slot.
+ *
+ * @param text    Characters to append, which don't need to be null terminated
+ * @param count   Number of characters
+ * @returns       1 if appended, 0 if there was not enough room (nothing is appended)
+ */
+uint8_t uart_append_text(const char *text, uint16_t count);
+
+/**
+ * Appends a \n\r\0 to uart_tx_buffer[].
+ */
+void uart_append_newline(void);
+
+/**
+ * Appends \x1B[*A\x1B[?25l to uart_tx_buffer[]. * is replaced with the actual number of lines.
+ * This moves the cursor back up to the top, and hides the cursor.
+ */
+void uart_append_cursor_home(void);
+
+/**
+ * Enables reception on the USART set up by uart_setup(). Bytes are written to a circular buffer by DMA,
+ * and the idle line interrupt wakes the CPU (from __WFI()) when the sender pauses, usually at the end of a frame.
+ *
+ * @param rx_pin   RX pin
+ */
+void uart_receive_setup(enum GPIO_PIN rx_pin);
+
+/**
+ * Gets the next complete frame that was received. Frames use the same format as uart_frame_begin():
+ * the payload and its CRC-16, COBS encoded and terminated by 0x00. Frames with a bad CRC are dropped and counted.
+ * Call this from the main loop, not from an ISR, until it returns 0.
+ *
+ * @param payload      Where to write the payload
+ * @param max_length   Size of the payload buffer
+ * @returns            Size of the payload, or 0 if no complete frame is waiting
+ */
+uint16_t uart_receive_frame(uint8_t *payload, uint16_t max_length);
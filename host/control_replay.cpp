@@ -0,0 +1,84 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Replays a telemetry log (from telemetry_record) through the firmware's controller and reports how its outputs
+// compare with the recorded ones, and how fast the replay runs. See replay.h.
+//
+// Usage: control_replay [options] <log>
+//        -p <index>=<value>    override a controller parameter (enum PARAMETER in controller.h), may be repeated
+//        -t <tolerance>        relative difference allowed beyond the quantization, default 0 (bit-exact floats)
+//        -r                    restore the recorded state before every row
+//
+// Exits with 1 if any output differs, so it can be used to catch numeric regressions in the control code.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "replay.h"
+#include "controller.h"
+
+int main(int argc, char *argv[]) {
+
+	replay_options options;
+	options.tolerance = 0.0;
+	options.reseed = false;
+
+	int option;
+	while((option = getopt(argc, argv, "p:t:r")) != -1) {
+		unsigned int index;
+		float value;
+		switch(option) {
+			case 'p':
+				if(sscanf(optarg, "%u=%f", &index, &value) != 2 || index >= PARAMETER_COUNT) {
+					fprintf(stderr, "Invalid parameter: %s\n", optarg);
+					return 2;
+				}
+				controller_parameters[index] = value;
+				break;
+			case 't':
+				options.tolerance = atof(optarg);
+				break;
+			case 'r':
+				options.reseed = true;
+				break;
+			default:
+				fprintf(stderr, "Usage: %s [-p index=value] [-t tolerance] [-r] <log>\n", argv[0]);
+				return 2;
+		}
+	}
+	if(optind != argc - 1) {
+		fprintf(stderr, "Usage: %s [-p index=value] [-t tolerance] [-r] <log>\n", argv[0]);
+		return 2;
+	}
+
+	telemetry_log_reader log;
+	if(!log.open(argv[optind])) {
+		fprintf(stderr, "Unable to open %s as a telemetry log\n", argv[optind]);
+		return 2;
+	}
+
+	replay_report report;
+	std::string error;
+	if(!control_replay(log, options, report, error)) {
+		fprintf(stderr, "Unable to replay %s: %s\n", argv[optind], error.c_str());
+		return 2;
+	}
+
+	printf("%llu rows, %llu replayed, %llu skipped, %llu resyncs\n", (unsigned long long) report.rows,
+	       (unsigned long long) report.replayed, (unsigned long long) report.skipped, (unsigned long long) report.resyncs);
+	uint64_t mismatches = 0;
+	for(const replay_output &output : report.outputs) {
+		printf("%-14s %10llu compared %10llu differ   max difference %-12g", output.name.c_str(),
+		       (unsigned long long) output.compared, (unsigned long long) output.mismatches, output.max_difference);
+		if(output.mismatches)
+			printf(" first at row %llu", (unsigned long long) output.first_mismatch);
+		printf("\n");
+		mismatches += output.mismatches;
+	}
+	printf("replay: %.0f rows/s, %.0fx real time at 72.7 Hz\n", report.replayed / report.seconds,
+	       report.replayed / report.seconds / 72.7);
+
+	return mismatches ? 1 : 0;
+
+}
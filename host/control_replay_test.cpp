@@ -0,0 +1,251 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Records a synthetic run of the controller the way the robot would (through f0lib_telemetry, with main.c's channel
+// scales and types and a UART that drops frames), decodes it into a telemetry log, then checks that the replay
+// reproduces every recorded output, and that it notices when a parameter is changed.
+//
+// Usage: control_replay_test [samples]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <vector>
+#include "telemetry_decoder.h"
+#include "telemetry_log.h"
+#include "replay.h"
+#include "controller.h"
+#include "MadgwickAHRS.h"
+#include "f0lib_uart.h"
+#include "f0lib_mpu6050_hmc5883l.h"
+
+static uint32_t failures = 0;
+
+static void check(int condition, const char *description) {
+
+	printf("%s %s\n", condition ? "PASS" : "FAIL", description);
+	if(!condition)
+		failures++;
+
+}
+
+// uart shim: frames go straight to the decoder, and every 250th frame is dropped //////////////////////////////////////
+
+static telemetry_decoder decoder;
+static uint8_t frame_buffer[UART_TX_SLOT_SIZE];
+static struct uart_statistics uart_stats;
+
+void* uart_frame_begin(void) {
+
+	return &frame_buffer[4];
+
+}
+
+void uart_frame_end(uint16_t byte_count) {
+
+	if((uart_stats.frames_sent + uart_stats.frames_dropped + 1) % 250 == 0) {
+		uart_stats.frames_dropped++;
+		return;
+	}
+
+	uint8_t encoded[UART_TX_SLOT_SIZE];
+	size_t length = telemetry_encode_frame(&frame_buffer[4], byte_count, encoded);
+	decoder.feed(encoded, length);
+	uart_stats.frames_sent++;
+	uart_stats.bytes_sent += length;
+
+}
+
+void uart_reset_tx_buffer(void) {
+
+}
+
+uint8_t uart_tx_slots_free(void) {
+
+	return UART_TX_SLOTS - 1;
+
+}
+
+const struct uart_statistics* uart_get_statistics(void) {
+
+	return &uart_stats;
+
+}
+
+// the channels the replay uses, with the same names, scales and types as main.c //////////////////////////////////////
+
+static struct {
+	float accel_x, accel_y, accel_z;
+	float gyro_x, gyro_y, gyro_z;
+	float pitch;
+	float q0, q1, q2, q3;
+	float gimbal_x, gimbal_y;
+	float knob_left, knob_middle, knob_right;
+	float set_point, error;
+	float p_scalar, proportional;
+	float i_scalar, integral;
+	float d_scalar, derivative;
+} telemetry;
+
+static const struct telemetry_channel telemetry_channels[] = {
+	{"Accel X",         "G",     MPU6050_HMC5883L_ACCEL_G_PER_LSB,    TELEMETRY_INT16, &telemetry.accel_x},
+	{"Accel Y",         "G",     MPU6050_HMC5883L_ACCEL_G_PER_LSB,    TELEMETRY_INT16, &telemetry.accel_y},
+	{"Accel Z",         "G",     MPU6050_HMC5883L_ACCEL_G_PER_LSB,    TELEMETRY_INT16, &telemetry.accel_z},
+	{"Gyro X",          "rad/s", MPU6050_HMC5883L_GYRO_RAD_PER_LSB,   TELEMETRY_INT16, &telemetry.gyro_x},
+	{"Gyro Y",          "rad/s", MPU6050_HMC5883L_GYRO_RAD_PER_LSB,   TELEMETRY_INT16, &telemetry.gyro_y},
+	{"Gyro Z",          "rad/s", MPU6050_HMC5883L_GYRO_RAD_PER_LSB,   TELEMETRY_INT16, &telemetry.gyro_z},
+	{"Pitch",           "rad",   0.0001f,                             TELEMETRY_INT16, &telemetry.pitch},
+	{"Q0",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q0},
+	{"Q1",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q1},
+	{"Q2",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q2},
+	{"Q3",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q3},
+	{"Gimbal X",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.gimbal_x},
+	{"Gimbal Y",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.gimbal_y},
+	{"Knob Left",       "",      1.0f,                                TELEMETRY_INT16, &telemetry.knob_left},
+	{"Knob Middle",     "",      1.0f,                                TELEMETRY_INT16, &telemetry.knob_middle},
+	{"Knob Right",      "",      1.0f,                                TELEMETRY_INT16, &telemetry.knob_right},
+	{"Set Point",       "rad",   0.0001f,                             TELEMETRY_INT16, &telemetry.set_point},
+	{"Error",           "rad",   1.0f,                                TELEMETRY_FLOAT, &telemetry.error},
+	{"P Scalar",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.p_scalar},
+	{"Proportional",    "",      1.0f,                                TELEMETRY_INT16, &telemetry.proportional},
+	{"I Scalar",        "",      0.1f,                                TELEMETRY_INT16, &telemetry.i_scalar},
+	{"Integral",        "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.integral},
+	{"D Scalar",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.d_scalar},
+	{"Derivative",      "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.derivative}
+};
+
+// a robot rocking back and forth with noisy sensors, and someone turning the knobs now and then
+static void run_controller(uint32_t samples) {
+
+	telemetry_setup(telemetry_channels, sizeof(telemetry_channels) / sizeof(telemetry_channels[0]));
+	srand(1);
+	int16_t knobs[3] = {2048, 2048, 2048};
+
+	for(uint32_t n = 0; n < samples; n++) {
+
+		float t = n / 72.7f;
+		float angle = 0.15f * sinf(2.0f * 3.14159265f * 0.4f * t) + 0.05f * sinf(2.0f * 3.14159265f * 2.3f * t);
+		float rate = 0.15f * 2.0f * 3.14159265f * 0.4f * cosf(2.0f * 3.14159265f * 0.4f * t);
+		if(n % 500 == 0)
+			for(int k = 0; k < 3; k++)
+				knobs[k] = rand() % 4096;
+
+		// raw readings, converted like main.c does
+		int16_t raw_accel_x = -8192.0f * cosf(angle) + (rand() % 200 - 100);
+		int16_t raw_accel_y = rand() % 200 - 100;
+		int16_t raw_accel_z = 8192.0f * sinf(angle) + (rand() % 200 - 100);
+		int16_t raw_gyro_y  = rate * 939.650784f + (rand() % 20 - 10);
+		struct controller_inputs inputs = {
+			raw_accel_x * MPU6050_HMC5883L_ACCEL_G_PER_LSB,
+			raw_accel_y * MPU6050_HMC5883L_ACCEL_G_PER_LSB,
+			raw_accel_z * MPU6050_HMC5883L_ACCEL_G_PER_LSB,
+			(rand() % 20 - 10) * MPU6050_HMC5883L_GYRO_RAD_PER_LSB,
+			raw_gyro_y * MPU6050_HMC5883L_GYRO_RAD_PER_LSB,
+			(rand() % 20 - 10) * MPU6050_HMC5883L_GYRO_RAD_PER_LSB,
+			0.0f, 0.0f, 0.0f,
+			(float) (int16_t) (300.0f * sinf(t)), (float) (int16_t) (700.0f * sinf(0.3f * t)),
+			(float) knobs[0], (float) knobs[1], (float) knobs[2]
+		};
+
+		struct controller_outputs outputs;
+		controller_update(&inputs, &outputs);
+
+		telemetry.accel_x = inputs.accel_x;
+		telemetry.accel_y = inputs.accel_y;
+		telemetry.accel_z = inputs.accel_z;
+		telemetry.gyro_x = inputs.gyro_x;
+		telemetry.gyro_y = inputs.gyro_y;
+		telemetry.gyro_z = inputs.gyro_z;
+		telemetry.pitch = outputs.pitch;
+		telemetry.q0 = q0;
+		telemetry.q1 = q1;
+		telemetry.q2 = q2;
+		telemetry.q3 = q3;
+		telemetry.gimbal_x = inputs.gimbal_x;
+		telemetry.gimbal_y = inputs.gimbal_y;
+		telemetry.knob_left = inputs.knob_left;
+		telemetry.knob_middle = inputs.knob_middle;
+		telemetry.knob_right = inputs.knob_right;
+		telemetry.set_point = outputs.set_point;
+		telemetry.error = outputs.error;
+		telemetry.p_scalar = outputs.p_scalar;
+		telemetry.proportional = outputs.proportional;
+		telemetry.i_scalar = outputs.i_scalar;
+		telemetry.integral = outputs.integral;
+		telemetry.d_scalar = outputs.d_scalar;
+		telemetry.derivative = outputs.derivative;
+		telemetry_send(1000 + n * 13755);
+
+	}
+
+}
+
+static uint64_t total_mismatches(const replay_report &report) {
+
+	uint64_t mismatches = 0;
+	for(const replay_output &output : report.outputs)
+		mismatches += output.mismatches;
+	return mismatches;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint32_t samples = (argc > 1) ? strtoul(argv[1], NULL, 0) : 50000;
+	const char *path = "/tmp/control_replay_test.tlog";
+
+	// record
+	telemetry_log_writer writer;
+	bool log_open = false;
+	decoder.on_sample = [&](const telemetry_sample &sample) {
+		if(!log_open && decoder.schema_complete())
+			log_open = writer.open(path, decoder.channels());
+		if(log_open)
+			writer.append(sample);
+	};
+	run_controller(samples);
+	check(log_open && writer.close() && decoder.statistics().lost_frames > 0, "recorded, with lost frames");
+
+	telemetry_log_reader log;
+	check(log.open(path), "log opened");
+	uint64_t gaps = 0;
+	for(uint64_t row = 1; row < log.rows(); row++)
+		if(log.sequence(row) != log.sequence(row - 1) + 1)
+			gaps++;
+
+	// replay
+	replay_options options = {0.0, false};
+	replay_report report;
+	std::string error;
+	check(control_replay(log, options, report, error), "replayed");
+	for(const replay_output &output : report.outputs)
+		printf("    %-14s %8llu compared, %llu differ, max difference %g\n", output.name.c_str(),
+		       (unsigned long long) output.compared, (unsigned long long) output.mismatches, output.max_difference);
+	printf("    %llu rows, %llu replayed, %llu skipped, %llu resyncs, %llu gaps\n", (unsigned long long) report.rows,
+	       (unsigned long long) report.replayed, (unsigned long long) report.skipped, (unsigned long long) report.resyncs,
+	       (unsigned long long) gaps);
+	check(total_mismatches(report) == 0 && report.outputs[4].compared == report.replayed, "every output reproduced");
+	check(report.resyncs == gaps + 1 && report.skipped == gaps + 1 && report.replayed + report.skipped == report.rows,
+	      "resumed after every gap");
+	printf("replay: %.0f rows/s, %.0fx real time at 72.7 Hz\n", report.replayed / report.seconds, report.replayed / report.seconds / 72.7);
+
+	options.reseed = true;
+	check(control_replay(log, options, report, error) && total_mismatches(report) == 0, "reproduced when reseeded every row");
+
+	// a different gain changes the proportional term, which the replay must notice
+	options.reseed = false;
+	float p_gain = controller_parameters[P_GAIN];
+	controller_parameters[P_GAIN] = p_gain * 1.01f;
+	check(control_replay(log, options, report, error) && report.outputs[3].mismatches > 0 && report.outputs[4].mismatches > 0 &&
+	      report.outputs[6].mismatches == 0, "a changed parameter is detected");
+	controller_parameters[P_GAIN] = p_gain;
+
+	log.close();
+	unlink(path);
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+
+}
@@ -0,0 +1,132 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Checks float_to_dec_buffer() from f0lib_converters against the C library's printf("%.*f"),
+// then compares their speed.
+//
+// Usage: float_format_test [random_values]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <math.h>
+#include "mock.h"
+#include "f0lib_converters.h"
+
+static uint32_t failures = 0;
+static uint32_t comparisons = 0;
+
+// compares one value at one precision, and reports the first few mismatches
+static void compare(float value, uint8_t decimals) {
+
+	char expected[64];
+	char actual[64];
+	snprintf(expected, sizeof(expected), "%.*f", decimals, value);
+	uint8_t length = float_to_dec_buffer(value, decimals, actual);
+
+	comparisons++;
+	if(strcmp(expected, actual) != 0 || length != strlen(actual)) {
+		if(failures < 20)
+			printf("FAIL %.9g with %u decimals: printf gives \"%s\", float_to_dec_buffer gives \"%s\"\n", value, decimals, expected, actual);
+		failures++;
+	}
+
+}
+
+static float from_bits(uint32_t bits) {
+
+	float value;
+	memcpy(&value, &bits, sizeof(value));
+	return value;
+
+}
+
+static uint32_t random_bits(void) {
+
+	return ((uint32_t) rand() << 16) ^ (uint32_t) rand();
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint32_t random_values = (argc > 1) ? strtoul(argv[1], NULL, 0) : 2000000;
+
+	// exact ties, carries into the integer part, and the extremes of the supported range
+	const float special[] = {0.0f, -0.0f, 0.5f, 1.5f, 2.5f, -2.5f, 0.125f, 0.375f, 0.9999999f, 9.99999995f, 99.5f, 0.05f,
+	                         1e-10f, -1e-10f, 1e-45f, 1.17549435e-38f, 4294967295.0f, 4294967296.0f, 9.2233715e18f,
+	                         3.14159265f, -123.456789f, 16777216.0f, 16777217.0f};
+	for(uint32_t i = 0; i < sizeof(special) / sizeof(special[0]); i++)
+		for(uint8_t decimals = 0; decimals <= 9; decimals++)
+			compare(special[i], decimals);
+
+	// every power of two in the supported range
+	for(int32_t exponent = 1; exponent < 127 + 63; exponent++)
+		for(uint8_t decimals = 0; decimals <= 9; decimals++)
+			compare(from_bits(exponent << 23), decimals);
+
+	// random bit patterns below 2^63, weighted towards the magnitudes that telemetry uses
+	srand(1);
+	for(uint32_t i = 0; i < random_values; i++) {
+		uint32_t bits = random_bits();
+		if(i & 1)
+			bits = (bits & 0x807FFFFF) | ((100 + random_bits() % 40) << 23); // roughly 1e-8 to 1e4
+		float value = from_bits(bits);
+		if(isnan(value) || isinf(value) || fabsf(value) >= 9.2233720e18f)
+			continue;
+		compare(value, random_bits() % 10);
+	}
+
+	// magnitudes of 2^63 and above, infinity and NaN
+	char text[64];
+	float_to_dec_buffer(1e30f, 3, text);
+	comparisons++;
+	if(strcmp(text, "ovf") != 0) {
+		printf("FAIL 1e30 gives \"%s\"\n", text);
+		failures++;
+	}
+	float_to_dec_buffer(-from_bits(0x7F800000), 3, text);
+	comparisons++;
+	if(strcmp(text, "-inf") != 0) {
+		printf("FAIL -inf gives \"%s\"\n", text);
+		failures++;
+	}
+	float_to_dec_buffer(from_bits(0x7FC00000), 3, text);
+	comparisons++;
+	if(strcmp(text, "nan") != 0) {
+		printf("FAIL nan gives \"%s\"\n", text);
+		failures++;
+	}
+
+	printf("%s %u comparisons with printf\n", failures ? "FAIL" : "PASS", comparisons);
+
+	// benchmark with the CSV mode's format: values of telemetry-like magnitudes with 7 decimals
+	if(random_values) {
+		const uint32_t count = 1000000;
+		float *values = (float*) malloc(count * sizeof(float));
+		for(uint32_t i = 0; i < count; i++)
+			values[i] = ((int32_t) random_bits() % 200000) / 1000.0f;
+
+		volatile uint32_t sink = 0;
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(uint32_t i = 0; i < count; i++)
+			sink += snprintf(text, sizeof(text), "%2.7f", values[i]);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double printf_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / count;
+
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(uint32_t i = 0; i < count; i++)
+			sink += float_to_dec_buffer(values[i], 7, text);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double formatter_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / count;
+
+		printf("benchmark: %.1f ns per value with snprintf, %.1f ns per value with float_to_dec_buffer (on the host)\n",
+		       printf_ns, formatter_ns);
+		free(values);
+	}
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+
+}
@@ -0,0 +1,260 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Fits the gyro bias vs temperature table used by f0lib_mpu6050_hmc5883l.
+//
+// Usage: gyro_temp_fit [-u <serial port or file>] <log> [temperature_start temperature_shift]
+//
+// The log is recorded by telemetry_record, and the "Temperature", "Gyro X", "Gyro Y" and "Gyro Z" channels are used.
+// Record with the robot at rest while the board warms up, with the existing bias table zeroed, and in the sensor's
+// axes (the default axis mapping.) The table is printed as C initializers for a struct mpu6050_hmc5883l_calibration.
+// If the temperature range is not given it is chosen to span the logged data.
+//
+// With -u the table is also written as one COMMAND_SET_GYRO_BIAS frame (see main.c), which the robot applies right away
+// and stores in flash once its motors are stopped. A serial port must already be configured, for example with:
+// stty -F <port> 921600 raw
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <vector>
+#include "telemetry_log.h"
+
+// these must match f0lib_mpu6050_hmc5883l.h
+#define BIAS_POINTS      8
+#define GYRO_LSB_PER_RAD 939.650784
+#define TEMP_LSB_PER_C   340.0
+#define TEMP_C_OFFSET    36.53
+
+// weight of the smoothness term, which also fills in points that have no nearby samples
+#define SMOOTHING 1e-3
+
+// this must match main.c
+#define COMMAND_SET_GYRO_BIAS 0x06
+
+struct sample {
+	double temperature; // raw
+	double gyro[3];     // raw
+};
+
+// Solves a * x = b by Gaussian elimination with partial pivoting. Returns 0 if the system is singular.
+static int solve(double a[BIAS_POINTS][BIAS_POINTS], double b[BIAS_POINTS], double x[BIAS_POINTS]) {
+
+	for(int column = 0; column < BIAS_POINTS; column++) {
+		int pivot = column;
+		for(int row = column + 1; row < BIAS_POINTS; row++)
+			if(fabs(a[row][column]) > fabs(a[pivot][column]))
+				pivot = row;
+		if(fabs(a[pivot][column]) < 1e-12)
+			return 0;
+		for(int i = 0; i < BIAS_POINTS; i++) {
+			double temp = a[column][i]; a[column][i] = a[pivot][i]; a[pivot][i] = temp;
+		}
+		double temp = b[column]; b[column] = b[pivot]; b[pivot] = temp;
+
+		for(int row = column + 1; row < BIAS_POINTS; row++) {
+			double factor = a[row][column] / a[column][column];
+			for(int i = column; i < BIAS_POINTS; i++)
+				a[row][i] -= factor * a[column][i];
+			b[row] -= factor * b[column];
+		}
+	}
+
+	for(int row = BIAS_POINTS - 1; row >= 0; row--) {
+		double sum = b[row];
+		for(int i = row + 1; i < BIAS_POINTS; i++)
+			sum -= a[row][i] * x[i];
+		x[row] = sum / a[row][row];
+	}
+	return 1;
+
+}
+
+// Writes one command frame the way f0lib_uart expects it: the payload and its CRC-16/CCITT-FALSE (big endian),
+// COBS encoded and terminated by a zero. Payloads are short enough to need no 0xFF code blocks.
+static int write_command(FILE *port, const uint8_t *payload, size_t length) {
+
+	uint8_t data[64];
+	uint8_t encoded[sizeof(data) + 2];
+	memcpy(data, payload, length);
+
+	uint16_t crc = 0xFFFF;
+	for(size_t i = 0; i < length; i++) {
+		crc ^= (uint16_t) payload[i] << 8;
+		for(int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : crc << 1;
+	}
+	data[length++] = crc >> 8;
+	data[length++] = crc & 0xFF;
+
+	size_t code = 0;
+	size_t n = 1;
+	for(size_t i = 0; i < length; i++) {
+		if(data[i] == 0) {
+			encoded[code] = n - code;
+			code = n++;
+		} else {
+			encoded[n++] = data[i];
+		}
+	}
+	encoded[code] = n - code;
+	encoded[n++] = 0;
+
+	return fwrite(encoded, 1, n, port) == n;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	const char *program = argv[0];
+	const char *upload = NULL;
+	if(argc >= 3 && strcmp(argv[1], "-u") == 0) {
+		upload = argv[2];
+		argc -= 2;
+		argv += 2;
+	}
+
+	if(argc != 2 && argc != 4) {
+		fprintf(stderr, "Usage: %s [-u <serial port or file>] <log> [temperature_start temperature_shift]\n", program);
+		return 1;
+	}
+
+	telemetry_log_reader log;
+	if(!log.open(argv[1])) {
+		fprintf(stderr, "Unable to open %s as a telemetry log\n", argv[1]);
+		return 1;
+	}
+
+	static const char *names[4] = {"Temperature", "Gyro X", "Gyro Y", "Gyro Z"};
+	int channels[4];
+	for(int i = 0; i < 4; i++) {
+		channels[i] = log.find_channel(names[i]);
+		if(channels[i] < 0) {
+			fprintf(stderr, "%s has no \"%s\" channel\n", argv[1], names[i]);
+			return 1;
+		}
+	}
+
+	// read the rows that have all four channels, converted back to raw units
+	std::vector<struct sample> samples;
+	for(uint64_t chunk = 0; chunk < log.chunks(); chunk++) {
+		const float *columns[4];
+		for(int i = 0; i < 4; i++)
+			columns[i] = log.chunk_channel(chunk, channels[i]);
+		for(uint32_t k = 0; k < log.chunk(chunk).rows; k++) {
+			if(isnan(columns[0][k]) || isnan(columns[1][k]) || isnan(columns[2][k]) || isnan(columns[3][k]))
+				continue; // decimated channels
+			struct sample sample;
+			sample.temperature = (columns[0][k] - TEMP_C_OFFSET) * TEMP_LSB_PER_C;
+			for(int axis = 0; axis < 3; axis++)
+				sample.gyro[axis] = columns[1 + axis][k] * GYRO_LSB_PER_RAD;
+			samples.push_back(sample);
+		}
+	}
+	log.close();
+	size_t count = samples.size();
+	if(count < BIAS_POINTS) {
+		fprintf(stderr, "Need at least %d samples, got %zu.\n", BIAS_POINTS, count);
+		return 1;
+	}
+
+	// choose the table's temperature range
+	double minimum = samples[0].temperature, maximum = samples[0].temperature;
+	for(size_t i = 1; i < count; i++) {
+		if(samples[i].temperature < minimum) minimum = samples[i].temperature;
+		if(samples[i].temperature > maximum) maximum = samples[i].temperature;
+	}
+	long start = (long) floor(minimum);
+	int shift = 0;
+	while(shift < 14 && start + ((long) (BIAS_POINTS - 1) << shift) < maximum)
+		shift++;
+	if(argc == 4) {
+		start = strtol(argv[2], NULL, 0);
+		shift = atoi(argv[3]);
+	}
+	double spacing = (double) (1L << shift);
+
+	// least squares fit of a piecewise linear curve: every sample is a weighted sum of its two neighboring points
+	int16_t table[3][BIAS_POINTS];
+	for(int axis = 0; axis < 3; axis++) {
+		double a[BIAS_POINTS][BIAS_POINTS] = {{0}};
+		double b[BIAS_POINTS] = {0};
+		double x[BIAS_POINTS];
+
+		for(size_t i = 0; i < count; i++) {
+			double position = (samples[i].temperature - start) / spacing;
+			if(position < 0) position = 0;
+			if(position > BIAS_POINTS - 1) position = BIAS_POINTS - 1;
+			int point = (int) position;
+			if(point == BIAS_POINTS - 1) point--;
+			double fraction = position - point;
+			double w0 = 1.0 - fraction, w1 = fraction;
+			a[point][point]         += w0 * w0;
+			a[point][point + 1]     += w0 * w1;
+			a[point + 1][point]     += w1 * w0;
+			a[point + 1][point + 1] += w1 * w1;
+			b[point]                += w0 * samples[i].gyro[axis];
+			b[point + 1]            += w1 * samples[i].gyro[axis];
+		}
+
+		// penalize the second difference so the curve stays smooth where there is little data
+		double weight = SMOOTHING * count;
+		for(int point = 1; point < BIAS_POINTS - 1; point++) {
+			int index[3] = {point - 1, point, point + 1};
+			double coefficient[3] = {1, -2, 1};
+			for(int i = 0; i < 3; i++)
+				for(int j = 0; j < 3; j++)
+					a[index[i]][index[j]] += weight * coefficient[i] * coefficient[j];
+		}
+
+		if(!solve(a, b, x)) {
+			fprintf(stderr, "Unable to fit the %c axis.\n", 'x' + axis);
+			return 1;
+		}
+		for(int point = 0; point < BIAS_POINTS; point++)
+			table[axis][point] = (int16_t) lround(x[point]);
+	}
+
+	printf("// gyro bias vs temperature, fitted from %zu samples between %.1fC and %.1fC\n", count, minimum / TEMP_LSB_PER_C + TEMP_C_OFFSET, maximum / TEMP_LSB_PER_C + TEMP_C_OFFSET);
+	printf(".gyro_bias_temperature_start = %ld,\n", start);
+	printf(".gyro_bias_temperature_shift = %d,\n", shift);
+	printf(".gyro_bias_table = {\n");
+	for(int axis = 0; axis < 3; axis++) {
+		printf("\t{");
+		for(int point = 0; point < BIAS_POINTS; point++)
+			printf("%s%d", point ? ", " : "", table[axis][point]);
+		printf("},\n");
+	}
+	printf("},\n");
+
+	// command payload: start (int16), shift (uint16), then the x, y and z points (int16), all little endian like the STM32
+	if(upload) {
+		FILE *port = fopen(upload, "wb");
+		if(!port) {
+			fprintf(stderr, "Unable to open %s\n", upload);
+			return 1;
+		}
+		uint8_t payload[5 + 3 * 2 * BIAS_POINTS];
+		payload[0] = COMMAND_SET_GYRO_BIAS;
+		payload[1] = (uint16_t) start & 0xFF;
+		payload[2] = (uint16_t) start >> 8;
+		payload[3] = shift & 0xFF;
+		payload[4] = shift >> 8;
+		for(int axis = 0; axis < 3; axis++) {
+			for(int point = 0; point < BIAS_POINTS; point++) {
+				payload[5 + 2 * (axis * BIAS_POINTS + point)] = (uint16_t) table[axis][point] & 0xFF;
+				payload[6 + 2 * (axis * BIAS_POINTS + point)] = (uint16_t) table[axis][point] >> 8;
+			}
+		}
+		int written = write_command(port, payload, sizeof(payload));
+		if(fclose(port) != 0 || !written) {
+			fprintf(stderr, "Unable to write %s\n", upload);
+			return 1;
+		}
+	}
+
+	return 0;
+
+}
@@ -0,0 +1,139 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Controls for the host-side peripheral models. See stm32f0xx.h in this directory.
+
+#pragma once
+#include "stm32f0xx.h"
+
+// core ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Connects an interrupt to a peripheral model. Whenever the IRQ is enabled in the NVIC, interrupts are not globally
+ * disabled and the handler is not already running, pending() is polled after each register access and handler() is
+ * called until pending() returns 0.
+ *
+ * @param irq       Interrupt number
+ * @param pending   Returns non-zero while the peripheral is requesting an interrupt
+ * @param handler   The firmware's ISR
+ */
+void mock_irq_connect(IRQn_Type irq, int (*pending)(void), void (*handler)(void));
+
+/**
+ * Calls the ISRs of any pending interrupts. Called automatically after register accesses and by the enable functions.
+ */
+void mock_irq_service(void);
+
+/**
+ * Makes flash blank again and clears the erase/write counters.
+ */
+void mock_flash_reset(void);
+
+extern uint32_t mock_flash_erases;
+extern uint32_t mock_flash_writes;
+
+// i2c ////////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * A device on a mock I2C bus. The callbacks are called as the master drives the bus.
+ */
+struct mock_i2c_device {
+	uint8_t address;
+	void (*start)(uint8_t read);  // addressed after a start bit
+	void (*write)(uint8_t byte);  // byte received from the master
+	uint8_t (*read)(void);        // byte to send to the master
+};
+
+enum MOCK_I2C_FAULT {
+	MOCK_I2C_NO_FAULT,
+	MOCK_I2C_NACK_ADDRESS,        // no device answers
+	MOCK_I2C_NACK_DATA,           // the device rejects the first data byte
+	MOCK_I2C_ARBITRATION_LOST,    // another master takes the bus after the address
+	MOCK_I2C_BUS_TIMEOUT          // a device holds SCL low. TIMEOUT is raised if TIMEOUTR enables it, otherwise the bus just stalls
+};
+
+/**
+ * Resets the model of an I2C peripheral, detaches all devices and clears any faults.
+ */
+void mock_i2c_reset(I2C_TypeDef *i2c);
+
+/**
+ * Adds a device to the bus.
+ */
+void mock_i2c_attach(I2C_TypeDef *i2c, const struct mock_i2c_device *device);
+
+/**
+ * Makes the next transfers (start bits) fail.
+ *
+ * @param i2c     I2C1 or I2C2
+ * @param fault   Type of failure
+ * @param count   Number of transfers to fail
+ */
+void mock_i2c_inject_fault(I2C_TypeDef *i2c, enum MOCK_I2C_FAULT fault, uint32_t count);
+
+/**
+ * Gets the time the bus would have been busy, based on the bits clocked and the SCL period set by TIMINGR.
+ *
+ * @returns   Bus time in nanoseconds
+ */
+uint64_t mock_i2c_bus_time_ns(I2C_TypeDef *i2c);
+
+// mpu6050 and hmc5883l ///////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Resets the MPU6050 and HMC5883L register maps and attaches both devices to a bus.
+ */
+void mock_mpu6050_hmc5883l_attach(I2C_TypeDef *i2c);
+
+/**
+ * Loads the MPU6050 output registers with the next sample.
+ * The magnetometer values are the three words read by the MPU6050's slave 0 from the HMC5883L, in HMC5883L register order.
+ */
+void mock_mpu6050_set_sample(const int16_t accel[3], int16_t temperature, const int16_t gyro[3], const int16_t magn[3]);
+
+/**
+ * Reads back a register that the firmware configured.
+ */
+uint8_t mock_mpu6050_register(uint8_t reg);
+uint8_t mock_hmc5883l_register(uint8_t reg);
+
+// exti ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Simulates an edge on a pin configured with exti_setup(), by calling its handler. This is the same as exti_trigger().
+ * The edge is timestamped with mock_microseconds.
+ */
+void mock_exti_edge(uint8_t pin);
+
+// the time reported by exti_get_timestamp() for the next edge
+extern uint32_t mock_microseconds;
+
+// usart and dma //////////////////////////////////////////////////////////////////////////////////////////////////////
+
+/**
+ * Resets both USARTs and the DMA controller, and connects their interrupts to the firmware's ISRs.
+ * Nothing moves on its own: the test decides when bytes go out or come in, so it also sets the pace of the line.
+ */
+void mock_uart_reset(void);
+
+/**
+ * Shifts bytes out of a USART, as its TX DMA channel feeds it. Transfer complete flags are raised (and their ISRs run)
+ * as each transfer finishes, so the firmware can chain the next one during the same call.
+ *
+ * @param usart   USART1 or USART2
+ * @param bytes   Where to write the bytes that went out on the line
+ * @param max     Most bytes to shift out, such as the number of byte times that have passed
+ * @returns       Number of bytes written, less than max if the DMA ran out of work
+ */
+uint32_t mock_uart_transmit(USART_TypeDef *usart, uint8_t *bytes, uint32_t max);
+
+/**
+ * Delivers bytes to a USART's RX DMA channel, then signals an idle line.
+ * Bytes are lost if the receiver or its DMA channel is not enabled.
+ *
+ * @param usart   USART1 or USART2
+ * @param bytes   Bytes arriving on the line
+ * @param count   Number of bytes
+ * @returns       Number of bytes written to memory by the DMA
+ */
+uint32_t mock_uart_receive(USART_TypeDef *usart, const uint8_t *bytes, uint32_t count);
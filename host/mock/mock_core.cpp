@@ -0,0 +1,181 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// NVIC, flash, GPIO and EXTI models. GPIO pins are plain memory: the bus models do not look at the pins.
+
+#include <string.h>
+#include "mock.h"
+#include "f0lib_gpio.h"
+#include "f0lib_exti.h"
+#include "f0lib_flash.h"
+
+uint32_t SystemCoreClock = 48000000;
+
+RCC_TypeDef mock_rcc;
+SYSCFG_TypeDef mock_syscfg;
+uint8_t mock_gpio_memory[6 * 0x400];
+
+// nvic ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define IRQ_COUNT 32
+
+struct irq {
+	int (*pending)(void);
+	void (*handler)(void);
+	uint8_t enabled;
+	uint8_t running;
+};
+
+static struct irq irqs[IRQ_COUNT];
+static uint8_t interrupts_disabled = 0;
+
+mock_register::operator uint32_t() {
+
+	uint32_t result = on_read ? on_read(this) : value;
+	mock_irq_service();
+	return result;
+
+}
+
+mock_register& mock_register::operator=(uint32_t new_value) {
+
+	if(on_write)
+		on_write(this, new_value);
+	else
+		value = new_value;
+	mock_irq_service();
+	return *this;
+
+}
+
+void mock_irq_connect(IRQn_Type irq, int (*pending)(void), void (*handler)(void)) {
+
+	irqs[irq].pending = pending;
+	irqs[irq].handler = handler;
+
+}
+
+void mock_irq_service(void) {
+
+	if(interrupts_disabled)
+		return;
+
+	for(int i = 0; i < IRQ_COUNT; i++) {
+		struct irq *irq = &irqs[i];
+		if(!irq->pending || !irq->handler || !irq->enabled || irq->running)
+			continue;
+		irq->running = 1;
+		while(irq->enabled && !interrupts_disabled && irq->pending())
+			irq->handler();
+		irq->running = 0;
+	}
+
+}
+
+void NVIC_EnableIRQ(IRQn_Type irq) {
+
+	irqs[irq].enabled = 1;
+	mock_irq_service();
+
+}
+
+void NVIC_DisableIRQ(IRQn_Type irq) {
+
+	irqs[irq].enabled = 0;
+
+}
+
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority) {
+
+}
+
+void __enable_irq(void) {
+
+	interrupts_disabled = 0;
+	mock_irq_service();
+
+}
+
+void __disable_irq(void) {
+
+	interrupts_disabled = 1;
+
+}
+
+// flash //////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static uint8_t flash[64 * 0x400];
+uint32_t mock_flash_erases = 0;
+uint32_t mock_flash_writes = 0;
+
+void mock_flash_reset(void) {
+
+	memset(flash, 0xFF, sizeof(flash));
+	mock_flash_erases = 0;
+	mock_flash_writes = 0;
+
+}
+
+uint8_t flash_erase_page(uint8_t pageNum) {
+
+	if(pageNum >= 64)
+		return 0;
+	memset(&flash[pageNum * 0x400], 0xFF, 0x400);
+	mock_flash_erases++;
+	return 1;
+
+}
+
+uint8_t flash_write_page(uint8_t pageNum, void* data, uint32_t byteCount) {
+
+	if(pageNum >= 64 || byteCount > 0x400)
+		return 0;
+	memcpy(&flash[pageNum * 0x400], data, byteCount);
+	mock_flash_writes++;
+	return 1;
+
+}
+
+const void* flash_page_address(uint8_t pageNum) {
+
+	return &flash[pageNum * 0x400];
+
+}
+
+// gpio and exti //////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static void (*exti_handlers[16])(void);
+static uint32_t exti_timestamps[16];
+uint32_t mock_microseconds = 0;
+
+void gpio_setup(enum GPIO_PIN pin, enum GPIO_MODE mode, enum GPIO_TYPE type, enum GPIO_SPEED speed, enum GPIO_PULL pull, enum GPIO_AF af) {
+
+	gpio_set_mode(pin, mode);
+
+}
+
+void exti_setup(enum GPIO_PIN pin, enum GPIO_PULL pull, enum EXTI_EDGE edge, void (*handler)(void)) {
+
+	exti_handlers[pin % 16] = handler;
+
+}
+
+void exti_trigger(enum GPIO_PIN pin) {
+
+	exti_timestamps[pin % 16] = mock_microseconds;
+	if(exti_handlers[pin % 16])
+		exti_handlers[pin % 16]();
+
+}
+
+uint32_t exti_get_timestamp(enum GPIO_PIN pin) {
+
+	return exti_timestamps[pin % 16];
+
+}
+
+void mock_exti_edge(uint8_t pin) {
+
+	exti_trigger((enum GPIO_PIN) pin);
+
+}
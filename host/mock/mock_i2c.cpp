@@ -0,0 +1,277 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Model of the STM32F0 I2C peripheral in master mode.
+// Transfers complete instantly: each register access immediately produces the flags the hardware would set next,
+// and bus time is accumulated separately from the SCL period in TIMINGR.
+
+#include "mock.h"
+#include "f0lib_i2c.h"
+
+void I2C1_IRQHandler(void);
+void I2C2_IRQHandler(void);
+
+I2C_TypeDef mock_i2c1;
+I2C_TypeDef mock_i2c2;
+
+#define MAX_DEVICES 8
+
+struct bus {
+	const struct mock_i2c_device *devices[MAX_DEVICES];
+	uint8_t device_count;
+	const struct mock_i2c_device *target;   // device addressed by the current transfer, or 0
+	uint8_t nbytes;                         // bytes left in the current transfer
+	uint8_t autoend;
+	uint8_t nack_next_write;
+	enum MOCK_I2C_FAULT fault;
+	uint32_t fault_count;
+	uint64_t time_ns;
+};
+
+static struct bus buses[2];
+
+static struct bus* get_bus(I2C_TypeDef *i2c) {
+
+	return (i2c == I2C2) ? &buses[1] : &buses[0];
+
+}
+
+// finds which peripheral a register belongs to
+static I2C_TypeDef* get_i2c(struct mock_register *reg) {
+
+	if((uint8_t *) reg >= (uint8_t *) &mock_i2c2 && (uint8_t *) reg < (uint8_t *) (&mock_i2c2 + 1))
+		return &mock_i2c2;
+	return &mock_i2c1;
+
+}
+
+// clocks some bits at the SCL frequency set by TIMINGR
+// each period also includes the edges, the analog filter delays (about 50ns each) and 2 clocks of synchronization per edge
+static void clock_bits(I2C_TypeDef *i2c, uint32_t bits) {
+
+	uint32_t timing = i2c->TIMINGR.value;
+	uint64_t presc = (timing >> 28) & 0xF;
+	uint64_t sclh = (timing >> 8) & 0xFF;
+	uint64_t scll = timing & 0xFF;
+	uint64_t period_ns = ((presc + 1) * (sclh + 1 + scll + 1) + 4) * 1000000000ULL / SystemCoreClock + I2C_RISE_TIME_NS + I2C_FALL_TIME_NS + 100;
+	get_bus(i2c)->time_ns += bits * period_ns;
+
+}
+
+static void end_transfer(I2C_TypeDef *i2c, struct bus *bus) {
+
+	if(bus->autoend) {
+		clock_bits(i2c, 1);
+		i2c->ISR.value |= I2C_ISR_STOPF;
+		bus->target = 0;
+	} else {
+		i2c->ISR.value |= I2C_ISR_TC;
+	}
+
+}
+
+// a NACK always makes the master send a stop bit
+static void nack(I2C_TypeDef *i2c, struct bus *bus) {
+
+	clock_bits(i2c, 1);
+	i2c->ISR.value |= I2C_ISR_NACKF | I2C_ISR_STOPF;
+	bus->target = 0;
+
+}
+
+static void receive_next_byte(I2C_TypeDef *i2c, struct bus *bus) {
+
+	clock_bits(i2c, 9);
+	i2c->RXDR.value = bus->target->read();
+	i2c->ISR.value |= I2C_ISR_RXNE;
+	bus->nbytes--;
+
+}
+
+static void start_transfer(I2C_TypeDef *i2c, struct bus *bus, uint32_t cr2) {
+
+	uint8_t address = (cr2 >> 1) & 0x7F;
+	uint8_t read = (cr2 & I2C_CR2_RD_WRN) ? 1 : 0;
+	bus->nbytes = (cr2 & I2C_CR2_NBYTES) >> 16;
+	bus->autoend = (cr2 & I2C_CR2_AUTOEND) ? 1 : 0;
+	bus->nack_next_write = 0;
+	i2c->ISR.value &= ~I2C_ISR_TC;
+
+	// start bit, address and acknowledge
+	clock_bits(i2c, 10);
+
+	if(bus->fault_count) {
+		bus->fault_count--;
+		switch(bus->fault) {
+			case MOCK_I2C_NACK_ADDRESS:
+				nack(i2c, bus);
+				return;
+			case MOCK_I2C_ARBITRATION_LOST:
+				i2c->ISR.value |= I2C_ISR_ARLO;
+				bus->target = 0;
+				return;
+			case MOCK_I2C_BUS_TIMEOUT:
+				if(i2c->TIMEOUTR.value & I2C_TIMEOUTR_TIMOUTEN)
+					i2c->ISR.value |= I2C_ISR_TIMEOUT;
+				bus->target = 0;
+				return;
+			case MOCK_I2C_NACK_DATA:
+				bus->nack_next_write = 1;
+				break;
+			default:
+				break;
+		}
+	}
+
+	bus->target = 0;
+	for(uint8_t i = 0; i < bus->device_count; i++)
+		if(bus->devices[i]->address == address)
+			bus->target = bus->devices[i];
+	if(!bus->target) {
+		nack(i2c, bus);
+		return;
+	}
+
+	bus->target->start(read);
+
+	if(bus->nbytes == 0)
+		end_transfer(i2c, bus);
+	else if(read)
+		receive_next_byte(i2c, bus);
+	else
+		i2c->ISR.value |= I2C_ISR_TXIS;
+
+}
+
+static void cr1_write(struct mock_register *reg, uint32_t value) {
+
+	I2C_TypeDef *i2c = get_i2c(reg);
+
+	// clearing PE resets the state machine and the flags
+	if(!(value & I2C_CR1_PE)) {
+		i2c->ISR.value = 0;
+		get_bus(i2c)->target = 0;
+	}
+	reg->value = value;
+
+}
+
+static void cr2_write(struct mock_register *reg, uint32_t value) {
+
+	I2C_TypeDef *i2c = get_i2c(reg);
+
+	reg->value = value & ~(I2C_CR2_START | I2C_CR2_STOP);
+	if((value & I2C_CR2_START) && (i2c->CR1.value & I2C_CR1_PE))
+		start_transfer(i2c, get_bus(i2c), value);
+
+}
+
+static void icr_write(struct mock_register *reg, uint32_t value) {
+
+	I2C_TypeDef *i2c = get_i2c(reg);
+	i2c->ISR.value &= ~(value & (I2C_ICR_NACKCF | I2C_ICR_STOPCF | I2C_ICR_BERRCF | I2C_ICR_ARLOCF | I2C_ICR_OVRCF | I2C_ICR_TIMOUTCF));
+
+}
+
+static void txdr_write(struct mock_register *reg, uint32_t value) {
+
+	I2C_TypeDef *i2c = get_i2c(reg);
+	struct bus *bus = get_bus(i2c);
+
+	reg->value = value & 0xFF;
+	if(!(i2c->ISR.value & I2C_ISR_TXIS) || !bus->target)
+		return;
+	i2c->ISR.value &= ~I2C_ISR_TXIS;
+	clock_bits(i2c, 9);
+
+	if(bus->nack_next_write) {
+		nack(i2c, bus);
+		return;
+	}
+
+	bus->target->write(value & 0xFF);
+	bus->nbytes--;
+	if(bus->nbytes > 0)
+		i2c->ISR.value |= I2C_ISR_TXIS;
+	else
+		end_transfer(i2c, bus);
+
+}
+
+static uint32_t rxdr_read(struct mock_register *reg) {
+
+	I2C_TypeDef *i2c = get_i2c(reg);
+	struct bus *bus = get_bus(i2c);
+
+	uint32_t value = reg->value;
+	if(!(i2c->ISR.value & I2C_ISR_RXNE))
+		return value;
+	i2c->ISR.value &= ~I2C_ISR_RXNE;
+
+	if(bus->nbytes > 0)
+		receive_next_byte(i2c, bus);
+	else
+		end_transfer(i2c, bus);
+
+	return value;
+
+}
+
+// interrupt requests, from the flags and their enable bits in CR1
+static int pending(I2C_TypeDef *i2c) {
+
+	uint32_t cr1 = i2c->CR1.value;
+	uint32_t isr = i2c->ISR.value;
+
+	return ((cr1 & I2C_CR1_TXIE)   && (isr & I2C_ISR_TXIS))  ||
+	       ((cr1 & I2C_CR1_RXIE)   && (isr & I2C_ISR_RXNE))  ||
+	       ((cr1 & I2C_CR1_NACKIE) && (isr & I2C_ISR_NACKF)) ||
+	       ((cr1 & I2C_CR1_STOPIE) && (isr & I2C_ISR_STOPF)) ||
+	       ((cr1 & I2C_CR1_TCIE)   && (isr & I2C_ISR_TC))    ||
+	       ((cr1 & I2C_CR1_ERRIE)  && (isr & (I2C_ISR_BERR | I2C_ISR_ARLO | I2C_ISR_TIMEOUT)));
+
+}
+
+static int i2c1_pending(void) { return pending(&mock_i2c1); }
+static int i2c2_pending(void) { return pending(&mock_i2c2); }
+
+void mock_i2c_reset(I2C_TypeDef *i2c) {
+
+	struct bus *bus = get_bus(i2c);
+	*bus = {};
+	*i2c = I2C_TypeDef();
+
+	i2c->CR1.on_write = cr1_write;
+	i2c->CR2.on_write = cr2_write;
+	i2c->ICR.on_write = icr_write;
+	i2c->TXDR.on_write = txdr_write;
+	i2c->RXDR.on_read = rxdr_read;
+
+	if(i2c == I2C1)
+		mock_irq_connect(I2C1_IRQn, i2c1_pending, I2C1_IRQHandler);
+	else
+		mock_irq_connect(I2C2_IRQn, i2c2_pending, I2C2_IRQHandler);
+
+}
+
+void mock_i2c_attach(I2C_TypeDef *i2c, const struct mock_i2c_device *device) {
+
+	struct bus *bus = get_bus(i2c);
+	if(bus->device_count < MAX_DEVICES)
+		bus->devices[bus->device_count++] = device;
+
+}
+
+void mock_i2c_inject_fault(I2C_TypeDef *i2c, enum MOCK_I2C_FAULT fault, uint32_t count) {
+
+	struct bus *bus = get_bus(i2c);
+	bus->fault = fault;
+	bus->fault_count = count;
+
+}
+
+uint64_t mock_i2c_bus_time_ns(I2C_TypeDef *i2c) {
+
+	return get_bus(i2c)->time_ns;
+
+}
@@ -0,0 +1,103 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Register maps of the MPU6050 and HMC5883L. The first byte written after a start bit sets the register pointer,
+// and the pointer increments after every byte read or written.
+
+#include <string.h>
+#include "mock.h"
+
+struct register_map {
+	uint8_t registers[128];
+	uint8_t pointer;
+	uint8_t pointer_written;  // the first byte of a write sets the pointer
+};
+
+static struct register_map mpu6050;
+static struct register_map hmc5883l;
+
+static void map_start(struct register_map *map, uint8_t read) {
+
+	map->pointer_written = read;
+
+}
+
+static void map_write(struct register_map *map, uint8_t byte) {
+
+	if(!map->pointer_written) {
+		map->pointer = byte & 0x7F;
+		map->pointer_written = 1;
+	} else {
+		map->registers[map->pointer] = byte;
+		map->pointer = (map->pointer + 1) & 0x7F;
+	}
+
+}
+
+static uint8_t map_read(struct register_map *map) {
+
+	uint8_t byte = map->registers[map->pointer];
+	map->pointer = (map->pointer + 1) & 0x7F;
+	return byte;
+
+}
+
+static void mpu6050_start(uint8_t read)   { map_start(&mpu6050, read); }
+static void mpu6050_write(uint8_t byte)   { map_write(&mpu6050, byte); }
+static uint8_t mpu6050_read(void)         { return map_read(&mpu6050); }
+static void hmc5883l_start(uint8_t read)  { map_start(&hmc5883l, read); }
+static void hmc5883l_write(uint8_t byte)  { map_write(&hmc5883l, byte); }
+static uint8_t hmc5883l_read(void)        { return map_read(&hmc5883l); }
+
+static const struct mock_i2c_device mpu6050_device  = {0b1101000, mpu6050_start,  mpu6050_write,  mpu6050_read};
+static const struct mock_i2c_device hmc5883l_device = {0b0011110, hmc5883l_start, hmc5883l_write, hmc5883l_read};
+
+void mock_mpu6050_hmc5883l_attach(I2C_TypeDef *i2c) {
+
+	memset(&mpu6050, 0, sizeof(mpu6050));
+	memset(&hmc5883l, 0, sizeof(hmc5883l));
+
+	// power-on values that differ from zero
+	mpu6050.registers[0x6B] = 0x40;  // sleeping
+	mpu6050.registers[0x75] = 0x68;  // WHO_AM_I
+	hmc5883l.registers[0x00] = 0x10;
+	hmc5883l.registers[0x01] = 0x20;
+	hmc5883l.registers[0x02] = 0x01; // single measurement mode
+	hmc5883l.registers[0x0A] = 'H';
+	hmc5883l.registers[0x0B] = '4';
+	hmc5883l.registers[0x0C] = '3';
+
+	mock_i2c_attach(i2c, &mpu6050_device);
+	mock_i2c_attach(i2c, &hmc5883l_device);
+
+}
+
+static void put_word(uint8_t reg, int16_t value) {
+
+	mpu6050.registers[reg] = (uint16_t) value >> 8;
+	mpu6050.registers[reg + 1] = (uint16_t) value & 0xFF;
+
+}
+
+void mock_mpu6050_set_sample(const int16_t accel[3], int16_t temperature, const int16_t gyro[3], const int16_t magn[3]) {
+
+	for(uint8_t axis = 0; axis < 3; axis++) {
+		put_word(0x3B + 2 * axis, accel[axis]); // ACCEL_XOUT_H
+		put_word(0x43 + 2 * axis, gyro[axis]);  // GYRO_XOUT_H
+		put_word(0x49 + 2 * axis, magn[axis]);  // EXT_SENS_DATA_00
+	}
+	put_word(0x41, temperature);                // TEMP_OUT_H
+
+}
+
+uint8_t mock_mpu6050_register(uint8_t reg) {
+
+	return mpu6050.registers[reg & 0x7F];
+
+}
+
+uint8_t mock_hmc5883l_register(uint8_t reg) {
+
+	return hmc5883l.registers[reg & 0x7F];
+
+}
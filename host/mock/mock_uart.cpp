@@ -0,0 +1,206 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Model of the USARTs when serviced by DMA, and of the DMA channels that feed them.
+// Only memory-incrementing transfers are modeled: memory to TDR for TX, and RDR to memory (optionally circular) for RX.
+// The line has no timing of its own. The test shifts bytes out and in, so it decides the baud rate.
+
+#include <string.h>
+#include "mock.h"
+
+void DMA1_Channel2_3_IRQHandler(void);
+void DMA1_Channel4_5_IRQHandler(void);
+void USART1_IRQHandler(void);
+void USART2_IRQHandler(void);
+
+USART_TypeDef mock_usart1;
+USART_TypeDef mock_usart2;
+DMA_TypeDef mock_dma1;
+DMA_Channel_TypeDef mock_dma1_channels[5];
+
+#define CHANNELS 5
+
+struct channel {
+	uint32_t count;      // CNDTR when the channel was enabled, reloaded in circular mode
+	uint32_t position;   // bytes transferred since then
+};
+
+static struct channel channels[CHANNELS];
+
+// The firmware writes 32-bit addresses to CPAR and CMAR, so on a 64-bit host the upper half is lost.
+// It is restored from the address of this model, which works for the registers and static buffers of the same executable.
+static uint32_t address_of(const void *pointer) {
+
+	return (uint32_t) (uintptr_t) pointer;
+
+}
+
+static uint8_t* host_address(uint32_t address) {
+
+	uintptr_t upper = (uintptr_t) &mock_dma1 & ~(uintptr_t) 0xFFFFFFFFu;
+	return (uint8_t *) (upper | address);
+
+}
+
+// transfer complete flag of a channel (0 = channel 1)
+static uint32_t tc_flag(int n) {
+
+	return 0x2 << (4 * n);
+
+}
+
+// finds the enabled DMA channel that moves data to or from a USART register
+static int find_channel(struct mock_register *usart_register, uint32_t direction) {
+
+	for(int n = 0; n < CHANNELS; n++) {
+		DMA_Channel_TypeDef *channel = &mock_dma1_channels[n];
+		if((channel->CCR.value & DMA_CCR_EN) && (channel->CCR.value & DMA_CCR_DIR) == direction &&
+		   channel->CPAR.value == address_of(usart_register))
+			return n;
+	}
+	return -1;
+
+}
+
+static void ccr_write(struct mock_register *reg, uint32_t value) {
+
+	int n = 0;
+	while(n < CHANNELS - 1 && reg != &mock_dma1_channels[n].CCR)
+		n++;
+
+	// enabling a channel latches its count and restarts it at the first address
+	if(!(reg->value & DMA_CCR_EN) && (value & DMA_CCR_EN)) {
+		channels[n].count = mock_dma1_channels[n].CNDTR.value;
+		channels[n].position = 0;
+	}
+	reg->value = value;
+
+}
+
+static void ifcr_write(struct mock_register *reg, uint32_t value) {
+
+	mock_dma1.ISR.value &= ~value;
+
+}
+
+static void usart1_icr_write(struct mock_register *reg, uint32_t value) {
+
+	mock_usart1.ISR.value &= ~value;
+
+}
+
+static void usart2_icr_write(struct mock_register *reg, uint32_t value) {
+
+	mock_usart2.ISR.value &= ~value;
+
+}
+
+// interrupt requests: a transfer complete flag with its TCIE bit, or an idle line with IDLEIE
+static int dma_pending(int first, int last) {
+
+	for(int n = first; n <= last; n++)
+		if((mock_dma1.ISR.value & tc_flag(n)) && (mock_dma1_channels[n].CCR.value & DMA_CCR_TCIE))
+			return 1;
+	return 0;
+
+}
+
+static int dma_channel2_3_pending(void) { return dma_pending(1, 2); }
+static int dma_channel4_5_pending(void) { return dma_pending(3, 4); }
+static int usart1_pending(void) { return (mock_usart1.ISR.value & USART_ISR_IDLE) && (mock_usart1.CR1.value & USART_CR1_IDLEIE); }
+static int usart2_pending(void) { return (mock_usart2.ISR.value & USART_ISR_IDLE) && (mock_usart2.CR1.value & USART_CR1_IDLEIE); }
+
+void mock_uart_reset(void) {
+
+	mock_usart1 = USART_TypeDef();
+	mock_usart2 = USART_TypeDef();
+	mock_dma1 = DMA_TypeDef();
+	for(int n = 0; n < CHANNELS; n++) {
+		mock_dma1_channels[n] = DMA_Channel_TypeDef();
+		mock_dma1_channels[n].CCR.on_write = ccr_write;
+		channels[n] = {};
+	}
+
+	mock_dma1.IFCR.on_write = ifcr_write;
+	mock_usart1.ICR.on_write = usart1_icr_write;
+	mock_usart2.ICR.on_write = usart2_icr_write;
+
+	mock_irq_connect(DMA1_Channel2_3_IRQn, dma_channel2_3_pending, DMA1_Channel2_3_IRQHandler);
+	mock_irq_connect(DMA1_Channel4_5_IRQn, dma_channel4_5_pending, DMA1_Channel4_5_IRQHandler);
+	mock_irq_connect(USART1_IRQn, usart1_pending, USART1_IRQHandler);
+	mock_irq_connect(USART2_IRQn, usart2_pending, USART2_IRQHandler);
+
+}
+
+uint32_t mock_uart_transmit(USART_TypeDef *usart, uint8_t *bytes, uint32_t max) {
+
+	uint32_t sent = 0;
+
+	while(sent < max) {
+
+		if((usart->CR1.value & (USART_CR1_UE | USART_CR1_TE)) != (USART_CR1_UE | USART_CR1_TE) || !(usart->CR3.value & USART_CR3_DMAT))
+			break;
+
+		int n = find_channel(&usart->TDR, DMA_CCR_DIR);
+		if(n < 0)
+			break;
+		DMA_Channel_TypeDef *channel = &mock_dma1_channels[n];
+
+		// a finished transfer that the ISR hasn't replaced yet (interrupts are disabled, or nothing else is queued)
+		uint32_t remaining = channel->CNDTR.value;
+		if(remaining == 0)
+			break;
+
+		uint32_t count = (remaining < max - sent) ? remaining : max - sent;
+		memcpy(&bytes[sent], host_address(channel->CMAR.value) + channels[n].position, count);
+		usart->TDR.value = bytes[sent + count - 1];
+		channels[n].position += count;
+		channel->CNDTR.value = remaining - count;
+		sent += count;
+
+		// the ISR may start the next transfer right away
+		if(channel->CNDTR.value == 0) {
+			mock_dma1.ISR.value |= tc_flag(n);
+			mock_irq_service();
+		}
+
+	}
+
+	return sent;
+
+}
+
+uint32_t mock_uart_receive(USART_TypeDef *usart, const uint8_t *bytes, uint32_t count) {
+
+	if((usart->CR1.value & (USART_CR1_UE | USART_CR1_RE)) != (USART_CR1_UE | USART_CR1_RE) || !(usart->CR3.value & USART_CR3_DMAR))
+		return 0;
+
+	int n = find_channel(&usart->RDR, 0);
+	if(n < 0)
+		return 0;
+	DMA_Channel_TypeDef *channel = &mock_dma1_channels[n];
+	uint8_t *memory = host_address(channel->CMAR.value);
+
+	uint32_t written = 0;
+	while(written < count && channel->CNDTR.value > 0) {
+
+		usart->RDR.value = bytes[written];
+		memory[channels[n].position++] = bytes[written++];
+		channel->CNDTR.value--;
+
+		// circular mode reloads the count as soon as it reaches zero
+		if(channel->CNDTR.value == 0) {
+			mock_dma1.ISR.value |= tc_flag(n);
+			if(channel->CCR.value & DMA_CCR_CIRC) {
+				channel->CNDTR.value = channels[n].count;
+				channels[n].position = 0;
+			}
+		}
+
+	}
+
+	usart->ISR.value |= USART_ISR_IDLE;
+	mock_irq_service();
+	return written;
+
+}
@@ -0,0 +1,189 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Stand-in for the CMSIS device header, so f0lib drivers can run on a PC.
+// Registers of modeled peripherals are mock_register objects: every read and write goes through a hook in the peripheral
+// model, and pending interrupts are delivered after each access. This needs operator overloading, so firmware sources
+// must be compiled as C++ (g++ -x c++) when this header is used.
+// Only the peripherals and bit definitions used by the modeled drivers are provided.
+
+#pragma once
+#include <stdint.h>
+
+#define __IO
+
+/**
+ * A peripheral register. Without hooks it behaves like plain memory.
+ */
+struct mock_register {
+	uint32_t value;
+	uint32_t (*on_read)(struct mock_register *reg);
+	void (*on_write)(struct mock_register *reg, uint32_t value);
+
+	operator uint32_t();
+	mock_register& operator=(uint32_t new_value);
+	mock_register& operator|=(uint32_t bits) { return *this = (uint32_t) *this | bits; }
+	mock_register& operator&=(uint32_t bits) { return *this = (uint32_t) *this & bits; }
+};
+
+// core ///////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef enum {
+	WWDG_IRQn = 0, PVD_IRQn = 1, RTC_IRQn = 2, FLASH_IRQn = 3, RCC_IRQn = 4, EXTI0_1_IRQn = 5, EXTI2_3_IRQn = 6, EXTI4_15_IRQn = 7,
+	TS_IRQn = 8, DMA1_Channel1_IRQn = 9, DMA1_Channel2_3_IRQn = 10, DMA1_Channel4_5_IRQn = 11, ADC1_COMP_IRQn = 12,
+	TIM1_BRK_UP_TRG_COM_IRQn = 13, TIM1_CC_IRQn = 14, TIM2_IRQn = 15, TIM3_IRQn = 16, TIM6_DAC_IRQn = 17, TIM14_IRQn = 19,
+	TIM15_IRQn = 20, TIM16_IRQn = 21, TIM17_IRQn = 22, I2C1_IRQn = 23, I2C2_IRQn = 24, SPI1_IRQn = 25, SPI2_IRQn = 26,
+	USART1_IRQn = 27, USART2_IRQn = 28, CEC_IRQn = 30
+} IRQn_Type;
+
+void NVIC_EnableIRQ(IRQn_Type irq);
+void NVIC_DisableIRQ(IRQn_Type irq);
+void NVIC_SetPriority(IRQn_Type irq, uint32_t priority);
+void __enable_irq(void);
+void __disable_irq(void);
+static inline void __NOP(void) {}
+
+extern uint32_t SystemCoreClock;
+
+// peripherals ////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+typedef struct {
+	mock_register CR1, CR2, OAR1, OAR2, TIMINGR, TIMEOUTR, ISR, ICR, PECR, RXDR, TXDR;
+} I2C_TypeDef;
+
+typedef struct {
+	mock_register CR1, CR2, CR3, BRR, GTPR, RTOR, RQR, ISR, ICR, RDR, TDR;
+} USART_TypeDef;
+
+typedef struct {
+	mock_register CCR, CNDTR, CPAR, CMAR;
+} DMA_Channel_TypeDef;
+
+typedef struct {
+	mock_register ISR, IFCR;
+} DMA_TypeDef;
+
+typedef struct {
+	volatile uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2], BRR;
+} GPIO_TypeDef;
+
+typedef struct {
+	volatile uint32_t CR, CFGR, CIR, APB2RSTR, APB1RSTR, AHBENR, APB2ENR, APB1ENR, BDCR, CSR, AHBRSTR, CFGR2, CFGR3, CR2;
+} RCC_TypeDef;
+
+typedef struct {
+	volatile uint32_t CFGR1, RESERVED, EXTICR[4], CFGR2;
+} SYSCFG_TypeDef;
+
+extern I2C_TypeDef mock_i2c1, mock_i2c2;
+extern USART_TypeDef mock_usart1, mock_usart2;
+extern DMA_TypeDef mock_dma1;
+extern DMA_Channel_TypeDef mock_dma1_channels[5];
+extern RCC_TypeDef mock_rcc;
+extern SYSCFG_TypeDef mock_syscfg;
+extern uint8_t mock_gpio_memory[6 * 0x400];
+
+#define I2C1          (&mock_i2c1)
+#define I2C2          (&mock_i2c2)
+#define USART1        (&mock_usart1)
+#define USART2        (&mock_usart2)
+#define DMA1          (&mock_dma1)
+#define DMA1_Channel1 (&mock_dma1_channels[0])
+#define DMA1_Channel2 (&mock_dma1_channels[1])
+#define DMA1_Channel3 (&mock_dma1_channels[2])
+#define DMA1_Channel4 (&mock_dma1_channels[3])
+#define DMA1_Channel5 (&mock_dma1_channels[4])
+#define RCC           (&mock_rcc)
+#define SYSCFG        (&mock_syscfg)
+#define GPIOA_BASE    ((uintptr_t) mock_gpio_memory)
+#define GPIOA         ((GPIO_TypeDef *) (GPIOA_BASE + 0x0000))
+#define GPIOB         ((GPIO_TypeDef *) (GPIOA_BASE + 0x0400))
+#define GPIOC         ((GPIO_TypeDef *) (GPIOA_BASE + 0x0800))
+#define GPIOD         ((GPIO_TypeDef *) (GPIOA_BASE + 0x0C00))
+#define GPIOF         ((GPIO_TypeDef *) (GPIOA_BASE + 0x1400))
+
+// bit definitions ////////////////////////////////////////////////////////////////////////////////////////////////////
+
+#define I2C_CR1_PE                0x00000001
+#define I2C_CR1_TXIE              0x00000002
+#define I2C_CR1_RXIE              0x00000004
+#define I2C_CR1_ADDRIE            0x00000008
+#define I2C_CR1_NACKIE            0x00000010
+#define I2C_CR1_STOPIE            0x00000020
+#define I2C_CR1_TCIE              0x00000040
+#define I2C_CR1_ERRIE             0x00000080
+
+#define I2C_CR2_SADD              0x000003FF
+#define I2C_CR2_RD_WRN            0x00000400
+#define I2C_CR2_START             0x00002000
+#define I2C_CR2_STOP              0x00004000
+#define I2C_CR2_NBYTES            0x00FF0000
+#define I2C_CR2_RELOAD            0x01000000
+#define I2C_CR2_AUTOEND           0x02000000
+
+#define I2C_TIMEOUTR_TIMEOUTA     0x00000FFF
+#define I2C_TIMEOUTR_TIDLE        0x00001000
+#define I2C_TIMEOUTR_TIMOUTEN     0x00008000
+
+#define I2C_ISR_TXE               0x00000001
+#define I2C_ISR_TXIS              0x00000002
+#define I2C_ISR_RXNE              0x00000004
+#define I2C_ISR_NACKF             0x00000010
+#define I2C_ISR_STOPF             0x00000020
+#define I2C_ISR_TC                0x00000040
+#define I2C_ISR_TCR               0x00000080
+#define I2C_ISR_BERR              0x00000100
+#define I2C_ISR_ARLO              0x00000200
+#define I2C_ISR_OVR               0x00000400
+#define I2C_ISR_TIMEOUT           0x00001000
+#define I2C_ISR_BUSY              0x00008000
+
+#define I2C_ICR_NACKCF            0x00000010
+#define I2C_ICR_STOPCF            0x00000020
+#define I2C_ICR_BERRCF            0x00000100
+#define I2C_ICR_ARLOCF            0x00000200
+#define I2C_ICR_OVRCF             0x00000400
+#define I2C_ICR_TIMOUTCF          0x00001000
+
+#define RCC_APB1ENR_I2C1EN        0x00200000
+#define RCC_APB1ENR_I2C2EN        0x00400000
+#define RCC_APB1RSTR_I2C1RST      0x00200000
+#define RCC_APB1RSTR_I2C2RST      0x00400000
+#define RCC_APB2ENR_SYSCFGEN      0x00000001
+#define RCC_CFGR3_I2C1SW          0x00000010
+
+#define SYSCFG_CFGR1_I2C_FMP_PB6  0x00010000
+#define SYSCFG_CFGR1_I2C_FMP_PB7  0x00020000
+#define SYSCFG_CFGR1_I2C_FMP_PB8  0x00040000
+#define SYSCFG_CFGR1_I2C_FMP_PB9  0x00080000
+
+#define RCC_AHBENR_DMA1EN         0x00000001
+#define RCC_APB2ENR_USART1EN      0x00004000
+#define RCC_APB2RSTR_USART1RST    0x00004000
+#define RCC_APB1ENR_USART2EN      0x00020000
+#define RCC_APB1RSTR_USART2RST    0x00020000
+
+#define USART_CR1_UE              0x00000001
+#define USART_CR1_RE              0x00000004
+#define USART_CR1_TE              0x00000008
+#define USART_CR1_IDLEIE          0x00000010
+#define USART_CR3_DMAR            0x00000040
+#define USART_CR3_DMAT            0x00000080
+#define USART_CR3_OVRDIS          0x00001000
+#define USART_ISR_IDLE            0x00000010
+#define USART_ICR_IDLECF          0x00000010
+
+#define DMA_CCR_EN                0x00000001
+#define DMA_CCR_TCIE              0x00000002
+#define DMA_CCR_DIR               0x00000010
+#define DMA_CCR_CIRC              0x00000020
+#define DMA_CCR_MINC              0x00000080
+
+#define DMA_ISR_TCIF2             0x00000020
+#define DMA_ISR_TCIF3             0x00000200
+#define DMA_ISR_TCIF4             0x00002000
+#define DMA_ISR_TCIF5             0x00020000
+#define DMA_IFCR_CTCIF2           0x00000020
+#define DMA_IFCR_CTCIF3           0x00000200
+#define DMA_IFCR_CTCIF4           0x00002000
+#define DMA_IFCR_CTCIF5           0x00020000
@@ -0,0 +1,241 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Runs f0lib_i2c and f0lib_mpu6050_hmc5883l against the host peripheral models in mock/.
+// Checks configuration, calibration, temperature compensation and recovery from injected bus faults,
+// then measures the driver's cost per sample.
+//
+// Usage: mpu6050_sim [benchmark_samples]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include "mock.h"
+#include "f0lib_i2c.h"
+#include "f0lib_mpu6050_hmc5883l.h"
+
+static uint32_t failures = 0;
+
+static void check(int condition, const char *description) {
+
+	printf("%s %s\n", condition ? "PASS" : "FAIL", description);
+	if(!condition)
+		failures++;
+
+}
+
+// event handler
+static uint32_t handler_calls = 0;
+static struct mpu6050_hmc5883l_sample last_sample;
+
+static void handler(const struct mpu6050_hmc5883l_sample *sample) {
+
+	handler_calls++;
+	last_sample = *sample;
+
+}
+
+// loads a sample into the MPU6050 and raises its interrupt
+static void feed(int16_t temperature, int16_t gyro_x, int16_t gyro_y, int16_t gyro_z) {
+
+	const int16_t accel[3] = {0, 0, 8192};
+	const int16_t gyro[3] = {gyro_x, gyro_y, gyro_z};
+	const int16_t magn[3] = {100, 200, 300};
+	mock_mpu6050_set_sample(accel, temperature, gyro, magn);
+	mock_microseconds += 13750; // 72.7Hz
+	mock_exti_edge(PB7);
+
+}
+
+// models a power cycle: the bus and sensors are reset, flash is kept
+static void boot(void) {
+
+	mock_i2c_reset(I2C1);
+	mock_mpu6050_hmc5883l_attach(I2C1);
+	mpu6050_hmc5883l_setup(PB8, PB9, PB7, &handler);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint32_t benchmark_samples = (argc > 1) ? strtoul(argv[1], NULL, 0) : 1000000;
+	const struct i2c_statistics *stats = i2c_get_statistics(I2C1);
+	struct i2c_statistics before;
+
+	// first boot with blank flash
+	mock_flash_reset();
+	boot();
+	check(i2c_queue_idle(I2C1), "setup: configuration writes completed");
+	check(mock_mpu6050_register(0x6B) == 0x00 && mock_mpu6050_register(0x19) == 109 &&
+	      mock_mpu6050_register(0x1B) == 0x18 && mock_mpu6050_register(0x1C) == 0x08 &&
+	      mock_mpu6050_register(0x38) == 0x01 && mock_mpu6050_register(0x6A) == 0x20 &&
+	      mock_mpu6050_register(0x25) == (0x1E | 0x80) && mock_mpu6050_register(0x26) == 0x03 &&
+	      mock_mpu6050_register(0x27) == (6 | 0x80) && mock_mpu6050_register(0x67) == 1, "setup: MPU6050 registers configured");
+	check(mock_hmc5883l_register(0x00) == 0x18 && mock_hmc5883l_register(0x01) == 0x60 &&
+	      mock_hmc5883l_register(0x02) == 0x00, "setup: HMC5883L registers configured");
+	check(mock_i2c1.TIMINGR.value != 0, "setup: TIMINGR set");
+	check(mpu6050_hmc5883l_calibrating(), "first boot: blank flash starts a gyro calibration");
+
+	for(int i = 0; i < 128; i++)
+		feed(1000, 100, -50, 25);
+	const struct mpu6050_hmc5883l_calibration *calibration = mpu6050_hmc5883l_get_calibration();
+	check(handler_calls == 0, "first boot: handler not called while calibrating");
+	check(!mpu6050_hmc5883l_calibrating() && mock_flash_writes == 0, "first boot: flash not written from the interrupt");
+	check(mpu6050_hmc5883l_save_pending_calibration() && mock_flash_writes == 1, "first boot: calibration written to flash");
+	check(!mpu6050_hmc5883l_save_pending_calibration() && mock_flash_writes == 1, "first boot: written only once");
+	check(calibration->gyro_offset[0] == 100 && calibration->gyro_offset[1] == -50 && calibration->gyro_offset[2] == 25 &&
+	      calibration->gyro_offset_temperature == 1000, "first boot: gyro offsets measured");
+
+	feed(1000, 110, -50, 25);
+	check(handler_calls == 1 && last_sample.gyro_x == 10 && last_sample.gyro_y == 0 && last_sample.gyro_z == 0,
+	      "first boot: offsets applied");
+	check(last_sample.accel_z == 8192 && last_sample.magn_x == 100 && last_sample.temperature == 1000, "first boot: sample fields");
+	check(last_sample.timestamp == mock_microseconds, "first boot: sample timestamped at the interrupt");
+
+	// 1MHz can't be met from an 8MHz clock, so setup reports the failure instead of running the bus at another speed
+	SystemCoreClock = 8000000;
+	mock_i2c1.TIMINGR.value = 0;
+	check(!mpu6050_hmc5883l_setup(PB8, PB9, PB7, &handler) && mock_i2c1.TIMINGR.value == 0, "setup: too slow a clock is reported");
+	SystemCoreClock = 48000000;
+
+	// second boot: the stored calibration is used immediately
+	boot();
+	check(!mpu6050_hmc5883l_calibrating(), "second boot: calibration loaded from flash");
+	handler_calls = 0;
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 1 && last_sample.gyro_x == 0, "second boot: first sample delivered");
+
+	// a NACK on the register number is retried
+	before = *stats;
+	handler_calls = 0;
+	mock_i2c_inject_fault(I2C1, MOCK_I2C_NACK_DATA, 2);
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 1 && stats->nacks == before.nacks + 2 && stats->retries == before.retries + 2 &&
+	      stats->failures == before.failures, "faults: NACKs retried");
+
+	// arbitration is lost on every attempt, so the sample is dropped
+	before = *stats;
+	handler_calls = 0;
+	mock_i2c_inject_fault(I2C1, MOCK_I2C_ARBITRATION_LOST, 1 + I2C_MAX_RETRIES);
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 0 && stats->arbitration_losses == before.arbitration_losses + 1 + I2C_MAX_RETRIES &&
+	      stats->failures == before.failures + 1, "faults: arbitration loss gives up after the retries");
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 1, "faults: next sample read normally");
+
+	// SCL held low is caught by the TIMEOUT hardware, and the bus is recovered by the main loop
+	before = *stats;
+	handler_calls = 0;
+	mock_i2c_inject_fault(I2C1, MOCK_I2C_BUS_TIMEOUT, 1);
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 0 && stats->timeouts == before.timeouts + 1 && stats->recoveries == before.recoveries,
+	      "faults: TIMEOUT defers recovery out of the interrupt");
+	mpu6050_hmc5883l_recover_bus();
+	check(handler_calls == 1 && stats->recoveries == before.recoveries + 1 && stats->retries == before.retries + 1,
+	      "faults: main loop recovers the bus and retries the read");
+	mpu6050_hmc5883l_recover_bus();
+	check(stats->recoveries == before.recoveries + 1, "faults: recovery runs once");
+
+	// without the TIMEOUT hardware a stalled read is aborted by the watchdog on a later interrupt
+	uint32_t timeoutr = mock_i2c1.TIMEOUTR.value;
+	mock_i2c1.TIMEOUTR.value = 0;
+	before = *stats;
+	handler_calls = 0;
+	mock_i2c_inject_fault(I2C1, MOCK_I2C_BUS_TIMEOUT, 1);
+	feed(1000, 100, -50, 25);
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 0 && !i2c_queue_idle(I2C1), "faults: stalled read is pending");
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 0 && stats->timeouts == before.timeouts + 1 && stats->recoveries == before.recoveries,
+	      "faults: watchdog aborts the stalled read");
+	feed(1000, 100, -50, 25);
+	check(stats->timeouts == before.timeouts + 1, "faults: watchdog leaves the pending recovery alone");
+	// the retried read completes after the main loop recovers the bus, then the next sample is read as usual
+	mpu6050_hmc5883l_recover_bus();
+	feed(1000, 100, -50, 25);
+	check(handler_calls == 2 && stats->recoveries == before.recoveries + 1,
+	      "faults: main loop recovers the bus and retries the stalled read");
+	mock_i2c1.TIMEOUTR.value = timeoutr;
+
+	// temperature compensation: bias rises 100 LSB per 1024 raw temperature units
+	struct mpu6050_hmc5883l_calibration table = *calibration;
+	table.gyro_bias_temperature_start = 0;
+	table.gyro_bias_temperature_shift = 10;
+	for(int point = 0; point < MPU6050_HMC5883L_BIAS_POINTS; point++) {
+		table.gyro_bias_table[0][point] = 100 * point;
+		table.gyro_bias_table[1][point] = 0;
+		table.gyro_bias_table[2][point] = 0;
+	}
+	table.gyro_offset[0] = 0;
+	table.gyro_offset_temperature = 0;
+	check(mpu6050_hmc5883l_set_calibration(&table), "temperature: table stored");
+	feed(512, 50, -50, 25);
+	check(last_sample.gyro_x == 0, "temperature: bias interpolated between points");
+	feed(20000, 700, -50, 25);
+	check(last_sample.gyro_x == 0, "temperature: bias held beyond the last point");
+
+	// recalibrating at another temperature shifts the curve
+	mpu6050_hmc5883l_calibrate_gyro();
+	for(int i = 0; i < 128; i++)
+		feed(512, -20, -50, 25);
+	feed(512, -20, -50, 25);
+	check(last_sample.gyro_x == 0, "temperature: recalibrated offset applied");
+	feed(1024, 30, -50, 25);
+	check(last_sample.gyro_x == 0, "temperature: table still applied after recalibrating");
+
+	// scales above 1.0 saturate near full scale instead of wrapping to the opposite sign
+	struct mpu6050_hmc5883l_calibration scaled = *calibration;
+	scaled.accel_scale[0] = MPU6050_HMC5883L_CALIBRATION_ONE * 3 / 2;
+	scaled.accel_scale[1] = MPU6050_HMC5883L_CALIBRATION_ONE * 3 / 2;
+	scaled.magn_soft_iron[0][0] = MPU6050_HMC5883L_CALIBRATION_ONE * 3 / 2;
+	check(mpu6050_hmc5883l_set_calibration(&scaled), "saturation: scales stored");
+	const int16_t full_scale_accel[3] = {30000, -30000, 8192};
+	const int16_t still_gyro[3] = {0, 0, 0};
+	const int16_t full_scale_magn[3] = {-30000, 200, 300};
+	mock_mpu6050_set_sample(full_scale_accel, 512, still_gyro, full_scale_magn);
+	mock_microseconds += 13750;
+	mock_exti_edge(PB7);
+	check(last_sample.accel_x == INT16_MAX && last_sample.accel_y == INT16_MIN && last_sample.magn_x == INT16_MIN,
+	      "saturation: readings clamped to the int16 range");
+	// the x offset measured above is -20, so removing it pushes a reading near full scale past INT16_MAX
+	feed(512, 32760, -50, 25);
+	check(last_sample.gyro_x == INT16_MAX, "saturation: gyro correction clamped to the int16 range");
+
+	// a fitted table is uploaded for all three axes at once, applied right away, and written to flash from the main loop
+	feed(2048, 30, -50, 25);
+	check(last_sample.gyro_y == 0, "upload: no y axis compensation before the upload");
+	int16_t points[3][MPU6050_HMC5883L_BIAS_POINTS];
+	for(int point = 0; point < MPU6050_HMC5883L_BIAS_POINTS; point++) {
+		points[0][point] = 100 * point;
+		points[1][point] = 30 * point;
+		points[2][point] = 0;
+	}
+	uint32_t writes = mock_flash_writes;
+	check(!mpu6050_hmc5883l_set_gyro_bias_table(0, 15, points), "upload: shift checked");
+	check(mpu6050_hmc5883l_set_gyro_bias_table(0, 10, points) && mock_flash_writes == writes, "upload: table accepted");
+	feed(2048, 30, -50, 25);
+	// bias(2048) - bias(512), where the offsets were measured
+	check(last_sample.gyro_y == -45, "upload: table changes the corrected gyro output");
+	check(mpu6050_hmc5883l_save_pending_calibration() && mock_flash_writes == writes + 1, "upload: table written to flash once");
+	boot();
+	feed(2048, 30, -50, 25);
+	check(mpu6050_hmc5883l_get_calibration()->gyro_bias_table[1][7] == 210 && last_sample.gyro_y == -45, "upload: table loaded at boot");
+
+	// benchmark
+	if(benchmark_samples) {
+		uint64_t bus_time = mock_i2c_bus_time_ns(I2C1);
+		struct timespec start, end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for(uint32_t i = 0; i < benchmark_samples; i++)
+			feed(1000 + (i & 1023), 100, -50, 25);
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		double host_ns = ((end.tv_sec - start.tv_sec) * 1e9 + (end.tv_nsec - start.tv_nsec)) / benchmark_samples;
+		double bus_us = (mock_i2c_bus_time_ns(I2C1) - bus_time) / 1000.0 / benchmark_samples;
+		printf("benchmark: %u samples, %.1f ns per sample on the host (driver and models), %.1f us of bus time per sample\n",
+		       benchmark_samples, host_ns, bus_us);
+	}
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+
+}
@@ -0,0 +1,182 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include <math.h>
+#include <float.h>
+#include <time.h>
+#include "replay.h"
+#include "controller.h"
+
+// recorded channels used by the replay, by their names in main.c's telemetry table
+enum REPLAY_COLUMN {
+	ACCEL_X, ACCEL_Y, ACCEL_Z,
+	GYRO_X, GYRO_Y, GYRO_Z,
+	GIMBAL_X, GIMBAL_Y,
+	KNOB_LEFT, KNOB_MIDDLE, KNOB_RIGHT,
+	Q0, Q1, Q2, Q3,
+	INTEGRAL, ERROR,
+	INPUT_COLUMNS,
+	PITCH = INPUT_COLUMNS, SET_POINT, P_SCALAR, PROPORTIONAL, I_SCALAR, D_SCALAR, DERIVATIVE,
+	COLUMN_COUNT
+};
+
+static const char *column_names[COLUMN_COUNT] = {
+	"Accel X", "Accel Y", "Accel Z",
+	"Gyro X", "Gyro Y", "Gyro Z",
+	"Gimbal X", "Gimbal Y",
+	"Knob Left", "Knob Middle", "Knob Right",
+	"Q0", "Q1", "Q2", "Q3",
+	"Integral", "Error",
+	"Pitch", "Set Point", "P Scalar", "Proportional", "I Scalar", "D Scalar", "Derivative"
+};
+
+// outputs compared with the recording, in the order they are reported
+static const int compared_columns[] = {PITCH, SET_POINT, ERROR, P_SCALAR, PROPORTIONAL, I_SCALAR, INTEGRAL, D_SCALAR, DERIVATIVE};
+#define COMPARED_COUNT (sizeof(compared_columns) / sizeof(compared_columns[0]))
+
+static float output_value(const struct controller_outputs &outputs, int column) {
+
+	switch(column) {
+		case PITCH:        return outputs.pitch;
+		case SET_POINT:    return outputs.set_point;
+		case ERROR:        return outputs.error;
+		case P_SCALAR:     return outputs.p_scalar;
+		case PROPORTIONAL: return outputs.proportional;
+		case I_SCALAR:     return outputs.i_scalar;
+		case INTEGRAL:     return outputs.integral;
+		case D_SCALAR:     return outputs.d_scalar;
+		case DERIVATIVE:   return outputs.derivative;
+		default:           return NAN;
+	}
+
+}
+
+bool control_replay(const telemetry_log_reader &log, const replay_options &options, replay_report &report, std::string &error) {
+
+	int channels[COLUMN_COUNT];
+	for(int i = 0; i < COLUMN_COUNT; i++) {
+		channels[i] = log.find_channel(column_names[i]);
+		if(channels[i] < 0) {
+			error = std::string("the log has no \"") + column_names[i] + "\" channel";
+			return false;
+		}
+	}
+
+	// the largest difference that still matches: half a quantization step, and the tolerance
+	double half_step[COLUMN_COUNT];
+	for(int i = 0; i < COLUMN_COUNT; i++) {
+		const struct telemetry_log_channel &channel = log.channel(channels[i]);
+		half_step[i] = (channel.type == TELEMETRY_FLOAT) ? 0.0 : channel.scale * 0.5;
+	}
+
+	report.rows = log.rows();
+	report.replayed = 0;
+	report.skipped = 0;
+	report.resyncs = 0;
+	report.outputs.assign(COMPARED_COUNT, replay_output());
+	for(size_t i = 0; i < COMPARED_COUNT; i++) {
+		report.outputs[i].name = column_names[compared_columns[i]];
+		report.outputs[i].compared = 0;
+		report.outputs[i].mismatches = 0;
+		report.outputs[i].first_mismatch = 0;
+		report.outputs[i].max_difference = 0.0;
+	}
+
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	float row_values[COLUMN_COUNT];
+	float previous_values[COLUMN_COUNT];
+	uint64_t previous_sequence = 0;
+	bool have_previous = false;    // the previous row directly precedes this one
+	bool synced = false;           // the controller's state follows on from the previous row
+
+	for(uint64_t chunk = 0; chunk < log.chunks(); chunk++) {
+
+		// columns are read straight from the mapped chunk
+		const float *columns[COLUMN_COUNT];
+		for(int i = 0; i < COLUMN_COUNT; i++)
+			columns[i] = log.chunk_channel(chunk, channels[i]);
+		const uint64_t *sequences = log.chunk_sequences(chunk);
+		uint64_t first_row = chunk * TELEMETRY_LOG_CHUNK_ROWS;
+
+		for(uint32_t k = 0; k < log.chunk(chunk).rows; k++) {
+
+			for(int i = 0; i < COLUMN_COUNT; i++)
+				row_values[i] = columns[i][k];
+
+			// the controller ran once per sequence number, so after a gap its state is unknown
+			if(have_previous && sequences[k] != previous_sequence + 1)
+				have_previous = synced = false;
+
+			bool inputs_present = true;
+			for(int i = 0; i < Q0; i++)
+				if(isnan(row_values[i]))
+					inputs_present = false;
+
+			if(!inputs_present) {
+				report.skipped++;
+				synced = false;
+			} else if((!synced || options.reseed) && !(have_previous && !isnan(previous_values[Q0]) && !isnan(previous_values[Q1]) &&
+			          !isnan(previous_values[Q2]) && !isnan(previous_values[Q3]) && !isnan(previous_values[INTEGRAL]) &&
+			          !isnan(previous_values[ERROR]))) {
+				// nothing to start from
+				report.skipped++;
+				synced = false;
+			} else {
+
+				if(!synced || options.reseed) {
+					struct controller_state state = {previous_values[Q0], previous_values[Q1], previous_values[Q2], previous_values[Q3],
+					                                 previous_values[INTEGRAL], previous_values[ERROR]};
+					controller_set_state(&state);
+					if(!synced)
+						report.resyncs++;
+					synced = true;
+				}
+
+				struct controller_inputs inputs = {
+					row_values[ACCEL_X], row_values[ACCEL_Y], row_values[ACCEL_Z],
+					row_values[GYRO_X], row_values[GYRO_Y], row_values[GYRO_Z],
+					0.0f, 0.0f, 0.0f,
+					row_values[GIMBAL_X], row_values[GIMBAL_Y],
+					row_values[KNOB_LEFT], row_values[KNOB_MIDDLE], row_values[KNOB_RIGHT]
+				};
+				struct controller_outputs outputs;
+				controller_update(&inputs, &outputs);
+				report.replayed++;
+
+				for(size_t i = 0; i < COMPARED_COUNT; i++) {
+					int column = compared_columns[i];
+					float recorded = row_values[column];
+					if(isnan(recorded))
+						continue;
+					double difference = fabs((double) output_value(outputs, column) - recorded);
+					replay_output &output = report.outputs[i];
+					output.compared++;
+					if(difference > output.max_difference)
+						output.max_difference = difference;
+					// the firmware quantizes in single precision, so a value near a rounding boundary can land a few ulps either way
+					double allowed = half_step[column] ? half_step[column] + 4.0 * FLT_EPSILON * fabs(recorded) : 0.0;
+					if(difference > allowed + options.tolerance * fmax(1.0, fabs(recorded))) {
+						if(output.mismatches++ == 0)
+							output.first_mismatch = first_row + k;
+					}
+				}
+
+			}
+
+			for(int i = 0; i < COLUMN_COUNT; i++)
+				previous_values[i] = row_values[i];
+			previous_sequence = sequences[k];
+			have_previous = true;
+
+		}
+
+	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	report.seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	return true;
+
+}
@@ -0,0 +1,54 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Replays a telemetry log through the firmware's controller (controller.c and MadgwickAHRS.c, compiled for the host):
+// the recorded sensor readings and radio inputs go in, and the pitch, set point, error and PID terms that come out
+// are compared with the recorded ones.
+//
+// The replay starts from the recorded filter quaternion, integral and error of the row before the first replayed row,
+// then carries its own state. After a gap (lost frames, or a row without all of the inputs) it resumes from the recorded
+// state again. Quantized channels match if they are within half a step, float channels must match exactly,
+// and the tolerance (relative to the recorded value, at least 1.0) allows for differences between the target's and the
+// host's math libraries.
+//
+// The controller parameters are not recorded: the replay uses the defaults in controller.c unless they are overridden.
+
+#pragma once
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include "telemetry_log.h"
+
+struct replay_options {
+	double tolerance;            // extra relative difference allowed, 0 = bit-exact for float channels
+	bool reseed;                 // restore the recorded state before every row, so errors can't accumulate
+};
+
+// the comparison of one output with its recorded channel
+struct replay_output {
+	std::string name;
+	uint64_t compared;
+	uint64_t mismatches;
+	uint64_t first_mismatch;     // row
+	double max_difference;
+};
+
+struct replay_report {
+	uint64_t rows;               // rows in the log
+	uint64_t replayed;
+	uint64_t skipped;            // rows without all of the inputs, or without a recorded state to start from
+	uint64_t resyncs;            // times the recorded state was restored, including the start
+	double seconds;              // time spent replaying and comparing
+	std::vector<replay_output> outputs;
+};
+
+/**
+ * Replays a whole log.
+ *
+ * @param log        An open log
+ * @param options    Tolerance and reseeding
+ * @param report     Where the results are written
+ * @param error      Set if the log is missing a channel the replay needs
+ * @returns          true if the log could be replayed (check the report for mismatches)
+ */
+bool control_replay(const telemetry_log_reader &log, const replay_options &options, replay_report &report, std::string &error);
@@ -0,0 +1,283 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Runs f0lib_telemetry natively to produce a telemetry stream, then checks telemetry_decoder against it:
+// values, schema, loss accounting, chunked input and resynchronization after corruption.
+// Finally measures the decoder's throughput.
+//
+// The UART is replaced by a shim that encodes each frame with telemetry_encode_frame() and appends it to the stream.
+//
+// Usage: telemetry_bench [frames] [file]
+// If a file is given, the clean stream is also written to it, for trying out telemetry_record.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <vector>
+#include "telemetry_decoder.h"
+#include "f0lib_uart.h"
+
+static uint32_t failures = 0;
+
+static void check(int condition, const char *description) {
+
+	printf("%s %s\n", condition ? "PASS" : "FAIL", description);
+	if(!condition)
+		failures++;
+
+}
+
+// uart shim //////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+static std::vector<uint8_t> stream;
+static uint8_t frame_buffer[UART_TX_SLOT_SIZE];
+static struct uart_statistics uart_stats;
+static uint32_t drop_every = 0;        // make the "TX ring" drop every nth frame, 0 = never
+
+void* uart_frame_begin(void) {
+
+	return &frame_buffer[4];
+
+}
+
+void uart_frame_end(uint16_t byte_count) {
+
+	if(drop_every && (uart_stats.frames_sent + uart_stats.frames_dropped + 1) % drop_every == 0) {
+		uart_stats.frames_dropped++;
+		return;
+	}
+
+	uint8_t encoded[UART_TX_SLOT_SIZE];
+	size_t length = telemetry_encode_frame(&frame_buffer[4], byte_count, encoded);
+	stream.insert(stream.end(), encoded, encoded + length);
+	uart_stats.frames_sent++;
+	uart_stats.bytes_sent += length;
+
+}
+
+void uart_reset_tx_buffer(void) {
+
+}
+
+uint8_t uart_tx_slots_free(void) {
+
+	return UART_TX_SLOTS - 1;
+
+}
+
+const struct uart_statistics* uart_get_statistics(void) {
+
+	return &uart_stats;
+
+}
+
+// a channel table like the one in main.c /////////////////////////////////////////////////////////////////////////////
+
+#define CHANNELS 31
+
+static float values[CHANNELS];
+static struct telemetry_channel channels[CHANNELS];
+static char names[CHANNELS][16];
+
+static void setup_channels(void) {
+
+	for(int i = 0; i < CHANNELS; i++) {
+		snprintf(names[i], sizeof(names[i]), "Channel %d", i);
+		channels[i].name = names[i];
+		channels[i].unit = (i % 3 == 0) ? "G" : "rad/s";
+		channels[i].type = (i % 10 == 9) ? TELEMETRY_FLOAT : (i % 10 == 8) ? TELEMETRY_INT8 : TELEMETRY_INT16;
+		channels[i].scale = (channels[i].type == TELEMETRY_INT8) ? 0.5f : 0.001f;
+		channels[i].value = &values[i];
+	}
+	telemetry_setup(channels, CHANNELS);
+
+}
+
+// a deterministic value for each channel and frame, within the range of the channel's type
+static float expected_value(int channel, uint32_t frame) {
+
+	float phase = frame * 0.01f + channel;
+	return (channels[channel].type == TELEMETRY_INT8) ? 40.0f * sinf(phase) : 30.0f * sinf(phase);
+
+}
+
+static void generate(uint32_t frames, uint32_t first_timestamp) {
+
+	for(uint32_t frame = 0; frame < frames; frame++) {
+		for(int i = 0; i < CHANNELS; i++)
+			values[i] = expected_value(i, frame);
+		telemetry_send(first_timestamp + frame * 13750);
+	}
+
+}
+
+static double seconds_since(const struct timespec &start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint32_t frames = (argc > 1) ? strtoul(argv[1], NULL, 0) : 100000;
+	if(frames < 1000)
+		frames = 1000;
+
+	setup_channels();
+	generate(frames, 1000);
+
+	// decode in one piece, checking every value
+	telemetry_decoder decoder;
+	uint32_t samples = 0;
+	uint32_t bad_values = 0;
+	uint32_t bad_timestamps = 0;
+	uint32_t frame = 0;
+	decoder.on_sample = [&](const telemetry_sample &sample) {
+		// the sequence number starts at 0, so it is the frame number once wrap-arounds are added back
+		frame += (uint16_t) (sample.sequence - frame);
+		if(sample.timestamp != 1000 + frame * 13750)
+			bad_timestamps++;
+		for(int i = 0; i < CHANNELS; i++) {
+			if(!(sample.mask & (1u << i)))
+				continue;
+			double tolerance = (channels[i].type == TELEMETRY_FLOAT) ? 0.0 : channels[i].scale * 0.5 + 1e-6;
+			if(fabs(sample.values[i] - expected_value(i, frame)) > tolerance)
+				bad_values++;
+		}
+		samples++;
+	};
+	decoder.feed(stream.data(), stream.size());
+	const telemetry_decoder_statistics &stats = decoder.statistics();
+
+	check(decoder.schema_complete() && decoder.channels()[9].type == TELEMETRY_FLOAT && decoder.channels()[4].name == "Channel 4" &&
+	      decoder.channels()[3].unit == "G" && decoder.channels()[8].scale == 0.5f, "schema received");
+	check(stats.crc_errors == 0 && stats.framing_errors == 0 && stats.frames == uart_stats.frames_sent, "every frame decoded");
+	// each descriptor precedes a data frame, so all but the last of those data frames arrive before the schema is complete
+	check(samples == frames - (CHANNELS - 1) && stats.unknown_layout == CHANNELS - 1, "every data frame after the schema delivered");
+	check(bad_values == 0 && bad_timestamps == 0, "values and timestamps match what was sent");
+	check(stats.lost_frames == 0 && stats.uart_drops == 0, "no loss reported");
+
+	// the same stream fed in random pieces
+	telemetry_decoder chunked;
+	uint32_t chunked_samples = 0;
+	chunked.on_sample = [&](const telemetry_sample &sample) { chunked_samples++; };
+	srand(1);
+	for(size_t offset = 0; offset < stream.size(); ) {
+		size_t count = 1 + rand() % 300;
+		if(offset + count > stream.size())
+			count = stream.size() - offset;
+		chunked.feed(&stream[offset], count);
+		offset += count;
+	}
+	check(chunked_samples == samples && chunked.statistics().frames == stats.frames, "chunked input gives the same result");
+
+	// decimation and disabled channels
+	std::vector<uint8_t> clean = stream;
+	stream.clear();
+	telemetry_set_decimation(0, 0);
+	telemetry_set_decimation(1, 4);
+	generate(1000, 1000);
+	uint32_t with_channel_0 = 0;
+	uint32_t with_channel_1 = 0;
+	decoder.on_sample = [&](const telemetry_sample &sample) {
+		with_channel_0 += (sample.mask & 1) ? 1 : 0;
+		with_channel_1 += (sample.mask & 2) ? 1 : 0;
+	};
+	decoder.feed(stream.data(), stream.size());
+	check(with_channel_0 == 0 && with_channel_1 == 250, "decimation");
+	telemetry_set_decimation(0, 1);
+	telemetry_set_decimation(1, 1);
+
+	// queued acknowledgements all go out before the next data frame, and histograms one after each data frame
+	stream.clear();
+	struct telemetry_histogram spread = {7, 100, -200, {0}};
+	struct telemetry_histogram empty = {8, 1, 0, {0}};
+	for(int32_t value = -500; value < 2000; value += 10)
+		telemetry_histogram_add(&spread, value);
+	check(telemetry_send_histogram(&spread) && telemetry_send_histogram(&empty), "histograms queued");
+	telemetry_acknowledge(5, 1);
+	telemetry_acknowledge(6, 0);
+	generate(3, 1000);
+	std::vector<telemetry_histogram_frame> histograms;
+	std::vector<uint8_t> acks;
+	decoder.on_ack = [&](uint8_t command, uint8_t result) { acks.push_back(command); acks.push_back(result); };
+	decoder.on_histogram = [&](const telemetry_histogram_frame &histogram) { histograms.push_back(histogram); };
+	decoder.feed(stream.data(), stream.size());
+	check(acks == std::vector<uint8_t>({5, 1, 6, 0}), "acknowledgements queued in order");
+	check(histograms.size() == 2 && histograms[0].id == 7 && histograms[1].id == 8 &&
+	      histograms[0].bin_width == 100 && histograms[0].first_bin == -200 && histograms[0].counts.size() == TELEMETRY_HISTOGRAM_BINS &&
+	      histograms[0].counts[0] == 40 && histograms[0].counts[1] == 10 && histograms[0].counts[15] == 70 &&
+	      histograms[1].counts[0] == 0, "histograms decoded, with out of range values in the end bins");
+
+	// frames dropped by the firmware are reported as lost, and attributed to the firmware
+	stream.clear();
+	drop_every = 100;
+	generate(10000, 1000);
+	drop_every = 0;
+	telemetry_decoder lossy;
+	lossy.feed(stream.data(), stream.size());
+	printf("loss: %u frames dropped by the firmware, %llu data frames reported lost\n",
+	       uart_stats.frames_dropped, (unsigned long long) lossy.statistics().lost_frames);
+	check(lossy.statistics().lost_frames >= 90 && lossy.statistics().lost_frames <= lossy.statistics().uart_drops &&
+	      lossy.statistics().uart_drops <= uart_stats.frames_dropped, "firmware drops counted");
+
+	// an empty channel table is rejected, and the previous one stays in use
+	stream.clear();
+	telemetry_setup(channels, 0);
+	generate(2 * TELEMETRY_DESCRIPTOR_INTERVAL, 1000);
+	telemetry_decoder unchanged;
+	unchanged.feed(stream.data(), stream.size());
+	check(unchanged.statistics().data_frames == 2 * TELEMETRY_DESCRIPTOR_INTERVAL && unchanged.channels().size() == CHANNELS,
+	      "an empty channel table is rejected");
+
+	// corrupted bytes are caught by the CRC, and decoding resumes at the next frame
+	std::vector<uint8_t> corrupted = clean;
+	uint32_t corruptions = 0;
+	for(size_t offset = 1000; offset < corrupted.size(); offset += 997) {
+		corrupted[offset] ^= 1 << (offset % 8);
+		corruptions++;
+	}
+	telemetry_decoder resync;
+	uint32_t resync_samples = 0;
+	resync.on_sample = [&](const telemetry_sample &sample) { resync_samples++; };
+	resync.feed(corrupted.data(), corrupted.size());
+	const telemetry_decoder_statistics &resync_stats = resync.statistics();
+	printf("corruption: %u bytes flipped, %llu CRC errors, %llu framing errors, %llu frames lost, %u of %u samples delivered\n",
+	       corruptions, (unsigned long long) resync_stats.crc_errors, (unsigned long long) resync_stats.framing_errors,
+	       (unsigned long long) resync_stats.lost_frames, resync_samples, samples);
+	check(resync_stats.crc_errors + resync_stats.framing_errors >= corruptions * 9 / 10 &&
+	      resync_samples + 2 * corruptions >= samples, "corruption detected and decoding resumes");
+
+	if(argc > 2) {
+		FILE *file = fopen(argv[2], "wb");
+		if(file) {
+			fwrite(clean.data(), 1, clean.size(), file);
+			fclose(file);
+		}
+	}
+
+	// throughput
+	struct timespec start;
+	uint32_t passes = 0;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	do {
+		telemetry_decoder bench;
+		uint64_t sum = 0;
+		bench.on_sample = [&](const telemetry_sample &sample) { sum += sample.sequence; };
+		bench.feed(clean.data(), clean.size());
+		passes++;
+	} while(seconds_since(start) < 1.0);
+	double elapsed = seconds_since(start);
+	double megabytes = clean.size() * (double) passes / 1e6;
+	printf("benchmark: %.1f MB/s, %.0f frames/s (%.0f bytes per frame, %.0fx the link's frame rate at 921600 baud)\n",
+	       megabytes / elapsed, stats.frames * (double) passes / elapsed, clean.size() / (double) stats.frames,
+	       (stats.frames * (double) passes / elapsed) / (92160.0 / (clean.size() / (double) stats.frames)));
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+
+}
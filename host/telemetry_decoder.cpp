@@ -0,0 +1,284 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include <string.h>
+#include <math.h>
+#include "telemetry_decoder.h"
+
+// CRC-16/CCITT-FALSE table, built on first use
+static uint16_t crc16_table[256];
+
+static void build_crc16_table(void) {
+
+	for(uint32_t byte = 0; byte < 256; byte++) {
+		uint16_t crc = byte << 8;
+		for(int bit = 0; bit < 8; bit++)
+			crc = (crc & 0x8000) ? (crc << 1) ^ 0x1021 : (crc << 1);
+		crc16_table[byte] = crc;
+	}
+
+}
+
+uint16_t telemetry_crc16(uint16_t crc, const uint8_t *bytes, size_t count) {
+
+	if(crc16_table[1] == 0)
+		build_crc16_table();
+
+	while(count--)
+		crc = (crc << 8) ^ crc16_table[(crc >> 8) ^ *bytes++];
+
+	return crc;
+
+}
+
+size_t telemetry_encode_frame(const uint8_t *payload, size_t length, uint8_t *out) {
+
+	if(length > 252)
+		return 0;
+
+	uint8_t data[254];
+	memcpy(data, payload, length);
+	uint16_t crc = telemetry_crc16(0xFFFF, payload, length);
+	data[length++] = crc >> 8;
+	data[length++] = crc & 0xFF;
+
+	size_t code = 0;
+	size_t n = 1;
+	for(size_t j = 0; j < length; j++) {
+		if(data[j] == 0) {
+			out[code] = n - code;
+			code = n++;
+		} else {
+			out[n++] = data[j];
+		}
+	}
+	out[code] = n - code;
+	out[n++] = 0;
+	return n;
+
+}
+
+telemetry_decoder::telemetry_decoder() : frame_length(0), frame_overflow(false), have_sequence(false), last_sequence(0), last_dropped(0) {
+
+	memset(&stats, 0, sizeof(stats));
+	telemetry_crc16(0xFFFF, 0, 0);
+
+}
+
+bool telemetry_decoder::schema_complete() const {
+
+	if(schema.empty())
+		return false;
+	for(const telemetry_channel_info &channel : schema)
+		if(!channel.known)
+			return false;
+	return true;
+
+}
+
+void telemetry_decoder::feed(const uint8_t *bytes, size_t count) {
+
+	stats.bytes += count;
+	const uint8_t *end = bytes + count;
+
+	while(bytes < end) {
+
+		// copy up to the next delimiter
+		const uint8_t *delimiter = (const uint8_t*) memchr(bytes, 0, end - bytes);
+		size_t run = (delimiter ? delimiter : end) - bytes;
+		if(frame_length + run > MAX_FRAME) {
+			frame_overflow = true;
+			frame_length = 0;
+		} else {
+			memcpy(&frame[frame_length], bytes, run);
+			frame_length += run;
+		}
+		bytes += run;
+
+		if(!delimiter)
+			break;
+		bytes++;
+
+		if(frame_overflow)
+			stats.framing_errors++;
+		else if(frame_length > 0)
+			process_frame(frame, frame_length);
+		frame_length = 0;
+		frame_overflow = false;
+
+	}
+
+}
+
+void telemetry_decoder::process_frame(const uint8_t *encoded, size_t length) {
+
+	// COBS decode
+	size_t r = 0;
+	size_t w = 0;
+	while(r < length) {
+		uint8_t code = encoded[r++];
+		if(r + code - 1 > length) {
+			stats.framing_errors++;
+			return;
+		}
+		memcpy(&decoded[w], &encoded[r], code - 1);
+		w += code - 1;
+		r += code - 1;
+		if(code < 0xFF && r < length)
+			decoded[w++] = 0;
+	}
+
+	if(w < 3) {
+		stats.framing_errors++;
+		return;
+	}
+	if(telemetry_crc16(0xFFFF, decoded, w) != 0) {
+		stats.crc_errors++;
+		return;
+	}
+	stats.frames++;
+
+	size_t payload_length = w - 2;
+	switch(decoded[0]) {
+		case TELEMETRY_DATA_FRAME:
+			stats.data_frames++;
+			process_data(decoded, payload_length);
+			break;
+		case TELEMETRY_DESCRIPTOR_FRAME:
+			stats.descriptor_frames++;
+			process_descriptor(decoded, payload_length);
+			break;
+		case TELEMETRY_ACK_FRAME:
+			stats.ack_frames++;
+			if(payload_length >= 3 && on_ack)
+				on_ack(decoded[1], decoded[2]);
+			break;
+		case TELEMETRY_HISTOGRAM_FRAME:
+			stats.histogram_frames++;
+			process_histogram(decoded, payload_length);
+			break;
+		default:
+			break;
+	}
+
+}
+
+void telemetry_decoder::process_histogram(const uint8_t *payload, size_t length) {
+
+	// type, id, bin count, bin width, first bin, counts
+	if(length < 9 || length != 9 + 2 * (size_t) payload[2]) {
+		stats.framing_errors++;
+		return;
+	}
+	if(!on_histogram)
+		return;
+
+	telemetry_histogram_frame histogram;
+	histogram.id = payload[1];
+	memcpy(&histogram.bin_width, &payload[3], sizeof(uint16_t));
+	memcpy(&histogram.first_bin, &payload[5], sizeof(int32_t));
+	histogram.counts.resize(payload[2]);
+	for(size_t i = 0; i < histogram.counts.size(); i++)
+		memcpy(&histogram.counts[i], &payload[9 + 2 * i], sizeof(uint16_t));
+	on_histogram(histogram);
+
+}
+
+void telemetry_decoder::process_descriptor(const uint8_t *payload, size_t length) {
+
+	// type, index, count, channel type, decimation, scale, name, unit
+	if(length < 11 || payload[1] >= payload[2] || payload[2] > TELEMETRY_MAX_CHANNELS) {
+		stats.framing_errors++;
+		return;
+	}
+
+	uint8_t index = payload[1];
+	uint8_t count = payload[2];
+	if(schema.size() != count) {
+		schema.assign(count, telemetry_channel_info());
+		values.assign(count, NAN);
+	}
+
+	const char *name = (const char*) &payload[9];
+	const char *unit = (const char*) memchr(name, 0, length - 9);
+	if(!unit || !memchr(unit + 1, 0, (const char*) payload + length - (unit + 1))) {
+		stats.framing_errors++;
+		return;
+	}
+	unit++;
+
+	telemetry_channel_info &channel = schema[index];
+	channel.known = true;
+	channel.type = payload[3];
+	channel.decimation = payload[4];
+	memcpy(&channel.scale, &payload[5], sizeof(float));
+	channel.name = name;
+	channel.unit = unit;
+
+	if(on_descriptor)
+		on_descriptor(index);
+
+}
+
+void telemetry_decoder::process_data(const uint8_t *payload, size_t length) {
+
+	// type, sequence, timestamp, frames dropped, mask, values
+	if(length < 13) {
+		stats.framing_errors++;
+		return;
+	}
+
+	telemetry_sample sample;
+	sample.sequence = payload[1] | (payload[2] << 8);
+	memcpy(&sample.timestamp, &payload[3], 4);
+	sample.frames_dropped = payload[7] | (payload[8] << 8);
+	memcpy(&sample.mask, &payload[9], 4);
+
+	// loss accounting works even when the values can't be decoded yet
+	if(have_sequence) {
+		stats.lost_frames += (uint16_t) (sample.sequence - last_sequence - 1);
+		stats.uart_drops += (uint16_t) (sample.frames_dropped - last_dropped);
+	}
+	have_sequence = true;
+	last_sequence = sample.sequence;
+	last_dropped = sample.frames_dropped;
+
+	size_t n = 13;
+	for(size_t channel = 0; channel < TELEMETRY_MAX_CHANNELS; channel++) {
+
+		if(!(sample.mask & ((uint32_t) 1 << channel)))
+			continue;
+		if(channel >= schema.size() || !schema[channel].known) {
+			stats.unknown_layout++;
+			return;
+		}
+
+		const telemetry_channel_info &info = schema[channel];
+		if(info.type == TELEMETRY_INT8 && n + 1 <= length) {
+			values[channel] = (int8_t) payload[n] * (double) info.scale;
+			n += 1;
+		} else if(info.type == TELEMETRY_INT16 && n + 2 <= length) {
+			values[channel] = (int16_t) (payload[n] | (payload[n + 1] << 8)) * (double) info.scale;
+			n += 2;
+		} else if(info.type == TELEMETRY_FLOAT && n + 4 <= length) {
+			float value;
+			memcpy(&value, &payload[n], 4);
+			values[channel] = value;
+			n += 4;
+		} else {
+			stats.framing_errors++;
+			return;
+		}
+
+	}
+
+	if(n != length) {
+		stats.framing_errors++;
+		return;
+	}
+
+	sample.values = values.data();
+	if(on_sample)
+		on_sample(sample);
+
+}
@@ -0,0 +1,119 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Incremental decoder for the telemetry stream sent by f0lib_telemetry over f0lib_uart:
+// frames are a payload and its CRC-16/CCITT-FALSE (big-endian), COBS encoded and terminated by 0x00.
+// Bytes can be fed in pieces of any size, and the decoder resynchronizes at the next 0x00 after any error.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <functional>
+#include "f0lib_telemetry.h"
+
+// one channel of the schema, from its descriptor frame
+struct telemetry_channel_info {
+	bool known;                 // a descriptor has been received
+	std::string name;
+	std::string unit;
+	float scale;
+	uint8_t type;               // enum TELEMETRY_TYPE
+	uint8_t decimation;
+};
+
+// one decoded data frame
+struct telemetry_sample {
+	uint16_t sequence;
+	uint32_t timestamp;         // microseconds
+	uint16_t frames_dropped;    // the UART's drop counter (low 16 bits)
+	uint32_t mask;              // channels present in this frame
+	const double *values;       // indexed by channel, only valid for channels in the mask
+};
+
+// one decoded histogram frame
+struct telemetry_histogram_frame {
+	uint8_t id;
+	uint16_t bin_width;
+	int32_t first_bin;          // lower edge of bin 0
+	std::vector<uint16_t> counts;
+};
+
+struct telemetry_decoder_statistics {
+	uint64_t bytes;
+	uint64_t frames;            // frames with a valid CRC
+	uint64_t data_frames;
+	uint64_t descriptor_frames;
+	uint64_t ack_frames;
+	uint64_t histogram_frames;
+	uint64_t crc_errors;
+	uint64_t framing_errors;    // bad COBS encoding, too short or too long
+	uint64_t unknown_layout;    // data frames that arrived before the descriptors of their channels
+	uint64_t lost_frames;       // gaps in the sequence numbers
+	uint64_t uart_drops;        // frames the firmware discarded because its TX ring was full
+};
+
+class telemetry_decoder {
+
+public:
+
+	// called for every decoded data frame, descriptor, acknowledgement and histogram
+	std::function<void(const telemetry_sample &sample)> on_sample;
+	std::function<void(uint8_t channel)> on_descriptor;
+	std::function<void(uint8_t command, uint8_t result)> on_ack;
+	std::function<void(const telemetry_histogram_frame &histogram)> on_histogram;
+
+	telemetry_decoder();
+
+	/**
+	 * Decodes more of the stream. Callbacks are called from here.
+	 */
+	void feed(const uint8_t *bytes, size_t count);
+
+	const std::vector<telemetry_channel_info>& channels() const { return schema; }
+	const telemetry_decoder_statistics& statistics() const { return stats; }
+
+	/**
+	 * @returns   true once a descriptor has been received for every channel
+	 */
+	bool schema_complete() const;
+
+private:
+
+	static const size_t MAX_FRAME = 1024;
+
+	void process_frame(const uint8_t *encoded, size_t length);
+	void process_data(const uint8_t *payload, size_t length);
+	void process_descriptor(const uint8_t *payload, size_t length);
+	void process_histogram(const uint8_t *payload, size_t length);
+
+	std::vector<telemetry_channel_info> schema;
+	std::vector<double> values;
+	uint8_t frame[MAX_FRAME];
+	size_t frame_length;
+	bool frame_overflow;
+	uint8_t decoded[MAX_FRAME];
+	bool have_sequence;
+	uint16_t last_sequence;
+	uint16_t last_dropped;
+	telemetry_decoder_statistics stats;
+
+};
+
+/**
+ * Calculates a CRC-16/CCITT-FALSE, the same as uart_crc16() in the firmware.
+ *
+ * @param crc     0xFFFF, or the result of the previous call
+ */
+uint16_t telemetry_crc16(uint16_t crc, const uint8_t *bytes, size_t count);
+
+/**
+ * Encodes a payload the way uart_frame_end() does, for tests and for sending commands to the robot.
+ *
+ * @param payload   Payload, at most 252 bytes
+ * @param length    Size of the payload
+ * @param out       Destination, with room for length + 4 bytes
+ * @returns         Number of bytes written, including the 0x00 delimiter, or 0 if the payload is too long
+ */
+size_t telemetry_encode_frame(const uint8_t *payload, size_t length, uint8_t *out);
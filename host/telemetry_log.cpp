@@ -0,0 +1,358 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include <string.h>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "telemetry_log.h"
+
+static_assert(sizeof(struct telemetry_log_header) <= TELEMETRY_LOG_HEADER_SIZE, "log header must fit in its page");
+static_assert(sizeof(struct telemetry_log_chunk) == 64, "chunk header must keep the columns 8-byte aligned");
+
+size_t telemetry_log_chunk_size(uint32_t chunk_rows, uint32_t channel_count) {
+
+	size_t size = sizeof(struct telemetry_log_chunk) + chunk_rows * (2 * sizeof(uint64_t) + channel_count * sizeof(float));
+	return (size + TELEMETRY_LOG_PAGE_SIZE - 1) / TELEMETRY_LOG_PAGE_SIZE * TELEMETRY_LOG_PAGE_SIZE;
+
+}
+
+// column offsets within a chunk
+static size_t timestamps_offset(uint32_t chunk_rows) {
+
+	return sizeof(struct telemetry_log_chunk);
+
+}
+
+static size_t sequences_offset(uint32_t chunk_rows) {
+
+	return sizeof(struct telemetry_log_chunk) + chunk_rows * sizeof(uint64_t);
+
+}
+
+static size_t channel_offset(uint32_t chunk_rows, uint32_t channel) {
+
+	return sizeof(struct telemetry_log_chunk) + chunk_rows * (2 * sizeof(uint64_t) + channel * sizeof(float));
+
+}
+
+static void copy_schema(struct telemetry_log_header &header, const std::vector<telemetry_channel_info> &schema) {
+
+	for(size_t i = 0; i < schema.size(); i++) {
+		struct telemetry_log_channel &channel = header.channels[i];
+		memset(&channel, 0, sizeof(channel));
+		strncpy(channel.name, schema[i].name.c_str(), sizeof(channel.name) - 1);
+		strncpy(channel.unit, schema[i].unit.c_str(), sizeof(channel.unit) - 1);
+		channel.scale = schema[i].scale;
+		channel.type = schema[i].type;
+		channel.decimation = schema[i].decimation;
+	}
+
+}
+
+// writer //////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+telemetry_log_writer::telemetry_log_writer() : file(NULL), chunk_rows_used(0), chunk_count(0), total_rows(0), have_previous(false),
+                                               previous_timestamp(0), previous_sequence(0), timestamp(0), sequence(0) {
+
+	memset(&header, 0, sizeof(header));
+
+}
+
+telemetry_log_writer::~telemetry_log_writer() {
+
+	close();
+
+}
+
+bool telemetry_log_writer::open(const char *path, const std::vector<telemetry_channel_info> &schema) {
+
+	if(file || schema.empty() || schema.size() > TELEMETRY_MAX_CHANNELS)
+		return false;
+
+	file = fopen(path, "wb");
+	if(!file)
+		return false;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TELEMETRY_LOG_MAGIC, sizeof(TELEMETRY_LOG_MAGIC));
+	header.version = TELEMETRY_LOG_VERSION;
+	header.header_size = TELEMETRY_LOG_HEADER_SIZE;
+	header.chunk_rows = TELEMETRY_LOG_CHUNK_ROWS;
+	header.chunk_size = telemetry_log_chunk_size(header.chunk_rows, schema.size());
+	header.channel_count = schema.size();
+	copy_schema(header, schema);
+
+	uint8_t page[TELEMETRY_LOG_HEADER_SIZE] = {0};
+	memcpy(page, &header, sizeof(header));
+	if(fwrite(page, sizeof(page), 1, file) != 1) {
+		close();
+		return false;
+	}
+
+	chunk.assign(header.chunk_size, 0);
+	chunk_rows_used = 0;
+	chunk_count = 0;
+	total_rows = 0;
+	have_previous = false;
+	return true;
+
+}
+
+bool telemetry_log_writer::update_schema(const std::vector<telemetry_channel_info> &schema) {
+
+	if(!file || schema.size() != header.channel_count)
+		return false;
+
+	copy_schema(header, schema);
+	bool success = fseek(file, 0, SEEK_SET) == 0 && fwrite(&header, sizeof(header), 1, file) == 1;
+	fseek(file, 0, SEEK_END);
+	return success;
+
+}
+
+bool telemetry_log_writer::append(const telemetry_sample &sample) {
+
+	if(!file)
+		return false;
+
+	// unwrap the timestamp and sequence number
+	if(have_previous) {
+		timestamp += (uint32_t) (sample.timestamp - previous_timestamp);
+		sequence += (uint16_t) (sample.sequence - previous_sequence);
+	} else {
+		timestamp = sample.timestamp;
+		sequence = sample.sequence;
+		have_previous = true;
+	}
+	previous_timestamp = sample.timestamp;
+	previous_sequence = sample.sequence;
+
+	uint32_t row = chunk_rows_used;
+	uint8_t *base = chunk.data();
+	((uint64_t*) (base + timestamps_offset(header.chunk_rows)))[row] = timestamp;
+	((uint64_t*) (base + sequences_offset(header.chunk_rows)))[row] = sequence;
+	for(uint32_t channel = 0; channel < header.channel_count; channel++) {
+		float value = (sample.mask & ((uint32_t) 1 << channel)) ? (float) sample.values[channel] : NAN;
+		((float*) (base + channel_offset(header.chunk_rows, channel)))[row] = value;
+	}
+
+	chunk_rows_used++;
+	total_rows++;
+	if(chunk_rows_used == header.chunk_rows)
+		return write_chunk();
+	return true;
+
+}
+
+bool telemetry_log_writer::write_chunk() {
+
+	uint8_t *base = chunk.data();
+	const uint64_t *timestamps = (const uint64_t*) (base + timestamps_offset(header.chunk_rows));
+	const uint64_t *sequences = (const uint64_t*) (base + sequences_offset(header.chunk_rows));
+
+	struct telemetry_log_chunk info;
+	memset(&info, 0, sizeof(info));
+	info.magic = TELEMETRY_LOG_CHUNK_MAGIC;
+	info.rows = chunk_rows_used;
+	info.first_timestamp = timestamps[0];
+	info.last_timestamp = timestamps[chunk_rows_used - 1];
+	info.first_sequence = sequences[0];
+	info.last_sequence = sequences[chunk_rows_used - 1];
+	memcpy(base, &info, sizeof(info));
+
+	bool success = fwrite(base, chunk.size(), 1, file) == 1;
+	memset(base, 0, chunk.size());
+	chunk_rows_used = 0;
+	chunk_count++;
+	return success;
+
+}
+
+bool telemetry_log_writer::close() {
+
+	if(!file)
+		return true;
+
+	bool success = true;
+	if(chunk_rows_used > 0)
+		success = write_chunk();
+	if(fclose(file) != 0)
+		success = false;
+	file = NULL;
+	return success;
+
+}
+
+// reader //////////////////////////////////////////////////////////////////////////////////////////////////////////////
+
+telemetry_log_reader::telemetry_log_reader() : map(NULL), map_size(0), header(NULL), chunk_count(0), total_rows(0) {
+
+}
+
+telemetry_log_reader::~telemetry_log_reader() {
+
+	close();
+
+}
+
+bool telemetry_log_reader::open(const char *path) {
+
+	close();
+
+	int fd = ::open(path, O_RDONLY);
+	if(fd < 0)
+		return false;
+	struct stat status;
+	if(fstat(fd, &status) != 0 || status.st_size < TELEMETRY_LOG_HEADER_SIZE) {
+		::close(fd);
+		return false;
+	}
+	void *address = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	::close(fd);
+	if(address == MAP_FAILED)
+		return false;
+	map = (const uint8_t*) address;
+	map_size = status.st_size;
+	header = (const struct telemetry_log_header*) map;
+
+	if(memcmp(header->magic, TELEMETRY_LOG_MAGIC, sizeof(TELEMETRY_LOG_MAGIC)) != 0 || header->version != TELEMETRY_LOG_VERSION ||
+	   header->header_size != TELEMETRY_LOG_HEADER_SIZE || header->chunk_rows == 0 || header->channel_count == 0 ||
+	   header->channel_count > TELEMETRY_MAX_CHANNELS ||
+	   header->chunk_size != telemetry_log_chunk_size(header->chunk_rows, header->channel_count)) {
+		close();
+		return false;
+	}
+
+	// a chunk cut short (the recorder was killed while writing it) is ignored, as are trailing chunks that were never filled in
+	chunk_count = (map_size - TELEMETRY_LOG_HEADER_SIZE) / header->chunk_size;
+	while(chunk_count > 0 && (chunk(chunk_count - 1).magic != TELEMETRY_LOG_CHUNK_MAGIC || chunk(chunk_count - 1).rows == 0))
+		chunk_count--;
+	total_rows = chunk_count ? (chunk_count - 1) * header->chunk_rows + chunk(chunk_count - 1).rows : 0;
+
+	// the log is usually read front to back, one column at a time
+	madvise((void*) map, map_size, MADV_SEQUENTIAL);
+	return true;
+
+}
+
+void telemetry_log_reader::close() {
+
+	if(map)
+		munmap((void*) map, map_size);
+	map = NULL;
+	map_size = 0;
+	header = NULL;
+	chunk_count = 0;
+	total_rows = 0;
+
+}
+
+int telemetry_log_reader::find_channel(const char *name) const {
+
+	for(uint32_t i = 0; i < header->channel_count; i++)
+		if(strncmp(header->channels[i].name, name, sizeof(header->channels[i].name)) == 0)
+			return i;
+	return -1;
+
+}
+
+const struct telemetry_log_chunk& telemetry_log_reader::chunk(uint64_t index) const {
+
+	return *(const struct telemetry_log_chunk*) (map + TELEMETRY_LOG_HEADER_SIZE + index * header->chunk_size);
+
+}
+
+const uint64_t* telemetry_log_reader::chunk_timestamps(uint64_t index) const {
+
+	return (const uint64_t*) ((const uint8_t*) &chunk(index) + timestamps_offset(header->chunk_rows));
+
+}
+
+const uint64_t* telemetry_log_reader::chunk_sequences(uint64_t index) const {
+
+	return (const uint64_t*) ((const uint8_t*) &chunk(index) + sequences_offset(header->chunk_rows));
+
+}
+
+const float* telemetry_log_reader::chunk_channel(uint64_t index, uint32_t channel) const {
+
+	return (const float*) ((const uint8_t*) &chunk(index) + channel_offset(header->chunk_rows, channel));
+
+}
+
+uint64_t telemetry_log_reader::find(uint64_t time) const {
+
+	if(total_rows == 0 || time > chunk(chunk_count - 1).last_timestamp)
+		return total_rows;
+
+	// the first chunk that ends at or after the time
+	uint64_t low = 0;
+	uint64_t high = chunk_count - 1;
+	while(low < high) {
+		uint64_t middle = (low + high) / 2;
+		if(chunk(middle).last_timestamp < time)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+
+	// then the first row in that chunk
+	const uint64_t *timestamps = chunk_timestamps(low);
+	uint32_t first = 0;
+	uint32_t last = chunk(low).rows - 1;
+	while(first < last) {
+		uint32_t middle = (first + last) / 2;
+		if(timestamps[middle] < time)
+			first = middle + 1;
+		else
+			last = middle;
+	}
+	return low * header->chunk_rows + first;
+
+}
+
+uint64_t telemetry_log_reader::timestamp(uint64_t row) const {
+
+	return chunk_timestamps(row / header->chunk_rows)[row % header->chunk_rows];
+
+}
+
+uint64_t telemetry_log_reader::sequence(uint64_t row) const {
+
+	return chunk_sequences(row / header->chunk_rows)[row % header->chunk_rows];
+
+}
+
+float telemetry_log_reader::value(uint32_t channel, uint64_t row) const {
+
+	return chunk_channel(row / header->chunk_rows, channel)[row % header->chunk_rows];
+
+}
+
+uint64_t telemetry_log_reader::read(uint32_t channel, uint64_t first_row, uint64_t count, float *values, uint64_t *timestamps) const {
+
+	if(first_row >= total_rows || channel >= header->channel_count)
+		return 0;
+	if(count > total_rows - first_row)
+		count = total_rows - first_row;
+
+	uint64_t copied = 0;
+	while(copied < count) {
+		uint64_t row = first_row + copied;
+		uint64_t index = row / header->chunk_rows;
+		uint32_t offset = row % header->chunk_rows;
+		uint64_t n = header->chunk_rows - offset;
+		if(n > count - copied)
+			n = count - copied;
+		if(values)
+			memcpy(&values[copied], &chunk_channel(index, channel)[offset], n * sizeof(float));
+		if(timestamps)
+			memcpy(&timestamps[copied], &chunk_timestamps(index)[offset], n * sizeof(uint64_t));
+		copied += n;
+	}
+	return copied;
+
+}
@@ -0,0 +1,182 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// A single-file, column-oriented telemetry log that can be memory-mapped and read without parsing.
+//
+// The file is a 4 KB header followed by fixed-size chunks, so chunk n is at TELEMETRY_LOG_HEADER_SIZE + n * chunk_size.
+// Each chunk holds up to chunk_rows samples as separate columns:
+//
+//     struct telemetry_log_chunk                     64 bytes, also the chunk's entry in the time index
+//     uint64_t timestamps[chunk_rows]                microseconds, unwrapped (the firmware's uint32 wraps every 71 minutes)
+//     uint64_t sequences[chunk_rows]                 frame sequence numbers, unwrapped
+//     float    channel_0[chunk_rows]                 NaN for samples that didn't include the channel
+//     float    channel_1[chunk_rows]
+//     ...
+//     padding to a multiple of 4 KB
+//
+// Only the last chunk may have fewer than chunk_rows rows. Everything is little-endian.
+// The chunk headers form a sparse index: seeking to a time is a binary search over the chunk headers,
+// then over one chunk's timestamps. Scanning one channel touches only that channel's pages.
+
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string>
+#include <vector>
+#include "telemetry_decoder.h"
+
+#define TELEMETRY_LOG_MAGIC        "F0TLOG1"
+#define TELEMETRY_LOG_VERSION      1
+#define TELEMETRY_LOG_HEADER_SIZE  4096
+#define TELEMETRY_LOG_CHUNK_MAGIC  0x4B4E4843  // "CHNK"
+#define TELEMETRY_LOG_CHUNK_ROWS   1024
+#define TELEMETRY_LOG_PAGE_SIZE    4096
+
+struct telemetry_log_channel {
+	char name[32];
+	char unit[16];
+	float scale;
+	uint8_t type;                  // enum TELEMETRY_TYPE
+	uint8_t decimation;
+	uint8_t reserved[2];
+};
+
+struct telemetry_log_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t chunk_rows;
+	uint32_t chunk_size;           // bytes, including the chunk header and padding
+	uint32_t channel_count;
+	uint32_t reserved;
+	struct telemetry_log_channel channels[TELEMETRY_MAX_CHANNELS];
+};
+
+struct telemetry_log_chunk {
+	uint32_t magic;
+	uint32_t rows;
+	uint64_t first_timestamp;
+	uint64_t last_timestamp;
+	uint64_t first_sequence;
+	uint64_t last_sequence;
+	uint8_t reserved[24];
+};
+
+/**
+ * Appends samples to a log file. A chunk is written each time it fills up, and the partial last chunk on close().
+ */
+class telemetry_log_writer {
+
+public:
+
+	telemetry_log_writer();
+	~telemetry_log_writer();
+
+	/**
+	 * Creates (or truncates) a log file.
+	 *
+	 * @param path       Output file
+	 * @param schema     The channels, from telemetry_decoder::channels(). The channel count is fixed for the life of the file.
+	 * @returns          true on success
+	 */
+	bool open(const char *path, const std::vector<telemetry_channel_info> &schema);
+
+	/**
+	 * Rewrites the channel descriptions in the header, such as after a decimation change.
+	 * Fails if the channel count differs from the one the file was opened with.
+	 */
+	bool update_schema(const std::vector<telemetry_channel_info> &schema);
+
+	bool append(const telemetry_sample &sample);
+
+	/**
+	 * Writes the last (partial) chunk and closes the file.
+	 */
+	bool close();
+
+	uint64_t rows() const { return total_rows; }
+
+private:
+
+	bool write_chunk();
+
+	FILE *file;
+	struct telemetry_log_header header;
+	std::vector<uint8_t> chunk;
+	uint32_t chunk_rows_used;
+	uint64_t chunk_count;
+	uint64_t total_rows;
+	bool have_previous;
+	uint32_t previous_timestamp;
+	uint16_t previous_sequence;
+	uint64_t timestamp;
+	uint64_t sequence;
+
+};
+
+/**
+ * Read-only access to a memory-mapped log. Rows are numbered from 0 across all chunks.
+ */
+class telemetry_log_reader {
+
+public:
+
+	telemetry_log_reader();
+	~telemetry_log_reader();
+
+	bool open(const char *path);
+	void close();
+
+	uint32_t channel_count() const { return header->channel_count; }
+	const struct telemetry_log_channel& channel(uint32_t index) const { return header->channels[index]; }
+
+	/**
+	 * @returns   The index of a channel with the given name, or -1 if there is none
+	 */
+	int find_channel(const char *name) const;
+
+	uint64_t rows() const { return total_rows; }
+	uint64_t chunks() const { return chunk_count; }
+
+	/**
+	 * @returns   The first row with a timestamp at or after the given time, or rows() if there is none
+	 */
+	uint64_t find(uint64_t timestamp) const;
+
+	uint64_t timestamp(uint64_t row) const;
+	uint64_t sequence(uint64_t row) const;
+	float value(uint32_t channel, uint64_t row) const;
+
+	/**
+	 * Copies a range of one channel, without touching the other channels' pages.
+	 *
+	 * @param channel      Channel index
+	 * @param first_row    First row to copy
+	 * @param count        Number of rows
+	 * @param values       Destination for the values (NaN where the channel was absent), or NULL
+	 * @param timestamps   Destination for the timestamps, or NULL
+	 * @returns            Number of rows copied, less than count if the log ends first
+	 */
+	uint64_t read(uint32_t channel, uint64_t first_row, uint64_t count, float *values, uint64_t *timestamps) const;
+
+	// direct access to a chunk's columns
+	const struct telemetry_log_chunk& chunk(uint64_t index) const;
+	const uint64_t* chunk_timestamps(uint64_t index) const;
+	const uint64_t* chunk_sequences(uint64_t index) const;
+	const float* chunk_channel(uint64_t index, uint32_t channel) const;
+
+private:
+
+	const uint8_t *map;
+	size_t map_size;
+	const struct telemetry_log_header *header;
+	uint64_t chunk_count;
+	uint64_t total_rows;
+
+};
+
+/**
+ * @returns   The size of a chunk with the given number of rows and channels, including its padding
+ */
+size_t telemetry_log_chunk_size(uint32_t chunk_rows, uint32_t channel_count);
@@ -0,0 +1,194 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Writes a long synthetic telemetry log and checks it reads back: timestamps that wrap, lost frames, absent channels,
+// seeking by time, reads that span chunks, schema updates and a log cut short.
+// Then compares scanning one channel against scanning all of them.
+//
+// Usage: telemetry_log_test [rows] [file]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <vector>
+#include "telemetry_log.h"
+
+#define CHANNELS 27
+
+static uint32_t failures = 0;
+
+static void check(int condition, const char *description) {
+
+	printf("%s %s\n", condition ? "PASS" : "FAIL", description);
+	if(!condition)
+		failures++;
+
+}
+
+static double seconds_since(const struct timespec &start) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start.tv_sec) + (now.tv_nsec - start.tv_nsec) / 1e9;
+
+}
+
+// the sample written as row n: every 1000th frame is lost, and channel 5 is only sent every 3rd frame
+static const uint64_t FIRST_TIMESTAMP = 0xFFF00000;   // wraps after about a second
+static const uint64_t PERIOD = 13750;
+
+static uint64_t row_frame(uint64_t row) {
+
+	return row + row / 999;
+
+}
+
+static float row_value(uint32_t channel, uint64_t frame) {
+
+	return channel * 1000.0f + (frame % 997);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	uint64_t rows = (argc > 1) ? strtoull(argv[1], NULL, 0) : 200000;
+	const char *path = (argc > 2) ? argv[2] : "/tmp/telemetry_log_test.tlog";
+	if(rows < 5000)
+		rows = 5000;
+
+	std::vector<telemetry_channel_info> schema(CHANNELS);
+	for(uint32_t i = 0; i < CHANNELS; i++) {
+		char name[32];
+		snprintf(name, sizeof(name), "Channel %u", i);
+		schema[i].known = true;
+		schema[i].name = name;
+		schema[i].unit = "rad";
+		schema[i].scale = 0.001f;
+		schema[i].type = TELEMETRY_INT16;
+		schema[i].decimation = (i == 5) ? 3 : 1;
+	}
+	schema[9].name = "Pitch";
+
+	// write
+	telemetry_log_writer writer;
+	check(writer.open(path, schema), "log created");
+	double values[CHANNELS];
+	bool written = true;
+	for(uint64_t row = 0; row < rows; row++) {
+		uint64_t frame = row_frame(row);
+		telemetry_sample sample;
+		sample.sequence = frame;
+		sample.timestamp = FIRST_TIMESTAMP + frame * PERIOD;
+		sample.frames_dropped = 0;
+		sample.mask = ((uint32_t) 1 << CHANNELS) - 1;
+		if(frame % 3)
+			sample.mask &= ~(1 << 5);
+		for(uint32_t i = 0; i < CHANNELS; i++)
+			values[i] = row_value(i, frame);
+		sample.values = values;
+		written &= writer.append(sample);
+	}
+	schema[5].decimation = 6;
+	written &= writer.update_schema(schema);
+	written &= writer.close();
+	check(written, "log written");
+
+	// read back
+	telemetry_log_reader reader;
+	check(reader.open(path), "log opened");
+	check(reader.rows() == rows && reader.chunks() == (rows + TELEMETRY_LOG_CHUNK_ROWS - 1) / TELEMETRY_LOG_CHUNK_ROWS, "row and chunk counts");
+	check(reader.channel_count() == CHANNELS && reader.find_channel("Pitch") == 9 && strcmp(reader.channel(3).unit, "rad") == 0 &&
+	      reader.channel(5).decimation == 6, "schema, including the update");
+
+	uint32_t bad_rows = 0;
+	for(uint64_t row = 0; row < rows; row++) {
+		uint64_t frame = row_frame(row);
+		if(reader.timestamp(row) != FIRST_TIMESTAMP + frame * PERIOD || reader.sequence(row) != frame)
+			bad_rows++;
+		for(uint32_t i = 0; i < CHANNELS; i++) {
+			float value = reader.value(i, row);
+			bool present = (i != 5) || (frame % 3 == 0);
+			if(present ? value != row_value(i, frame) : !isnan(value))
+				bad_rows++;
+		}
+	}
+	check(bad_rows == 0, "timestamps and sequence numbers unwrapped, values and absent channels");
+
+	// seeking by time
+	uint64_t last_timestamp = reader.timestamp(rows - 1);
+	srand(1);
+	uint32_t bad_seeks = 0;
+	for(int i = 0; i < 10000; i++) {
+		uint64_t time = FIRST_TIMESTAMP + (uint64_t) ((double) rand() / RAND_MAX * (last_timestamp - FIRST_TIMESTAMP));
+		uint64_t row = reader.find(time);
+		if(row >= rows || reader.timestamp(row) < time || (row > 0 && reader.timestamp(row - 1) >= time))
+			bad_seeks++;
+	}
+	check(bad_seeks == 0 && reader.find(0) == 0 && reader.find(FIRST_TIMESTAMP) == 0 && reader.find(last_timestamp) == rows - 1 &&
+	      reader.find(last_timestamp + 1) == rows, "seeking by time");
+
+	// reads that span chunks and run past the end
+	std::vector<float> column(3000);
+	std::vector<uint64_t> times(3000);
+	uint64_t first = TELEMETRY_LOG_CHUNK_ROWS - 100;
+	uint64_t count = reader.read(9, first, column.size(), column.data(), times.data());
+	bool matches = count == column.size();
+	for(uint64_t i = 0; i < count; i++)
+		matches &= column[i] == reader.value(9, first + i) && times[i] == reader.timestamp(first + i);
+	check(matches && reader.read(9, rows - 10, 3000, column.data(), NULL) == 10 && reader.read(9, rows, 1, column.data(), NULL) == 0,
+	      "reads spanning chunks");
+
+	// a log cut short in the middle of its last chunk still opens, without that chunk
+	size_t chunk_size = telemetry_log_chunk_size(TELEMETRY_LOG_CHUNK_ROWS, CHANNELS);
+	std::string truncated_path = std::string(path) + ".truncated";
+	FILE *in = fopen(path, "rb");
+	FILE *out = fopen(truncated_path.c_str(), "wb");
+	std::vector<uint8_t> bytes(TELEMETRY_LOG_HEADER_SIZE + 2 * chunk_size + chunk_size / 2);
+	size_t read_bytes = in ? fread(bytes.data(), 1, bytes.size(), in) : 0;
+	if(out) {
+		fwrite(bytes.data(), 1, read_bytes, out);
+		fclose(out);
+	}
+	if(in)
+		fclose(in);
+	telemetry_log_reader truncated;
+	check(truncated.open(truncated_path.c_str()) && truncated.rows() == 2 * TELEMETRY_LOG_CHUNK_ROWS &&
+	      truncated.find(last_timestamp) == truncated.rows(), "truncated log");
+	truncated.close();
+	unlink(truncated_path.c_str());
+
+	// scanning one channel against scanning every channel
+	struct timespec start;
+	double sum = 0.0;
+	const uint64_t BLOCK = 4096;
+	std::vector<float> block(BLOCK);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(uint64_t row = 0; row < rows; row += BLOCK) {
+		uint64_t n = reader.read(9, row, BLOCK, block.data(), NULL);
+		for(uint64_t i = 0; i < n; i++)
+			sum += block[i];
+	}
+	double one_channel = seconds_since(start);
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for(uint32_t channel = 0; channel < CHANNELS; channel++) {
+		for(uint64_t row = 0; row < rows; row += BLOCK) {
+			uint64_t n = reader.read(channel, row, BLOCK, block.data(), NULL);
+			for(uint64_t i = 0; i < n; i++)
+				sum += isnan(block[i]) ? 0.0f : block[i];
+		}
+	}
+	double all_channels = seconds_since(start);
+	printf("scan: %llu rows (%.1f hours at 72.7 Hz), %.1f MB file, one channel in %.2f ms (%.0f Mrows/s), all %u in %.2f ms\n",
+	       (unsigned long long) rows, rows / 72.7 / 3600.0, (TELEMETRY_LOG_HEADER_SIZE + reader.chunks() * chunk_size) / 1e6,
+	       one_channel * 1e3, rows / one_channel / 1e6, CHANNELS, all_channels * 1e3);
+
+	reader.close();
+	unlink(path);
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+
+}
@@ -0,0 +1,81 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Reads a telemetry log written by telemetry_record.
+//
+// Usage: telemetry_query <log>                                      lists the channels and the time span
+//        telemetry_query <log> <channel> [start] [end]              prints one channel as CSV (seconds, value)
+//
+// The channel is a name or an index. Start and end are in seconds from the start of the log.
+// Only the index and the pages of the requested channel are read.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+#include "telemetry_log.h"
+
+int main(int argc, char *argv[]) {
+
+	if(argc < 2 || argc > 5) {
+		fprintf(stderr, "Usage: %s <log> [<channel> [start seconds] [end seconds]]\n", argv[0]);
+		return 1;
+	}
+
+	telemetry_log_reader log;
+	if(!log.open(argv[1])) {
+		fprintf(stderr, "Unable to open %s as a telemetry log\n", argv[1]);
+		return 1;
+	}
+	if(log.rows() == 0) {
+		fprintf(stderr, "%s is empty\n", argv[1]);
+		return 1;
+	}
+
+	uint64_t first_timestamp = log.timestamp(0);
+	uint64_t last_timestamp = log.timestamp(log.rows() - 1);
+
+	if(argc == 2) {
+		static const char *types[] = {"int8", "int16", "float"};
+		printf("%llu samples in %llu chunks, %.3f seconds, sequence numbers %llu to %llu\n",
+		       (unsigned long long) log.rows(), (unsigned long long) log.chunks(), (last_timestamp - first_timestamp) / 1e6,
+		       (unsigned long long) log.sequence(0), (unsigned long long) log.sequence(log.rows() - 1));
+		for(uint32_t i = 0; i < log.channel_count(); i++) {
+			const struct telemetry_log_channel &channel = log.channel(i);
+			printf("%2u  %-24.32s %-8.16s scale %-10g %-6s decimation %u\n", i, channel.name, channel.unit, channel.scale,
+			       channel.type <= TELEMETRY_FLOAT ? types[channel.type] : "?", channel.decimation);
+		}
+		return 0;
+	}
+
+	int channel = log.find_channel(argv[2]);
+	if(channel < 0) {
+		char *end;
+		long index = strtol(argv[2], &end, 10);
+		if(*end == 0 && index >= 0 && index < (long) log.channel_count())
+			channel = index;
+	}
+	if(channel < 0) {
+		fprintf(stderr, "No channel named %s\n", argv[2]);
+		return 1;
+	}
+
+	double start = (argc > 3) ? atof(argv[3]) : 0.0;
+	double end = (argc > 4) ? atof(argv[4]) : INFINITY;
+	if(start < 0.0)
+		start = 0.0;
+	uint64_t first_row = log.find(first_timestamp + (uint64_t) (start * 1e6));
+	uint64_t end_row = (end == INFINITY) ? log.rows() : log.find(first_timestamp + (uint64_t) (end * 1e6));
+
+	printf("seconds,%s\n", log.channel(channel).name);
+	const size_t BLOCK = 4096;
+	float values[BLOCK];
+	uint64_t timestamps[BLOCK];
+	for(uint64_t row = first_row; row < end_row; row += BLOCK) {
+		uint64_t count = log.read(channel, row, (end_row - row < BLOCK) ? end_row - row : BLOCK, values, timestamps);
+		for(uint64_t i = 0; i < count; i++)
+			if(!isnan(values[i]))
+				printf("%.6f,%g\n", (timestamps[i] - first_timestamp) / 1e6, values[i]);
+	}
+	return 0;
+
+}
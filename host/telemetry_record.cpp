@@ -0,0 +1,155 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// Records the robot's telemetry stream from a serial port or a file into a telemetry log (see telemetry_log.h):
+// one column-oriented, memory-mappable file with a time index, readable with telemetry_query.
+// Recording starts once the schema is known. A decimation change updates the log's schema.
+// The latest histogram of each id (such as the radio's latency and jitter) is printed when recording stops.
+//
+// Usage: telemetry_record <serial port, file, or - for stdin> <output file>
+// A serial port is configured for 921600 baud, 8N1, raw. Recording stops at the end of a file or with Ctrl-C.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+#include <vector>
+#include <map>
+#include "telemetry_decoder.h"
+#include "telemetry_log.h"
+
+static volatile sig_atomic_t stop = 0;
+
+static void handle_signal(int signal) {
+
+	stop = 1;
+
+}
+
+// raw 8N1 at the firmware's baud rate, if the input is a terminal
+static void configure_serial_port(int fd) {
+
+	struct termios options;
+	if(!isatty(fd) || tcgetattr(fd, &options) != 0)
+		return;
+	cfmakeraw(&options);
+	cfsetispeed(&options, B921600);
+	cfsetospeed(&options, B921600);
+	options.c_cc[VMIN] = 1;
+	options.c_cc[VTIME] = 0;
+	tcsetattr(fd, TCSANOW, &options);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s <serial port, file, or - for stdin> <output file>\n", argv[0]);
+		return 1;
+	}
+
+	int fd = strcmp(argv[1], "-") == 0 ? 0 : open(argv[1], O_RDONLY | O_NOCTTY);
+	if(fd < 0) {
+		fprintf(stderr, "Unable to open %s: %s\n", argv[1], strerror(errno));
+		return 1;
+	}
+	configure_serial_port(fd);
+
+	telemetry_log_writer log;
+	bool log_open = false;
+	bool failed = false;
+	std::vector<telemetry_channel_info> schema_written;
+	uint64_t skipped = 0;
+
+	telemetry_decoder decoder;
+
+	// the log is created once every channel is known, and its schema rewritten if a descriptor changes (such as the decimation)
+	decoder.on_descriptor = [&](uint8_t channel) {
+		if(!log_open || !decoder.schema_complete())
+			return;
+		const telemetry_channel_info &info = decoder.channels()[channel];
+		const telemetry_channel_info &old = schema_written[channel];
+		if(old.name == info.name && old.unit == info.unit && old.scale == info.scale &&
+		   old.type == info.type && old.decimation == info.decimation)
+			return;
+		if(!log.update_schema(decoder.channels())) {
+			fprintf(stderr, "The channel count changed from %zu to %zu, stopping.\n", schema_written.size(), decoder.channels().size());
+			failed = true;
+			return;
+		}
+		schema_written = decoder.channels();
+	};
+
+	decoder.on_sample = [&](const telemetry_sample &sample) {
+		if(failed)
+			return;
+		if(!log_open) {
+			if(!decoder.schema_complete()) {
+				skipped++;
+				return;
+			}
+			if(!log.open(argv[2], decoder.channels())) {
+				fprintf(stderr, "Unable to create %s: %s\n", argv[2], strerror(errno));
+				failed = true;
+				return;
+			}
+			log_open = true;
+			schema_written = decoder.channels();
+		}
+		if(!log.append(sample)) {
+			fprintf(stderr, "Unable to write %s: %s\n", argv[2], strerror(errno));
+			failed = true;
+		}
+	};
+
+	std::map<uint8_t, telemetry_histogram_frame> histograms;
+	decoder.on_histogram = [&](const telemetry_histogram_frame &histogram) {
+		histograms[histogram.id] = histogram;
+	};
+
+	// without SA_RESTART, so a blocking read() returns when interrupted
+	struct sigaction action;
+	memset(&action, 0, sizeof(action));
+	action.sa_handler = handle_signal;
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	uint8_t buffer[65536];
+	while(!stop && !failed) {
+		ssize_t count = read(fd, buffer, sizeof(buffer));
+		if(count < 0 && errno == EINTR)
+			continue;
+		if(count <= 0)
+			break;
+		decoder.feed(buffer, count);
+	}
+
+	if(log_open && !log.close()) {
+		fprintf(stderr, "Unable to write %s: %s\n", argv[2], strerror(errno));
+		failed = true;
+	}
+
+	const telemetry_decoder_statistics &stats = decoder.statistics();
+	fprintf(stderr, "%llu samples recorded from %llu bytes: %llu frames, %llu CRC errors, %llu framing errors, "
+	                "%llu lost frames (%llu dropped by the firmware), %llu samples before the schema was known\n",
+	        (unsigned long long) log.rows(), (unsigned long long) stats.bytes, (unsigned long long) stats.frames,
+	        (unsigned long long) stats.crc_errors, (unsigned long long) stats.framing_errors,
+	        (unsigned long long) stats.lost_frames, (unsigned long long) stats.uart_drops,
+	        (unsigned long long) (stats.unknown_layout + skipped));
+
+	// one line per bin: its lower bound and its count, the end bins also hold everything beyond them
+	for(const auto &entry : histograms) {
+		const telemetry_histogram_frame &histogram = entry.second;
+		fprintf(stderr, "histogram %u:\n", histogram.id);
+		for(size_t bin = 0; bin < histogram.counts.size(); bin++)
+			fprintf(stderr, "%11lld %8u\n", (long long) histogram.first_bin + (long long) bin * histogram.bin_width, histogram.counts[bin]);
+	}
+
+	return failed ? 1 : 0;
+
+}
@@ -0,0 +1,442 @@
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+// End-to-end test of the serial link without a robot or a serial adapter. The firmware's UART driver (f0lib_uart.c)
+// and telemetry (f0lib_telemetry.c) run natively on the USART and DMA models in mock/, and the bytes they shift out
+// are written to the master side of a pseudo-terminal at the pace of the baud rate. A second thread reads the slave
+// side like telemetry_record reads a serial port, decodes it with telemetry_decoder, and sends commands back,
+// which the firmware receives through its RX DMA and acknowledges.
+//
+// Three phases run for the same time each:
+//   clean       frames at about 30% of the line rate: nothing may be corrupted, every command is acknowledged, and the
+//               firmware drops nothing
+//   saturated   frames at twice the line rate: the TX ring must keep the line busy, every lost frame must be a data frame
+//               the firmware dropped, and every command is still acknowledged
+//   corrupted   as clean, but with bits flipped on the line: every corruption must be caught by the CRC or the framing,
+//               no bad value may get through, and decoding must resume at the next frame
+// and for each the frame rate, the line utilization and the latency (from telemetry_send() to decoding) are reported.
+// Finally, text that is too long for a TX slot must be dropped and counted.
+//
+// Usage: uart_pty_harness [seconds per phase] [baud]
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mock.h"
+#include "telemetry_decoder.h"
+#include "f0lib_uart.h"
+#include "f0lib_telemetry.h"
+
+// after the register definitions, because termios.h defines CR1, CR2 and CR3 as macros
+#include <pty.h>
+#include <termios.h>
+
+static uint32_t failures = 0;
+
+static void check(int condition, const char *description) {
+
+	printf("%s %s\n", condition ? "PASS" : "FAIL", description);
+	if(!condition)
+		failures++;
+
+}
+
+static uint64_t host_microseconds(void) {
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (uint64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+
+}
+
+// a channel table about the size of main.c's, with values that can be checked exactly ////////////////////////////////
+
+#define CHANNELS 24
+
+static float values[CHANNELS];
+static struct telemetry_channel channels[CHANNELS];
+static char names[CHANNELS][16];
+
+static void setup_channels(void) {
+
+	for(int i = 0; i < CHANNELS; i++) {
+		snprintf(names[i], sizeof(names[i]), "Channel %d", i);
+		channels[i].name = names[i];
+		channels[i].unit = "";
+		channels[i].scale = 1.0f;
+		channels[i].type = TELEMETRY_INT16;
+		channels[i].value = &values[i];
+	}
+	telemetry_setup(channels, CHANNELS);
+
+}
+
+static float expected_value(int channel, uint32_t frame) {
+
+	return (float) ((frame * 31 + channel * 997) % 60001) - 30000.0f;
+
+}
+
+// the same command codes as main.c, with the two that don't touch the robot
+enum COMMAND {
+	COMMAND_SET_DECIMATION = 0x02, // telemetry channel index, decimation
+	COMMAND_SEND_SCHEMA    = 0x04
+};
+
+static void process_commands(void) {
+
+	uint8_t payload[16];
+	uint16_t length;
+
+	while((length = uart_receive_frame(payload, sizeof(payload)))) {
+		uint8_t result = 0;
+		if(payload[0] == COMMAND_SET_DECIMATION && length == 3) {
+			result = telemetry_set_decimation(payload[1], payload[2]);
+		} else if(payload[0] == COMMAND_SEND_SCHEMA && length == 1) {
+			telemetry_send_schema();
+			result = 1;
+		}
+		telemetry_acknowledge(payload[0], result);
+	}
+
+}
+
+// the host side: decodes the slave, measures latency and sends commands //////////////////////////////////////////////
+
+static int master_fd;
+static int slave_fd;
+
+static std::mutex host_mutex;                      // protects everything below, except the atomics
+static telemetry_decoder decoder;
+static std::vector<uint32_t> latencies;
+static uint32_t bad_values = 0;
+static uint32_t frame = 0;
+static uint64_t acks = 0;
+
+static std::atomic<uint64_t> bytes_read(0);
+static std::atomic<uint64_t> commands_sent(0);
+static std::atomic<bool> commands_enabled(false);
+static std::atomic<bool> host_running(true);
+
+static void send_command(uint64_t n) {
+
+	uint8_t payload[3];
+	size_t length;
+	if(n % 2) {
+		payload[0] = COMMAND_SET_DECIMATION;
+		payload[1] = n % CHANNELS;
+		payload[2] = 1;
+		length = 3;
+	} else {
+		payload[0] = COMMAND_SEND_SCHEMA;
+		length = 1;
+	}
+
+	uint8_t encoded[8];
+	size_t count = telemetry_encode_frame(payload, length, encoded);
+	if(write(slave_fd, encoded, count) == (ssize_t) count)
+		commands_sent++;
+
+}
+
+static void host_thread(void) {
+
+	decoder.on_sample = [](const telemetry_sample &sample) {
+		latencies.push_back((uint32_t) host_microseconds() - sample.timestamp);
+		frame += (uint16_t) (sample.sequence - frame);
+		for(int i = 0; i < CHANNELS; i++)
+			if((sample.mask & (1u << i)) && sample.values[i] != expected_value(i, frame))
+				bad_values++;
+	};
+	decoder.on_ack = [](uint8_t command, uint8_t result) {
+		if(result == 1)
+			acks++;
+	};
+
+	uint64_t next_command = host_microseconds();
+	uint8_t bytes[4096];
+
+	while(host_running) {
+
+		struct pollfd fd = {slave_fd, POLLIN, 0};
+		if(poll(&fd, 1, 2) > 0) {
+			ssize_t count = read(slave_fd, bytes, sizeof(bytes));
+			if(count > 0) {
+				std::lock_guard<std::mutex> lock(host_mutex);
+				decoder.feed(bytes, count);
+				bytes_read += count;
+			}
+		}
+
+		uint64_t now = host_microseconds();
+		if(commands_enabled && now >= next_command) {
+			send_command(commands_sent);
+			next_command = now + 20000;
+		}
+
+	}
+
+}
+
+// the firmware side: makes frames, and moves bytes between the USART model and the master ////////////////////////////
+
+static uint64_t bytes_written = 0;
+static uint32_t firmware_frame = 0;
+
+struct phase {
+	const char *name;
+	double frame_rate;
+	uint32_t corrupt_every;                       // flip a bit in one of every n bytes on average, 0 = never
+	bool catch_up;                                // make the frames that came due while the thread wasn't running
+	double seconds;
+	uint64_t line_bytes;                          // bytes sent while frames were being made
+	uint64_t corruptions;
+	uint32_t frames_sent;                         // by the firmware, of any type
+	uint32_t frames_dropped;
+	uint64_t commands;
+	uint64_t acks;
+	uint32_t bad_values;
+	telemetry_decoder_statistics decoded;         // during the phase
+	std::vector<uint32_t> latencies;
+};
+
+static void write_all(const uint8_t *bytes, uint32_t count) {
+
+	while(count > 0) {
+		ssize_t n = write(master_fd, bytes, count);
+		if(n <= 0)
+			continue;
+		bytes += n;
+		count -= n;
+	}
+
+}
+
+static void run_phase(struct phase &phase, double seconds, uint32_t baud) {
+
+	std::vector<uint8_t> line(4096);
+	double bytes_per_us = baud / 10.0 / 1e6;      // 8N1
+	uint64_t period = 1e6 / phase.frame_rate;
+	uint64_t corruptions = 0;
+	struct uart_statistics uart_before = *uart_get_statistics();
+	telemetry_decoder_statistics decoded_before;
+	uint64_t acks_before;
+	uint32_t bad_values_before;
+	{
+		std::lock_guard<std::mutex> lock(host_mutex);
+		decoded_before = decoder.statistics();
+		acks_before = acks;
+		bad_values_before = bad_values;
+		latencies.clear();
+	}
+	uint64_t commands_before = commands_sent;
+
+	uint64_t start = host_microseconds();
+	uint64_t commands_end = start + seconds * 1e6;
+	uint64_t frames_end = commands_end + 50000;   // time for the last command to be acknowledged
+	uint64_t next_frame = start;
+	double line_clock = start;                    // when the line finishes sending what was written so far
+	uint64_t line_bytes = 0;
+	commands_enabled = true;
+
+	while(true) {
+
+		uint64_t now = host_microseconds();
+		bool making_frames = now < frames_end;
+		if(now >= commands_end)
+			commands_enabled = false;
+
+		// the bytes that fit in the time since the last call, and the line goes idle if the DMA runs out of work
+		double due = (now - line_clock) * bytes_per_us;
+		uint32_t max = (due < line.size()) ? (uint32_t) due : line.size();
+		uint32_t count = mock_uart_transmit(USART1, line.data(), max);
+		if(count < max)
+			line_clock = now;
+		else
+			line_clock += count / bytes_per_us;
+
+		if(phase.corrupt_every) {
+			for(uint32_t k = 0; k < count; k++) {
+				if(rand() % phase.corrupt_every == 0) {
+					line[k] ^= 1 << (rand() % 8);
+					corruptions++;
+				}
+			}
+		}
+		write_all(line.data(), count);
+		bytes_written += count;
+		if(making_frames)
+			line_bytes += count;
+
+		// commands from the host
+		struct pollfd fd = {master_fd, POLLIN, 0};
+		while(poll(&fd, 1, 0) > 0) {
+			uint8_t bytes[64];
+			ssize_t count = read(master_fd, bytes, sizeof(bytes));
+			if(count <= 0)
+				break;
+			mock_uart_receive(USART1, bytes, count);
+			process_commands();
+		}
+
+		// a late pass skips the frames it missed, like the control loop would, unless the phase catches up on them
+		if(now > next_frame + (phase.catch_up ? 4 * period : period))
+			next_frame = now;
+		while(making_frames && now >= next_frame) {
+			for(int i = 0; i < CHANNELS; i++)
+				values[i] = expected_value(i, firmware_frame);
+			telemetry_send((uint32_t) now);
+			firmware_frame++;
+			next_frame += period;
+		}
+
+		// done once the firmware has nothing left to send and the host has read all of it
+		if(!making_frames && count < max && bytes_read == bytes_written)
+			break;
+
+		usleep(100);
+
+	}
+
+	const struct uart_statistics *uart_after = uart_get_statistics();
+	phase.seconds = (frames_end - start) / 1e6;
+	phase.line_bytes = line_bytes;
+	phase.corruptions = corruptions;
+	phase.frames_sent = uart_after->frames_sent - uart_before.frames_sent;
+	phase.frames_dropped = uart_after->frames_dropped - uart_before.frames_dropped;
+	phase.commands = commands_sent - commands_before;
+
+	std::lock_guard<std::mutex> lock(host_mutex);
+	const telemetry_decoder_statistics &after = decoder.statistics();
+	phase.decoded.bytes = after.bytes - decoded_before.bytes;
+	phase.decoded.frames = after.frames - decoded_before.frames;
+	phase.decoded.data_frames = after.data_frames - decoded_before.data_frames;
+	phase.decoded.descriptor_frames = after.descriptor_frames - decoded_before.descriptor_frames;
+	phase.decoded.ack_frames = after.ack_frames - decoded_before.ack_frames;
+	phase.decoded.histogram_frames = after.histogram_frames - decoded_before.histogram_frames;
+	phase.decoded.crc_errors = after.crc_errors - decoded_before.crc_errors;
+	phase.decoded.framing_errors = after.framing_errors - decoded_before.framing_errors;
+	phase.decoded.unknown_layout = after.unknown_layout - decoded_before.unknown_layout;
+	phase.decoded.lost_frames = after.lost_frames - decoded_before.lost_frames;
+	phase.decoded.uart_drops = after.uart_drops - decoded_before.uart_drops;
+	phase.acks = acks - acks_before;
+	phase.bad_values = bad_values - bad_values_before;
+	phase.latencies = latencies;
+
+}
+
+static uint32_t percentile(const std::vector<uint32_t> &sorted, double fraction) {
+
+	if(sorted.empty())
+		return 0;
+	return sorted[(size_t) (fraction * (sorted.size() - 1))];
+
+}
+
+static void report(struct phase &phase, uint32_t baud) {
+
+	std::sort(phase.latencies.begin(), phase.latencies.end());
+	printf("%s: %.0f data frames/s decoded, %u frames sent, %u dropped by the firmware, line %.1f%% busy\n", phase.name,
+	       phase.decoded.data_frames / phase.seconds, phase.frames_sent, phase.frames_dropped,
+	       100.0 * phase.line_bytes / (phase.seconds * baud / 10.0));
+	printf("    latency p50 %u us, p99 %u us, max %u us\n", percentile(phase.latencies, 0.5),
+	       percentile(phase.latencies, 0.99), phase.latencies.empty() ? 0 : phase.latencies.back());
+	printf("    %llu lost, %llu dropped by the firmware, %llu crc errors, %llu framing errors, %llu corruptions, "
+	       "%llu/%llu commands acknowledged\n",
+	       (unsigned long long) phase.decoded.lost_frames, (unsigned long long) phase.decoded.uart_drops,
+	       (unsigned long long) phase.decoded.crc_errors, (unsigned long long) phase.decoded.framing_errors,
+	       (unsigned long long) phase.corruptions, (unsigned long long) phase.acks, (unsigned long long) phase.commands);
+
+}
+
+int main(int argc, char *argv[]) {
+
+	double seconds = (argc > 1) ? atof(argv[1]) : 1.0;
+	uint32_t baud = (argc > 2) ? strtoul(argv[2], NULL, 0) : 921600;
+	if(seconds <= 0.0 || baud < 9600) {
+		fprintf(stderr, "Usage: %s [seconds per phase] [baud]\n", argv[0]);
+		return 2;
+	}
+
+	// a raw pseudo-terminal, set up like a serial port
+	struct termios settings;
+	if(openpty(&master_fd, &slave_fd, NULL, NULL, NULL) != 0 || tcgetattr(slave_fd, &settings) != 0) {
+		perror("Unable to open a pseudo-terminal");
+		return 2;
+	}
+	cfmakeraw(&settings);
+	tcsetattr(slave_fd, TCSANOW, &settings);
+
+	mock_uart_reset();
+	uart_setup(PA9, baud);
+	uart_receive_setup(PA10);
+	setup_channels();
+	srand(1);
+
+	std::thread host(host_thread);
+
+	// a data frame with 24 int16 channels is 65 bytes on the line, and a descriptor follows one in eight
+	double frame_rate = baud / 10.0 / (65.0 + 32.0 / TELEMETRY_DESCRIPTOR_INTERVAL);
+	struct phase clean = {"clean", 0.3 * frame_rate, 0, false};
+	struct phase saturated = {"saturated", 2.0 * frame_rate, 0, true};
+	struct phase corrupted = {"corrupted", 0.3 * frame_rate, 1000, false};
+
+	run_phase(clean, seconds, baud);
+	report(clean, baud);
+	check(clean.decoded.crc_errors == 0 && clean.decoded.framing_errors == 0 && clean.bad_values == 0, "clean: no errors");
+	check(clean.decoded.data_frames > 0.9 * clean.frame_rate * clean.seconds &&
+	      clean.decoded.lost_frames <= clean.decoded.uart_drops, "clean: every frame the firmware sent was decoded");
+	check(clean.commands > 0 && clean.acks == clean.commands, "clean: every command acknowledged");
+	check(clean.frames_dropped == 0, "clean: no frames dropped by the firmware");
+
+	run_phase(saturated, seconds, baud);
+	report(saturated, baud);
+	check(saturated.decoded.crc_errors == 0 && saturated.decoded.framing_errors == 0 && saturated.bad_values == 0,
+	      "saturated: no errors");
+	check(saturated.line_bytes > 0.75 * saturated.seconds * baud / 10.0, "saturated: line kept busy");
+	check(saturated.frames_dropped > 0 && saturated.decoded.lost_frames > 0 &&
+	      saturated.decoded.lost_frames <= saturated.decoded.uart_drops, "saturated: losses are all drops in the firmware");
+	check(saturated.commands > 0 && saturated.acks == saturated.commands, "saturated: every command acknowledged");
+
+	run_phase(corrupted, seconds, baud);
+	report(corrupted, baud);
+	uint64_t errors = corrupted.decoded.crc_errors + corrupted.decoded.framing_errors;
+	check(corrupted.corruptions > 0 && errors >= 0.9 * corrupted.corruptions && corrupted.bad_values == 0,
+	      "corrupted: corruptions caught");
+	check(corrupted.decoded.lost_frames <= corrupted.decoded.uart_drops + 2 * corrupted.corruptions &&
+	      corrupted.decoded.data_frames > 0.9 * corrupted.frame_rate * corrupted.seconds - 2 * corrupted.corruptions,
+	      "corrupted: decoding resumes after each corruption");
+
+	// text that doesn't fit in a TX slot is dropped and counted, instead of running into the next slot
+	uint32_t dropped = uart_get_statistics()->frames_dropped;
+	float big = 1e18f; // 26 characters with UART_CSV_DECIMALS
+	uart_send_csv_floats(20, big, big, big, big, big, big, big, big, big, big, big, big, big, big, big, big, big, big, big, big);
+	check(uart_get_statistics()->frames_dropped == dropped + 1, "text: a CSV line longer than a slot is dropped");
+	dropped = uart_get_statistics()->frames_dropped;
+	uint32_t rows_dropped = 0;
+	for(int row = 0; row < 10; row++) {
+		uint32_t before = uart_get_statistics()->frames_dropped;
+		uart_append_ascii_graph((char *) "Row", big, (char *) "G", -1.0f, 1.0f);
+		rows_dropped += uart_get_statistics()->frames_dropped - before;
+	}
+	check(rows_dropped > 0 && rows_dropped < 10 && uart_get_statistics()->frames_dropped == dropped + rows_dropped,
+	      "text: graph rows that don't fit are left out");
+	uart_reset_tx_buffer();
+
+	host_running = false;
+	host.join();
+	close(slave_fd);
+	close(master_fd);
+
+	printf("%u failures\n", failures);
+	return failures ? 1 : 0;
+
+}
@@ -1,139 +1,374 @@
-// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
-// License: public domain
-
-#include <stm32f0xx.h>
-#include "f0lib/f0lib_mpu6050_hmc5883l.h"
-#include "f0lib/f0lib_uart.h"
-#include "f0lib/f0lib_timers.h"
-#include "f0lib/f0lib_rf_cc2500.h"
-#include "f0lib/f0lib_gpio.h"
-
-#include "MadgwickAHRS.h"
-#include <math.h>
-#include <stdio.h>
-
-// variables written to by the CC2500 packet received handler
-volatile float gimbalX = 0;
-volatile float gimbalY = 0;
-volatile float knobLeft = 0;
-volatile float knobMiddle = 0;
-volatile float knobRight = 0;
-
-void process_new_sensor_values(float gyro_x, float gyro_y, float gyro_z, float accel_x, float accel_y, float accel_z, float magn_x, float magn_y, float magn_z) {
-
-	// sensor fusion with Madgwick's Filter
-	// MadgwickAHRSupdate(gyro_z, gyro_y, -gyro_x, accel_z, accel_y, -accel_x, magn_z, magn_y, -magn_x);
-	MadgwickAHRSupdateIMU(gyro_z, gyro_y, -gyro_x, accel_z, accel_y, -accel_x);
-
-	// calculate the pitch angle so that:    0 = vertical    -pi/2 = on its back    +pi/2 = on its face
-	float pitch = asinf(-2.0f * (q1*q3 - q0*q2));
-
-	// calculate the set point (desired angle) and error (difference between the current angle and desired angle)
-	// since there are no wheel encoders, only throttle affects the set point
-	// mapping throttle to an angle so that:  0 = no throttle    -pi/10 = full speed reverse    +pi/10 = full speed forward
-	float set_point = (float) gimbalY / 1400.0f * 0.314159265f;
-	float error = pitch - set_point;
-
-	// calculate the proportional component (current error * p scalar)
-	float p_scalar = 12000.0f + (knobLeft - 2048.0f) * 5.90f;
-	if(p_scalar < 0) p_scalar = 0;
-	float proportional = error * p_scalar;
-
-	// calculate the integral component (summation of past errors * i scalar)
-	float i_scalar = 500.0f + (knobMiddle - 2048.0f) * 0.27f;
-	if(i_scalar < 0) i_scalar = 0;
-	static float integral = 0;
-	integral += error * i_scalar;
-	if(integral >  1000) integral = 1000; // limit wind-up
-	if(integral < -1000) integral = -1000;
-
-	// calculate the derivative component (change since previous error * d scalar)
-	static float previous_error = 0;
-	float d_scalar = 16000.0f + (knobRight - 2048.0f) * 7.85f;
-	if(d_scalar < 0) d_scalar = 0;
-	float derivative = (error - previous_error) * d_scalar;
-	previous_error = error;
-
-	int32_t motor_a_speed = proportional + integral + derivative;
-	int32_t motor_b_speed = proportional + integral + derivative;
-
-	// apply steering
-	motor_a_speed += gimbalX / 2;
-	motor_b_speed -= gimbalX / 2;
-
-	// stop the motors if we're far from vertical since there is no chance of success
-	if(pitch < -0.7f || pitch > 0.7f) {
-		motor_a_speed = 0;
-		motor_b_speed = 0;
-	}
-
-	timer_dual_hbridge_motor_speeds(motor_a_speed, motor_b_speed);
-
-	uart_send_bin_floats(27,
-	                     accel_x, // G
-						 accel_y, // G
-						 accel_z, // G
-						 gyro_x,  // Rad/s
-						 gyro_y,  // Rad/s
-						 gyro_z,  // Rad/s
-						 magn_x,  // Gs
-						 magn_y,  // Gs
-						 magn_z,  // Gs
-						 pitch,   // Rad
-						 q0,      // Quaternion
-						 q1,      // Quaternion
-						 q2,      // Quaternion
-						 q3,      // Quaternion
-	                     gimbalX,
-						 gimbalY,
-						 knobLeft,
-						 knobMiddle,
-						 knobRight,
-						 set_point,
-						 error,
-						 p_scalar,
-						 proportional,
-						 i_scalar,
-						 integral,
-						 d_scalar,
-						 derivative);
-
-}
-
-
-void process_new_packet(uint8_t byte_count, uint8_t bytes[]) {
-
-	int16_t gimX = (bytes[1] << 8) | bytes[0];
-	int16_t gimY = (bytes[3] << 8) | bytes[2];
-	int16_t knoL = (bytes[5] << 8) | bytes[4];
-	int16_t knoM = (bytes[7] << 8) | bytes[6];
-	int16_t knoR = (bytes[9] << 8) | bytes[8];
-	// ignore byte10: currently unused
-
-	gimbalX    = (float) gimX;
-	gimbalY    = (float) gimY;
-	knobLeft   = (float) knoL;
-	knobMiddle = (float) knoM;
-	knobRight  = (float) knoR;
-
-}
-
-void main(void) {
-
-	// configure the UART
-	uart_setup(PA9, 921600);
-
-	// configure the 9DOF
-	mpu6050_hmc5883l_setup(PB8, PB9, PB7, &process_new_sensor_values);
-
-	// configure the dual h-bridge PWM timer
-	timer_dual_hbridge_setup(PA0, PA1, PA2, PA3);
-
-	// configure the RF module
-	cc2500_setup(SPI1, PB3, PB4, PB5, PD2, PC12, 11, &process_new_packet);
-	cc2500_enter_rx_mode();
-
-	// everything else is handled by the ISR
-	while(1);
-
-}
+// Author: Farrell Farahbod <farrellfarahbod@gmail.com>
+// License: public domain
+
+#include <stm32f0xx.h>
+#include "f0lib/f0lib_mpu6050_hmc5883l.h"
+#include "f0lib/f0lib_uart.h"
+#include "f0lib/f0lib_telemetry.h"
+#include "f0lib/f0lib_dashboard.h"
+#include "f0lib/f0lib_timers.h"
+#include "f0lib/f0lib_rf_cc2500.h"
+#include "f0lib/f0lib_gpio.h"
+
+#include "controller.h"
+#include "MadgwickAHRS.h"
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+// variables written to by the CC2500 packet received handler
+volatile float gimbalX = 0;
+volatile float gimbalY = 0;
+volatile float knobLeft = 0;
+volatile float knobMiddle = 0;
+volatile float knobRight = 0;
+volatile uint8_t packet_pending = 0; // a packet arrived since the last controller update
+volatile float radio_loss = 0;       // fraction of recent packets lost, from the gaps in their sequence numbers
+volatile uint8_t motors_stopped = 1; // the motors are off, so the control loop can be stalled by a flash write
+
+// radio timing in microseconds, sent as telemetry histograms every HISTOGRAM_PERIOD samples (about 5s)
+#define HISTOGRAM_PERIOD 364
+static struct telemetry_histogram radio_jitter  = {1, 250,  -2000, {0}}; // packet arrival, relative to the transmitter's period
+static struct telemetry_histogram radio_latency = {2, 1000, 0,     {0}}; // end of a packet to the motors updated with its command
+
+// commands received over the UART. The first payload byte is the command, and every command is acknowledged
+// with a telemetry acknowledgement frame carrying the command and 1 (success) or 0 (failure.)
+enum COMMAND {
+	COMMAND_SET_PARAMETER    = 0x01, // parameter index, value (float)
+	COMMAND_SET_DECIMATION   = 0x02, // telemetry channel index, decimation
+	COMMAND_CALIBRATE_GYRO   = 0x03, // the robot must be still, the motors are stopped until it finishes
+	COMMAND_SEND_SCHEMA      = 0x04,
+	COMMAND_CLEAR_HISTOGRAMS = 0x05, // empties the radio jitter and latency histograms
+	COMMAND_SET_GYRO_BIAS    = 0x06  // temperature start (int16), temperature shift (uint16), 8 x, y and z biases (int16), from host/gyro_temp_fit
+};
+
+// values reported by telemetry, updated by the sensor handler
+static struct {
+	float accel_x, accel_y, accel_z;
+	float gyro_x, gyro_y, gyro_z;
+	float pitch;
+	float q0, q1, q2, q3;
+	float gimbal_x, gimbal_y;
+	float knob_left, knob_middle, knob_right;
+	float set_point, error;
+	float p_scalar, proportional;
+	float i_scalar, integral;
+	float d_scalar, derivative;
+	float temperature;
+	float sample_interval, latency, packet_age;
+	float radio_rssi, radio_lqi, packet_rate, radio_loss;
+} telemetry;
+
+// the sensor channels are scaled by one LSB, and the filter state and integral are floats,
+// so a recording holds everything needed to replay the controller exactly (see host/control_replay.cpp)
+// the table is full (TELEMETRY_MAX_CHANNELS), and the magnetometer is left out because the controller doesn't use it
+static const struct telemetry_channel telemetry_channels[] = {
+	{"Accel X",         "G",     MPU6050_HMC5883L_ACCEL_G_PER_LSB,    TELEMETRY_INT16, &telemetry.accel_x},
+	{"Accel Y",         "G",     MPU6050_HMC5883L_ACCEL_G_PER_LSB,    TELEMETRY_INT16, &telemetry.accel_y},
+	{"Accel Z",         "G",     MPU6050_HMC5883L_ACCEL_G_PER_LSB,    TELEMETRY_INT16, &telemetry.accel_z},
+	{"Gyro X",          "rad/s", MPU6050_HMC5883L_GYRO_RAD_PER_LSB,   TELEMETRY_INT16, &telemetry.gyro_x},
+	{"Gyro Y",          "rad/s", MPU6050_HMC5883L_GYRO_RAD_PER_LSB,   TELEMETRY_INT16, &telemetry.gyro_y},
+	{"Gyro Z",          "rad/s", MPU6050_HMC5883L_GYRO_RAD_PER_LSB,   TELEMETRY_INT16, &telemetry.gyro_z},
+	{"Pitch",           "rad",   0.0001f,                             TELEMETRY_INT16, &telemetry.pitch},
+	{"Q0",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q0},
+	{"Q1",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q1},
+	{"Q2",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q2},
+	{"Q3",              "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.q3},
+	{"Gimbal X",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.gimbal_x},
+	{"Gimbal Y",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.gimbal_y},
+	{"Knob Left",       "",      1.0f,                                TELEMETRY_INT16, &telemetry.knob_left},
+	{"Knob Middle",     "",      1.0f,                                TELEMETRY_INT16, &telemetry.knob_middle},
+	{"Knob Right",      "",      1.0f,                                TELEMETRY_INT16, &telemetry.knob_right},
+	{"Set Point",       "rad",   0.0001f,                             TELEMETRY_INT16, &telemetry.set_point},
+	{"Error",           "rad",   1.0f,                                TELEMETRY_FLOAT, &telemetry.error},
+	{"P Scalar",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.p_scalar},
+	{"Proportional",    "",      1.0f,                                TELEMETRY_INT16, &telemetry.proportional},
+	{"I Scalar",        "",      0.1f,                                TELEMETRY_INT16, &telemetry.i_scalar},
+	{"Integral",        "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.integral},
+	{"D Scalar",        "",      1.0f,                                TELEMETRY_INT16, &telemetry.d_scalar},
+	{"Derivative",      "",      1.0f,                                TELEMETRY_FLOAT, &telemetry.derivative},
+	{"Temperature",     "C",     MPU6050_HMC5883L_TEMP_C_PER_LSB,     TELEMETRY_INT16, &telemetry.temperature},
+	{"Sample Interval", "us",    1.0f,                                TELEMETRY_INT16, &telemetry.sample_interval},
+	{"Latency",         "us",    1.0f,                                TELEMETRY_INT16, &telemetry.latency},
+	{"Packet Age",      "us",    1.0f,                                TELEMETRY_FLOAT, &telemetry.packet_age},
+	{"Radio RSSI",      "dBm",   1.0f,                                TELEMETRY_INT16, &telemetry.radio_rssi},
+	{"Radio LQI",       "",      1.0f,                                TELEMETRY_INT8,  &telemetry.radio_lqi},
+	{"Packet Rate",     "Hz",    0.1f,                                TELEMETRY_INT16, &telemetry.packet_rate},
+	{"Radio Loss",      "%",     1.0f,                                TELEMETRY_INT8,  &telemetry.radio_loss}
+};
+
+void process_new_sensor_values(const struct mpu6050_hmc5883l_sample *sample) {
+
+	// convert the readings into G's, Radians per second and Gauss's
+	float accel_x = sample->accel_x * MPU6050_HMC5883L_ACCEL_G_PER_LSB;
+	float accel_y = sample->accel_y * MPU6050_HMC5883L_ACCEL_G_PER_LSB;
+	float accel_z = sample->accel_z * MPU6050_HMC5883L_ACCEL_G_PER_LSB;
+	float gyro_x  = sample->gyro_x  * MPU6050_HMC5883L_GYRO_RAD_PER_LSB;
+	float gyro_y  = sample->gyro_y  * MPU6050_HMC5883L_GYRO_RAD_PER_LSB;
+	float gyro_z  = sample->gyro_z  * MPU6050_HMC5883L_GYRO_RAD_PER_LSB;
+	float magn_x  = sample->magn_x  * MPU6050_HMC5883L_MAGN_GAUSS_PER_LSB;
+	float magn_y  = sample->magn_y  * MPU6050_HMC5883L_MAGN_GAUSS_PER_LSB;
+	float magn_z  = sample->magn_z  * MPU6050_HMC5883L_MAGN_GAUSS_PER_LSB;
+	float temperature = sample->temperature * MPU6050_HMC5883L_TEMP_C_PER_LSB + MPU6050_HMC5883L_TEMP_C_OFFSET;
+
+	// timing: microseconds since the previous sample, and age of the most recent radio packet
+	static uint32_t previous_timestamp = 0;
+	float sample_interval = sample->timestamp - previous_timestamp;
+	uint32_t packet_age = cc2500_get_packet_age(sample->timestamp);
+	previous_timestamp = sample->timestamp;
+
+	// the radio inputs can change in the middle of an update, so use a snapshot
+	struct controller_inputs inputs = {
+		accel_x, accel_y, accel_z,
+		gyro_x, gyro_y, gyro_z,
+		magn_x, magn_y, magn_z,
+		gimbalX, gimbalY,
+		knobLeft, knobMiddle, knobRight
+	};
+	uint8_t new_command = packet_pending;
+	packet_pending = 0;
+	// stale gimbal commands (older than CC2500_PACKET_TIMEOUT) are dropped: the robot stops driving and turning,
+	// and keeps balancing with the last knob settings
+	if(packet_age > CC2500_PACKET_TIMEOUT) {
+		inputs.gimbal_x = 0;
+		inputs.gimbal_y = 0;
+	}
+	struct controller_outputs outputs;
+	controller_update(&inputs, &outputs);
+
+	timer_dual_hbridge_motor_speeds(outputs.motor_a_speed, outputs.motor_b_speed);
+	motors_stopped = outputs.stopped;
+
+	// microseconds from the MPU6050 interrupt to updated motor outputs, and from the radio packet if it's a new one
+	uint32_t motors_updated = timer_microseconds();
+	float latency = motors_updated - sample->timestamp;
+	uint32_t command_age = cc2500_get_packet_age(motors_updated); // 0xFFFFFFFF if no packet or a stale one, not a latency
+	if(new_command && command_age != 0xFFFFFFFF)
+		telemetry_histogram_add(&radio_latency, command_age);
+
+	// report the new values
+	telemetry.accel_x = accel_x;
+	telemetry.accel_y = accel_y;
+	telemetry.accel_z = accel_z;
+	telemetry.gyro_x = gyro_x;
+	telemetry.gyro_y = gyro_y;
+	telemetry.gyro_z = gyro_z;
+	telemetry.pitch = outputs.pitch;
+	telemetry.q0 = q0;
+	telemetry.q1 = q1;
+	telemetry.q2 = q2;
+	telemetry.q3 = q3;
+	telemetry.gimbal_x = inputs.gimbal_x;
+	telemetry.gimbal_y = inputs.gimbal_y;
+	telemetry.knob_left = inputs.knob_left;
+	telemetry.knob_middle = inputs.knob_middle;
+	telemetry.knob_right = inputs.knob_right;
+	telemetry.set_point = outputs.set_point;
+	telemetry.error = outputs.error;
+	telemetry.p_scalar = outputs.p_scalar;
+	telemetry.proportional = outputs.proportional;
+	telemetry.i_scalar = outputs.i_scalar;
+	telemetry.integral = outputs.integral;
+	telemetry.d_scalar = outputs.d_scalar;
+	telemetry.derivative = outputs.derivative;
+	telemetry.temperature = temperature;
+	telemetry.sample_interval = sample_interval;
+	telemetry.latency = latency;
+	telemetry.packet_age = packet_age;
+	const struct cc2500_link_statistics *link = cc2500_get_link_statistics();
+	telemetry.radio_rssi = link->rssi;
+	telemetry.radio_lqi = link->lqi;
+	telemetry.packet_rate = link->packet_rate;
+	telemetry.radio_loss = radio_loss * 100.0f;
+
+#ifdef DASHBOARD
+	// a terminal dashboard instead of binary telemetry, updated with every 4th sample
+	static uint8_t dashboard_divider = 0;
+	if(++dashboard_divider == 4) {
+		dashboard_divider = 0;
+		dashboard_begin();
+		dashboard_graph("Pitch          ", outputs.pitch,         "Rad",   -0.7f,     0.7f);
+		dashboard_graph("Set Point      ", outputs.set_point,     "Rad",   -0.7f,     0.7f);
+		dashboard_graph("Gyro X         ", gyro_x,                "Rad/s", -5.0f,     5.0f);
+		dashboard_graph("Gyro Y         ", gyro_y,                "Rad/s", -5.0f,     5.0f);
+		dashboard_graph("Gyro Z         ", gyro_z,                "Rad/s", -5.0f,     5.0f);
+		dashboard_graph("Proportional   ", outputs.proportional,  "",      -5000.0f,  5000.0f);
+		dashboard_graph("Integral       ", outputs.integral,      "",      -1000.0f,  1000.0f);
+		dashboard_graph("Derivative     ", outputs.derivative,    "",      -5000.0f,  5000.0f);
+		dashboard_graph("Temperature    ", temperature,           "C",     0.0f,      60.0f);
+		dashboard_graph("Latency        ", latency,               "us",    0.0f,      2000.0f);
+		dashboard_end();
+	}
+#else
+	static uint16_t histogram_divider = 0;
+	if(++histogram_divider == HISTOGRAM_PERIOD) {
+		histogram_divider = 0;
+		telemetry_send_histogram(&radio_jitter);
+		telemetry_send_histogram(&radio_latency);
+	}
+	telemetry_send(sample->timestamp);
+#endif
+
+}
+
+
+void process_new_packet(const struct cc2500_packet *packet) {
+
+	uint8_t *bytes = packet->bytes;
+
+	int16_t gimX = (bytes[1] << 8) | bytes[0];
+	int16_t gimY = (bytes[3] << 8) | bytes[2];
+	int16_t knoL = (bytes[5] << 8) | bytes[4];
+	int16_t knoM = (bytes[7] << 8) | bytes[6];
+	int16_t knoR = (bytes[9] << 8) | bytes[8];
+	uint8_t sequence = bytes[10]; // incremented by the transmitter for every packet
+
+	gimbalX    = (float) gimX;
+	gimbalY    = (float) gimY;
+	knobLeft   = (float) knoL;
+	knobMiddle = (float) knoM;
+	knobRight  = (float) knoR;
+	packet_pending = 1;
+
+	// the sequence number counts the packets that never arrived, which the CC2500 can't see without their sync word
+	static uint8_t previous_sequence = 0;
+	static uint32_t previous_timestamp = 0;
+	static float period = 0; // average microseconds between the transmitter's packets
+	uint8_t missed = sequence - previous_sequence - 1;
+	uint32_t interval = packet->timestamp - previous_timestamp;
+
+	// Nothing to compare the first packet with, or the first after the link was lost. A repeated sequence number
+	// (a duplicate, or a transmitter that doesn't number its packets) or a gap longer than the interval allows
+	// can't be measured either, so the sequence is only resynchronized.
+	uint8_t resync = (previous_timestamp == 0 || interval > CC2500_PACKET_TIMEOUT || missed == 255 ||
+	                  (period != 0 && missed > interval / period));
+
+	if(!resync) {
+		// the missed packets count as lost, and this one as received: loss = (1 - (1 - loss) * (1 - weight)^missed) * (1 - weight).
+		// The power is taken by squaring, so this takes at most eight steps whatever the gap.
+		float keep = 1.0f;
+		float factor = 1.0f - CC2500_STATISTICS_WEIGHT;
+		for(uint8_t bits = missed; bits; bits >>= 1) {
+			if(bits & 1)
+				keep *= factor;
+			factor *= factor;
+		}
+		radio_loss = (1.0f - (1.0f - radio_loss) * keep) * (1.0f - CC2500_STATISTICS_WEIGHT);
+
+		float slot_interval = (float) interval / (missed + 1);
+		if(period == 0) {
+			period = slot_interval;
+		} else {
+			telemetry_histogram_add(&radio_jitter, (int32_t) (interval - (missed + 1) * period));
+			period += CC2500_STATISTICS_WEIGHT * (slot_interval - period);
+		}
+	}
+
+	previous_sequence = sequence;
+	previous_timestamp = packet->timestamp;
+
+}
+
+void process_commands(void) {
+
+	uint8_t payload[UART_RX_FRAME_SIZE];
+	uint16_t length;
+
+	while((length = uart_receive_frame(payload, sizeof(payload)))) {
+
+		uint8_t result = 0;
+		float value;
+
+		switch(payload[0]) {
+
+			case COMMAND_SET_PARAMETER:
+				if(length == 6 && payload[1] < PARAMETER_COUNT) {
+					memcpy(&value, &payload[2], sizeof(float));
+					if(isfinite(value)) {
+						controller_parameters[payload[1]] = value;
+						result = 1;
+					}
+				}
+				break;
+
+			case COMMAND_SET_DECIMATION:
+				if(length == 3)
+					result = telemetry_set_decimation(payload[1], payload[2]);
+				break;
+
+			case COMMAND_CALIBRATE_GYRO:
+				// the sensor handler isn't called while calibrating, so nothing else will update the motors
+				if(length == 1) {
+					mpu6050_hmc5883l_calibrate_gyro();
+					timer_dual_hbridge_motor_speeds(0, 0);
+					motors_stopped = 1;
+					result = 1;
+				}
+				break;
+
+			case COMMAND_SEND_SCHEMA:
+				telemetry_send_schema();
+				result = 1;
+				break;
+
+			case COMMAND_CLEAR_HISTOGRAMS:
+				// the radio and sensor handlers add to them
+				__disable_irq();
+				memset(radio_jitter.counts, 0, sizeof(radio_jitter.counts));
+				memset(radio_latency.counts, 0, sizeof(radio_latency.counts));
+				__enable_irq();
+				result = 1;
+				break;
+
+			case COMMAND_SET_GYRO_BIAS:
+				// applied right away, and written to flash by the main loop once the motors are stopped
+				if(length == 5 + 3 * 2 * MPU6050_HMC5883L_BIAS_POINTS) {
+					int16_t start;
+					uint16_t shift;
+					int16_t table[3][MPU6050_HMC5883L_BIAS_POINTS];
+					memcpy(&start, &payload[1], sizeof(start));
+					memcpy(&shift, &payload[3], sizeof(shift));
+					memcpy(table, &payload[5], sizeof(table));
+					result = mpu6050_hmc5883l_set_gyro_bias_table(start, shift, table);
+				}
+				break;
+
+		}
+
+		telemetry_acknowledge(payload[0], result);
+
+	}
+
+}
+
+void main(void) {
+
+	// configure the UART
+	uart_setup(PA9, 921600);
+	uart_receive_setup(PA10);
+	telemetry_setup(telemetry_channels, sizeof(telemetry_channels) / sizeof(telemetry_channels[0]));
+
+	// configure the microsecond timebase used to timestamp sensor readings and radio packets
+	timer_microseconds_setup(TIM15);
+
+	// configure the 9DOF, then the dual h-bridge PWM timer. If the I2C bus can't run at the configured speed
+	// there is nothing to balance with, so the motors are left unpowered
+	if(mpu6050_hmc5883l_setup(PB8, PB9, PB7, &process_new_sensor_values))
+		timer_dual_hbridge_setup(PA0, PA1, PA2, PA3);
+
+	// configure the RF module. Without it the robot still balances, with the gimbals and knobs at their defaults
+	if(cc2500_setup(SPI1, PB3, PB4, PB5, PD2, PC12, 11, &process_new_packet))
+		cc2500_enter_rx_mode();
+
+	// the control loop runs in the ISRs, commands, bus recovery and flash writes are handled here between interrupts
+	while(1) {
+		process_commands();
+		mpu6050_hmc5883l_recover_bus();
+		// flash is a single bank, so erasing a page stalls every interrupt (and the control loop) for 20 - 40ms.
+		// A new calibration is kept in RAM and used right away, and written once the robot has been laid down.
+		if(motors_stopped)
+			mpu6050_hmc5883l_save_pending_calibration();
+		__WFI();
+	}
+
+}